@@ -259,12 +259,8 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
         }
 
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk", __func__);
-
         std::list<PublicCoin> listPubcoins;
-        if (!BlockToPubcoinList(block, listPubcoins, true))
+        if (!BlockIndexToPubcoinList(pindex, listPubcoins))
             return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
 
         nTotalMintsFound += listPubcoins.size();
@@ -336,7 +332,7 @@ int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
     CBlockIndex* pindex = chainActive[GetZerocoinStartHeight()];
     int n = 0;
     while (pindex->nHeight < nHeightEnd) {
-        n += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
+        n += pindex->zerocoinMintsInBlock.count(denom);
         pindex = chainActive.Next(pindex);
     }
 
@@ -350,19 +346,12 @@ int AddBlockMintsToAccumulator(const libzerocoin::PublicCoin& coin, const int nH
     int nMintsAdded = 0;
     if (pindex->MintedDenomination(coin.getDenomination())) {
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk while adding pubcoins to witness", __func__);
-
         list<PublicCoin> listPubcoins;
-        if(!BlockToPubcoinList(block, listPubcoins, true))
+        if(!BlockIndexToPubcoinList(pindex, listPubcoins, coin.getDenomination()))
             return error("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
 
         //add the mints to the witness
         for (const PublicCoin& pubcoin : listPubcoins) {
-            if (pubcoin.getDenomination() != coin.getDenomination())
-                continue;
-
             if (isWitness && pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
                 continue;
 
@@ -400,7 +389,124 @@ bool GetAccumulatorValue(int& nHeight, const libzerocoin::CoinDenomination denom
     return true;
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CBlockIndex* pindexCheckpoint)
+//The height that cached witnesses are accumulated to. It stays behind the stop height of both spends
+//and stakes (whose checkpoint is at least Zerocoin_RequiredStakeDepth deep) so that either can resume from it.
+int GetWitnessStateHeight(int nChainHeight)
+{
+    return nChainHeight - (nChainHeight % 10) - Params().Zerocoin_RequiredStakeDepth() - 10;
+}
+
+bool IsWitnessStateInChain(const CAccumulatorWitnessState& state)
+{
+    if (state.IsNull() || state.nHeightEnd > chainActive.Height())
+        return false;
+
+    return chainActive[state.nHeightEnd - 1]->GetBlockHash() == state.hashBlockLast;
+}
+
+//The witness state of a mint before any block is accumulated into it. It starts from the same accumulator
+//value and height as GenerateAccumulatorWitness does, so that the witness can be advanced from its confirmation on.
+bool InitAccumulatorWitnessState(const uint256& hashPubcoin, const uint256& txidMint, CAccumulatorWitnessState& state)
+{
+    CTransaction txMinted;
+    uint256 hashBlock;
+    if (!GetTransaction(txidMint, txMinted, hashBlock) || !mapBlockIndex.count(hashBlock))
+        return false;
+    CBlockIndex* pindexMint = mapBlockIndex.at(hashBlock);
+    if (!chainActive.Contains(pindexMint))
+        return false;
+
+    libzerocoin::PublicCoin pubcoin(Params().Zerocoin_Params(false));
+    bool fFound = false;
+    for (const CTxOut& out : txMinted.vout) {
+        CValidationState stateMint;
+        if (out.IsZerocoinMint() && TxOutToPublicCoin(out, pubcoin, stateMint) && GetPubCoinHash(pubcoin.getValue()) == hashPubcoin) {
+            fFound = true;
+            break;
+        }
+    }
+    if (!fFound)
+        return false;
+
+    int nHeightMintAdded = pindexMint->nHeight;
+    int nHeightCheckpoint = nHeightMintAdded + (10 - (nHeightMintAdded % 10));
+    CBigNum bnAccValue = 0;
+    if (nHeightCheckpoint > chainActive.Height() || !GetAccumulatorValue(nHeightCheckpoint, pubcoin.getDenomination(), bnAccValue))
+        return false;
+    if (nHeightCheckpoint - 10 < 1)
+        return false;
+
+    state.SetNull();
+    state.bnPubcoin = pubcoin.getValue();
+    state.denom = pubcoin.getDenomination();
+    state.nHeightMintAdded = nHeightMintAdded;
+    state.nHeightAccStart = nHeightMintAdded - (nHeightMintAdded % 10);
+    state.nHeightEnd = nHeightCheckpoint - 10;
+    state.hashBlockLast = chainActive[state.nHeightEnd - 1]->GetBlockHash();
+    state.bnWitness = bnAccValue;
+    return true;
+}
+
+//Accumulate the witnesses up to nHeightEnd, reading each block at most once for all of them.
+//Witnesses that are not in the active chain anymore are set to null.
+bool AdvanceAccumulatorWitnesses(std::vector<CAccumulatorWitnessState>& vWitnessState, int nHeightEnd)
+{
+    int nHeightStart = nHeightEnd;
+    for (CAccumulatorWitnessState& state : vWitnessState) {
+        if (!IsWitnessStateInChain(state)) {
+            state.SetNull();
+            continue;
+        }
+        nHeightStart = std::min(nHeightStart, state.nHeightEnd);
+    }
+
+    if (nHeightEnd > chainActive.Height())
+        return error("%s: height %d is more than active chain height", __func__, nHeightEnd);
+
+    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+    for (CBlockIndex* pindex = chainActive[nHeightStart]; pindex && pindex->nHeight < nHeightEnd; pindex = chainActive.Next(pindex)) {
+        if (ShutdownRequested())
+            return false;
+
+        bool fReadMints = false;
+        list<PublicCoin> listPubcoins;
+        for (CAccumulatorWitnessState& state : vWitnessState) {
+            if (state.IsNull() || state.nHeightEnd != pindex->nHeight)
+                continue;
+
+            if (pindex->nHeight != state.nHeightAccStart && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
+                ++state.nCheckpointsAdded;
+
+            if (pindex->MintedDenomination(state.denom)) {
+                if (!fReadMints) {
+                    if (!BlockIndexToPubcoinList(pindex, listPubcoins))
+                        return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+                    fReadMints = true;
+                }
+
+                libzerocoin::Accumulator witnessAccumulator(params, state.denom, state.bnWitness);
+                for (const PublicCoin& pubcoin : listPubcoins) {
+                    if (pubcoin.getDenomination() != state.denom)
+                        continue;
+
+                    if (pindex->nHeight == state.nHeightMintAdded && pubcoin.getValue() == state.bnPubcoin)
+                        continue;
+
+                    witnessAccumulator.increment(pubcoin.getValue());
+                    ++state.nMintsAdded;
+                }
+                state.bnWitness = witnessAccumulator.getValue();
+            }
+
+            state.nHeightEnd = pindex->nHeight + 1;
+            state.hashBlockLast = pindex->GetBlockHash();
+        }
+    }
+
+    return true;
+}
+
+bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CBlockIndex* pindexCheckpoint, CAccumulatorWitnessState* pWitnessState)
 {
     LogPrint("zero", "%s: generating\n", __func__);
     int nLockAttempts = 0;
@@ -460,7 +566,33 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     RandomizeSecurityLevel(nSecurityLevel); //make security level not always the same and predictable
     libzerocoin::Accumulator witnessAccumulator = accumulator;
 
+    //Resume from a previously accumulated witness if it does not go past where this walk stops
+    CAccumulatorWitnessState stateNew;
+    if (pWitnessState && pWitnessState->bnPubcoin == coin.getValue() && pWitnessState->nHeightMintAdded == nHeightMintAdded &&
+        pWitnessState->nHeightEnd <= nHeightStop && IsWitnessStateInChain(*pWitnessState) &&
+        (nSecurityLevel == 100 || pWitnessState->nCheckpointsAdded < nSecurityLevel)) {
+        pindex = chainActive[pWitnessState->nHeightEnd];
+        witnessAccumulator.setValue(pWitnessState->bnWitness);
+        nMintsAdded = pWitnessState->nMintsAdded;
+        nCheckpointsAdded = pWitnessState->nCheckpointsAdded;
+        LogPrint("zero", "%s: resuming witness from height %d\n", __func__, pWitnessState->nHeightEnd);
+    }
+    int nHeightWitnessState = GetWitnessStateHeight(nChainHeight);
+
     while (pindex) {
+        //Remember the progress up to the witness state height so the next witness can resume from it
+        if (pWitnessState && pindex->nHeight <= nHeightWitnessState && pindex->nHeight > nAccStartHeight) {
+            stateNew.bnPubcoin = coin.getValue();
+            stateNew.denom = coin.getDenomination();
+            stateNew.nHeightMintAdded = nHeightMintAdded;
+            stateNew.nHeightAccStart = nAccStartHeight;
+            stateNew.nHeightEnd = pindex->nHeight;
+            stateNew.hashBlockLast = pindex->pprev->GetBlockHash();
+            stateNew.bnWitness = witnessAccumulator.getValue();
+            stateNew.nMintsAdded = nMintsAdded;
+            stateNew.nCheckpointsAdded = nCheckpointsAdded;
+        }
+
         if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
             ++nCheckpointsAdded;
 
@@ -486,6 +618,9 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     if (!witness.VerifyWitness(accumulator, coin))
         return error("%s: failed to verify witness", __func__);
 
+    if (pWitnessState && !stateNew.IsNull() && (stateNew.nHeightEnd > pWitnessState->nHeightEnd || !IsWitnessStateInChain(*pWitnessState)))
+        *pWitnessState = stateNew;
+
     // A certain amount of accumulated coins are required
     if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
         strError = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
@@ -516,8 +651,7 @@ map<CoinDenomination, int> GetMintMaturityHeight()
         for (auto denom : libzerocoin::zerocoinDenomList) {
             //If the denom has not already had a mint added to it, then see if it has a mint added on this block
             if (mapDenomMaturity.at(denom).first < Params().Zerocoin_RequiredAccumulation()) {
-                mapDenomMaturity.at(denom).first += count(pindex->vMintDenominationsInBlock.begin(),
-                                                          pindex->vMintDenominationsInBlock.end(), denom);
+                mapDenomMaturity.at(denom).first += pindex->zerocoinMintsInBlock.count(denom);
 
                 //if mint was found then record this block as the first block that maturity occurs.
                 if (mapDenomMaturity.at(denom).first >= Params().Zerocoin_RequiredAccumulation())
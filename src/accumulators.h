@@ -15,8 +15,67 @@
 
 class CBlockIndex;
 
+/**
+ * How far the witness of a mint has been accumulated: every mint of the same denomination
+ * in the blocks from the mint's group of ten blocks up to (not including) nHeightEnd.
+ * GenerateAccumulatorWitness resumes from this instead of walking all blocks since the mint.
+ */
+class CAccumulatorWitnessState
+{
+public:
+    CBigNum bnPubcoin;
+    libzerocoin::CoinDenomination denom;
+    int nHeightMintAdded;
+    int nHeightAccStart;
+    int nHeightEnd;
+    uint256 hashBlockLast; // hash of the block at nHeightEnd - 1, used to detect reorgs
+    CBigNum bnWitness;
+    int nMintsAdded;
+    int nCheckpointsAdded;
+
+    CAccumulatorWitnessState()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        bnPubcoin = 0;
+        denom = libzerocoin::ZQ_ERROR;
+        nHeightMintAdded = 0;
+        nHeightAccStart = 0;
+        nHeightEnd = 0;
+        hashBlockLast = 0;
+        bnWitness = 0;
+        nMintsAdded = 0;
+        nCheckpointsAdded = 0;
+    }
+
+    bool IsNull() const { return nHeightEnd == 0; }
+    uint256 GetPubcoinHash() const { return GetPubCoinHash(bnPubcoin); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(bnPubcoin);
+        READWRITE(denom);
+        READWRITE(nHeightMintAdded);
+        READWRITE(nHeightAccStart);
+        READWRITE(nHeightEnd);
+        READWRITE(hashBlockLast);
+        READWRITE(bnWitness);
+        READWRITE(nMintsAdded);
+        READWRITE(nCheckpointsAdded);
+    }
+};
+
 std::map<libzerocoin::CoinDenomination, int> GetMintMaturityHeight();
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CBlockIndex* pindexCheckpoint = nullptr);
+bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CBlockIndex* pindexCheckpoint = nullptr, CAccumulatorWitnessState* pWitnessState = nullptr);
+int GetWitnessStateHeight(int nChainHeight);
+bool IsWitnessStateInChain(const CAccumulatorWitnessState& state);
+bool InitAccumulatorWitnessState(const uint256& hashPubcoin, const uint256& txidMint, CAccumulatorWitnessState& state);
+bool AdvanceAccumulatorWitnesses(std::vector<CAccumulatorWitnessState>& vWitnessState, int nHeightEnd);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
@@ -77,4 +77,36 @@ uint256 CBlockIndex::GetBlockTrust() const
         uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
         return bnPoWTrust > 1 ? bnPoWTrust : 1;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndexArena::~CBlockIndexArena()
+{
+    for (unsigned int i = 0; i < vChunks.size(); i++) {
+        for (size_t j = 0; j < vChunks[i].second; j++)
+            vChunks[i].first[j].~CBlockIndex();
+        ::operator delete(vChunks[i].first);
+    }
+}
+
+void CBlockIndexArena::NewChunk(size_t nSize)
+{
+    CBlockIndex* pchunk = static_cast<CBlockIndex*>(::operator new(nSize * sizeof(CBlockIndex)));
+    vChunks.push_back(make_pair(pchunk, (size_t)0));
+    nCapacity = nSize;
+}
+
+void CBlockIndexArena::Reserve(size_t nCount)
+{
+    if (vChunks.empty() || nCapacity - vChunks.back().second < nCount)
+        NewChunk(std::max(nCount, BLOCK_INDEX_ARENA_CHUNK));
+}
+
+void* CBlockIndexArena::AllocateRaw()
+{
+    if (vChunks.empty() || vChunks.back().second == nCapacity)
+        NewChunk(BLOCK_INDEX_ARENA_CHUNK);
+    return &vChunks.back().first[vChunks.back().second++];
+}
@@ -14,6 +14,7 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <new>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -100,6 +101,151 @@ enum BlockStatus {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/**
+ * Zerocoin supply of each denomination. Kept in a fixed array instead of a map
+ * to save heap allocations in every block index entry, and serialized exactly
+ * like the std::map<CoinDenomination, int64_t> it replaced.
+ */
+class CZerocoinSupply
+{
+private:
+    int64_t nSupply[libzerocoin::ZEROCOIN_DENOMINATIONS];
+
+    static int Index(libzerocoin::CoinDenomination denom)
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (nIndex < 0)
+            throw std::out_of_range("CZerocoinSupply: invalid denomination");
+        return nIndex;
+    }
+
+public:
+    CZerocoinSupply()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATIONS; i++)
+            nSupply[i] = 0;
+    }
+
+    int64_t& at(libzerocoin::CoinDenomination denom) { return nSupply[Index(denom)]; }
+    int64_t at(libzerocoin::CoinDenomination denom) const { return nSupply[Index(denom)]; }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(libzerocoin::ZEROCOIN_DENOMINATIONS) +
+               libzerocoin::ZEROCOIN_DENOMINATIONS * (sizeof(libzerocoin::CoinDenomination) + sizeof(int64_t));
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, libzerocoin::ZEROCOIN_DENOMINATIONS);
+        for (auto& denom : libzerocoin::zerocoinDenomList) {
+            ::Serialize(s, denom, nType, nVersion);
+            ::Serialize(s, at(denom), nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        SetNull();
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nSize; i++) {
+            libzerocoin::CoinDenomination denom;
+            int64_t nValue;
+            ::Unserialize(s, denom, nType, nVersion);
+            ::Unserialize(s, nValue, nType, nVersion);
+            if (libzerocoin::ZerocoinDenominationToIndex(denom) >= 0)
+                at(denom) = nValue;
+        }
+    }
+};
+
+/**
+ * Denominations of the zerocoin mints in a block, stored as a count per
+ * denomination. Serialized like the std::vector<CoinDenomination> it
+ * replaced, with one entry per mint.
+ */
+class CZerocoinMintCounts
+{
+private:
+    uint32_t nCount[libzerocoin::ZEROCOIN_DENOMINATIONS];
+
+public:
+    CZerocoinMintCounts()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATIONS; i++)
+            nCount[i] = 0;
+    }
+
+    void push_back(libzerocoin::CoinDenomination denom)
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (nIndex >= 0)
+            nCount[nIndex]++;
+    }
+
+    uint32_t count(libzerocoin::CoinDenomination denom) const
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return nIndex >= 0 ? nCount[nIndex] : 0;
+    }
+
+    uint64_t size() const
+    {
+        uint64_t nSize = 0;
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATIONS; i++)
+            nSize += nCount[i];
+        return nSize;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    bool operator==(const CZerocoinMintCounts& other) const
+    {
+        return std::equal(nCount, nCount + libzerocoin::ZEROCOIN_DENOMINATIONS, other.nCount);
+    }
+
+    bool operator!=(const CZerocoinMintCounts& other) const { return !(*this == other); }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(size()) + size() * sizeof(libzerocoin::CoinDenomination);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, size());
+        for (auto& denom : libzerocoin::zerocoinDenomList) {
+            for (uint32_t i = 0; i < count(denom); i++)
+                ::Serialize(s, denom, nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        clear();
+        uint64_t nSize = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nSize; i++) {
+            libzerocoin::CoinDenomination denom;
+            ::Unserialize(s, denom, nType, nVersion);
+            push_back(denom);
+        }
+    }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -179,8 +325,8 @@ public:
     uint32_t nSequenceId;
     
     //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
-    std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    CZerocoinSupply zerocoinSupply;
+    CZerocoinMintCounts zerocoinMintsInBlock;
     
     void SetNull()
     {
@@ -212,10 +358,8 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(make_pair(denom, 0));
-        }
-        vMintDenominationsInBlock.clear();
+        zerocoinSupply.SetNull();
+        zerocoinMintsInBlock.clear();
     }
 
     CBlockIndex()
@@ -293,14 +437,14 @@ public:
     {
         int64_t nTotal = 0;
         for (auto& denom : libzerocoin::zerocoinDenomList) {
-            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * mapZerocoinSupply.at(denom);
+            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * zerocoinSupply.at(denom);
         }
         return nTotal;
     }
 
     bool MintedDenomination(libzerocoin::CoinDenomination denom) const
     {
-        return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
+        return zerocoinMintsInBlock.count(denom) > 0;
     }
 
     uint256 GetBlockHash() const
@@ -472,8 +616,8 @@ public:
         READWRITE(nNonce);
         if(this->nVersion > 3) {
             READWRITE(nAccumulatorCheckpoint);
-            READWRITE(mapZerocoinSupply);
-            READWRITE(vMintDenominationsInBlock);
+            READWRITE(zerocoinSupply);
+            READWRITE(zerocoinMintsInBlock);
         }
 
     }
@@ -503,6 +647,39 @@ public:
     }
 };
 
+/** Number of CBlockIndex objects allocated at once by CBlockIndexArena */
+static const size_t BLOCK_INDEX_ARENA_CHUNK = 4096;
+
+/**
+ * Allocates CBlockIndex objects in large contiguous chunks instead of one heap
+ * allocation each. Objects live until the arena itself is destroyed; there is
+ * no way to free a single entry, matching how mapBlockIndex never erases.
+ */
+class CBlockIndexArena
+{
+public:
+    CBlockIndexArena() : nCapacity(0) {}
+    ~CBlockIndexArena();
+
+    CBlockIndex* Allocate() { return new (AllocateRaw()) CBlockIndex(); }
+    CBlockIndex* Allocate(const CBlockHeader& block) { return new (AllocateRaw()) CBlockIndex(block); }
+
+    /** Make room for at least nCount more objects in a single chunk */
+    void Reserve(size_t nCount);
+
+private:
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+
+    void* AllocateRaw();
+    void NewChunk(size_t nSize);
+
+    //! chunks and the number of objects constructed in each
+    std::vector<std::pair<CBlockIndex*, size_t> > vChunks;
+    //! number of objects the last chunk can hold
+    size_t nCapacity;
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain
 {
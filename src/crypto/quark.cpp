@@ -0,0 +1,229 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/masterstake-config.h"
+#endif
+
+#include "crypto/quark.h"
+
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_skein.h"
+
+#include <string.h>
+
+#if defined(ENABLE_AVX2) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#include <cpuid.h>
+#define HAVE_QUARK_AVX2 1
+
+namespace quark_avx2
+{
+void Blake512_4way(unsigned char* out, const unsigned char* in, size_t len);
+void Bmw512_4way(unsigned char* out, const unsigned char* in);
+void Jh512_4way(unsigned char* out, const unsigned char* in);
+void Keccak512_4way(unsigned char* out, const unsigned char* in);
+void Skein512_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+// Internal implementation code.
+namespace
+{
+void Blake512(unsigned char* out, const unsigned char* in, size_t len)
+{
+    sph_blake512_context ctx;
+    sph_blake512_init(&ctx);
+    sph_blake512(&ctx, in, len);
+    sph_blake512_close(&ctx, out);
+}
+
+void Bmw512(unsigned char* out, const unsigned char* in)
+{
+    sph_bmw512_context ctx;
+    sph_bmw512_init(&ctx);
+    sph_bmw512(&ctx, in, 64);
+    sph_bmw512_close(&ctx, out);
+}
+
+void Groestl512(unsigned char* out, const unsigned char* in)
+{
+    sph_groestl512_context ctx;
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, in, 64);
+    sph_groestl512_close(&ctx, out);
+}
+
+void Jh512(unsigned char* out, const unsigned char* in)
+{
+    sph_jh512_context ctx;
+    sph_jh512_init(&ctx);
+    sph_jh512(&ctx, in, 64);
+    sph_jh512_close(&ctx, out);
+}
+
+void Keccak512(unsigned char* out, const unsigned char* in)
+{
+    sph_keccak512_context ctx;
+    sph_keccak512_init(&ctx);
+    sph_keccak512(&ctx, in, 64);
+    sph_keccak512_close(&ctx, out);
+}
+
+void Skein512(unsigned char* out, const unsigned char* in)
+{
+    sph_skein512_context ctx;
+    sph_skein512_init(&ctx);
+    sph_skein512(&ctx, in, 64);
+    sph_skein512_close(&ctx, out);
+}
+
+/** The branch condition of HashQuark: bit 3 of the little-endian 512 bit value. */
+bool inline QuarkBranch(const unsigned char* hash)
+{
+    return (hash[0] & 8) != 0;
+}
+
+/** One header, one primitive at a time; the same chain as HashQuark in hash.h. */
+void Quark80(unsigned char* out, const unsigned char* in)
+{
+    unsigned char a[64], b[64];
+
+    Blake512(a, in, QUARK_HEADER_SIZE);
+    Bmw512(b, a);
+    if (QuarkBranch(b))
+        Groestl512(a, b);
+    else
+        Skein512(a, b);
+    Groestl512(b, a);
+    Jh512(a, b);
+    if (QuarkBranch(a))
+        Blake512(b, a, 64);
+    else
+        Bmw512(b, a);
+    Keccak512(a, b);
+    Skein512(b, a);
+    if (QuarkBranch(b))
+        Keccak512(a, b);
+    else
+        Jh512(a, b);
+    memcpy(out, a, 32);
+}
+
+#ifdef HAVE_QUARK_AVX2
+/** Bitmask of the lanes of a 4-way buffer that take the first branch. */
+int inline QuarkBranch4(const unsigned char* hash)
+{
+    int nMask = 0;
+    for (int l = 0; l < 4; l++)
+        if (QuarkBranch(hash + 64 * l))
+            nMask |= 1 << l;
+    return nMask;
+}
+
+/** Copy the lanes selected by nMask from one 4-way buffer to another. */
+void inline SelectLanes(unsigned char* dst, const unsigned char* src, int nMask)
+{
+    for (int l = 0; l < 4; l++)
+        if (nMask & (1 << l))
+            memcpy(dst + 64 * l, src + 64 * l, 64);
+}
+
+/**
+ * Four headers at a time. Every primitive except Groestl runs 4-way; at a
+ * branch both sides are computed 4-way unless all lanes agree, and each lane
+ * keeps its own result.
+ */
+void Quark80_4way_avx2(unsigned char* out, const unsigned char* in)
+{
+    unsigned char a[256], b[256], c[256];
+    int nMask;
+
+    quark_avx2::Blake512_4way(a, in, QUARK_HEADER_SIZE);
+    quark_avx2::Bmw512_4way(b, a);
+    nMask = QuarkBranch4(b);
+    if (nMask != 0xF)
+        quark_avx2::Skein512_4way(a, b);
+    for (int l = 0; l < 4; l++)
+        if (nMask & (1 << l))
+            Groestl512(a + 64 * l, b + 64 * l);
+    for (int l = 0; l < 4; l++)
+        Groestl512(b + 64 * l, a + 64 * l);
+    quark_avx2::Jh512_4way(a, b);
+    nMask = QuarkBranch4(a);
+    if (nMask != 0xF)
+        quark_avx2::Bmw512_4way(b, a);
+    if (nMask != 0) {
+        quark_avx2::Blake512_4way(c, a, 64);
+        SelectLanes(b, c, nMask);
+    }
+    quark_avx2::Keccak512_4way(a, b);
+    quark_avx2::Skein512_4way(b, a);
+    nMask = QuarkBranch4(b);
+    if (nMask != 0xF)
+        quark_avx2::Jh512_4way(a, b);
+    if (nMask != 0) {
+        quark_avx2::Keccak512_4way(c, b);
+        SelectLanes(a, c, nMask);
+    }
+    for (int l = 0; l < 4; l++)
+        memcpy(out + 32 * l, a + 64 * l, 32);
+}
+
+bool AVX2Enabled()
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid(1, eax, ebx, ecx, edx);
+    // The OS must save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2).
+    if (!(ecx & (1 << 27)))
+        return false;
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 5)) != 0;
+}
+#endif
+
+typedef void (*Quark80_4wayFn)(unsigned char* out, const unsigned char* in);
+
+/** The 4-way implementation in use, if any. Set by QuarkAutoDetect. */
+Quark80_4wayFn Quark80_4way = NULL;
+
+} // namespace
+
+void QuarkHash80N(unsigned char* out, const unsigned char* in, size_t n)
+{
+    if (Quark80_4way) {
+        while (n >= 4) {
+            Quark80_4way(out, in);
+            out += 4 * 32;
+            in += 4 * QUARK_HEADER_SIZE;
+            n -= 4;
+        }
+    }
+    while (n > 0) {
+        Quark80(out, in);
+        out += 32;
+        in += QUARK_HEADER_SIZE;
+        n--;
+    }
+}
+
+std::string QuarkAutoDetect()
+{
+#ifdef HAVE_QUARK_AVX2
+    if (AVX2Enabled()) {
+        Quark80_4way = Quark80_4way_avx2;
+        return "avx2(4way)";
+    }
+#endif
+    return "standard";
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_QUARK_H
+#define BITCOIN_CRYPTO_QUARK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Size of the serialized block header hashed by QuarkHash80N. */
+static const size_t QUARK_HEADER_SIZE = 80;
+
+/**
+ * Compute the Quark hashes of n consecutive 80 byte block headers, writing
+ * n 32 byte hashes to out. Identical to calling HashQuark on each header, but
+ * hashes several headers at once when a vectorized implementation is active.
+ */
+void QuarkHash80N(unsigned char* out, const unsigned char* in, size_t n);
+
+/** Select the fastest Quark implementation this CPU supports. Returns its name. */
+std::string QuarkAutoDetect();
+
+#endif // BITCOIN_CRYPTO_QUARK_H
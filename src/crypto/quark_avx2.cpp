@@ -0,0 +1,512 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way AVX2 versions of the 512-bit Quark primitives. Each 256-bit register
+// holds the same 64-bit state word for four independent messages, so every
+// function here hashes four equally sized messages at once. The results are
+// bit-identical to the sph implementations in this directory.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace quark_avx2
+{
+namespace
+{
+__m256i inline K(uint64_t x) { return _mm256_set1_epi64x(x); }
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+__m256i inline Sub(__m256i x, __m256i y) { return _mm256_sub_epi64(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+/** ~x & y */
+__m256i inline AndNot(__m256i x, __m256i y) { return _mm256_andnot_si256(x, y); }
+__m256i inline Not(__m256i x) { return Xor(x, K(~(uint64_t)0)); }
+__m256i inline ShL(__m256i x, int n) { return _mm256_slli_epi64(x, n); }
+__m256i inline ShR(__m256i x, int n) { return _mm256_srli_epi64(x, n); }
+__m256i inline RotL(__m256i x, int n) { return Or(ShL(x, n), ShR(x, 64 - n)); }
+__m256i inline RotR(__m256i x, int n) { return Or(ShR(x, n), ShL(x, 64 - n)); }
+
+/** Gather word i of each lane's message, lanes being nStride bytes apart. */
+__m256i inline LoadLE(const unsigned char* in, size_t nStride, int i)
+{
+    return _mm256_set_epi64x(ReadLE64(in + 3 * nStride + 8 * i), ReadLE64(in + 2 * nStride + 8 * i),
+                             ReadLE64(in + nStride + 8 * i), ReadLE64(in + 8 * i));
+}
+
+__m256i inline LoadBE(const unsigned char* in, size_t nStride, int i)
+{
+    return _mm256_set_epi64x(ReadBE64(in + 3 * nStride + 8 * i), ReadBE64(in + 2 * nStride + 8 * i),
+                             ReadBE64(in + nStride + 8 * i), ReadBE64(in + 8 * i));
+}
+
+/** Scatter word i back into each lane's 64 byte output. */
+void inline StoreLE(unsigned char* out, int i, __m256i x)
+{
+    uint64_t v[4];
+    _mm256_storeu_si256((__m256i*)v, x);
+    for (int l = 0; l < 4; l++)
+        WriteLE64(out + 64 * l + 8 * i, v[l]);
+}
+
+void inline StoreBE(unsigned char* out, int i, __m256i x)
+{
+    uint64_t v[4];
+    _mm256_storeu_si256((__m256i*)v, x);
+    for (int l = 0; l < 4; l++)
+        WriteBE64(out + 64 * l + 8 * i, v[l]);
+}
+
+/* ----------- BLAKE-512 ------------------------------------------------- */
+
+const uint64_t BLAKE_IV[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+
+const uint64_t BLAKE_CB[16] = {
+    0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+    0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+    0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL, 0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+    0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL, 0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL};
+
+const unsigned char BLAKE_SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+void inline BlakeG(__m256i* v, const __m256i* m, const unsigned char* s, int a, int b, int c, int d, int i)
+{
+    v[a] = Add(Add(v[a], v[b]), Xor(m[s[2 * i]], K(BLAKE_CB[s[2 * i + 1]])));
+    v[d] = RotR(Xor(v[d], v[a]), 32);
+    v[c] = Add(v[c], v[d]);
+    v[b] = RotR(Xor(v[b], v[c]), 25);
+    v[a] = Add(Add(v[a], v[b]), Xor(m[s[2 * i + 1]], K(BLAKE_CB[s[2 * i]])));
+    v[d] = RotR(Xor(v[d], v[a]), 16);
+    v[c] = Add(v[c], v[d]);
+    v[b] = RotR(Xor(v[b], v[c]), 11);
+}
+
+/* ----------- BMW-512 --------------------------------------------------- */
+
+const uint64_t BMW_IV[16] = {
+    0x8081828384858687ULL, 0x88898A8B8C8D8E8FULL, 0x9091929394959697ULL, 0x98999A9B9C9D9E9FULL,
+    0xA0A1A2A3A4A5A6A7ULL, 0xA8A9AAABACADAEAFULL, 0xB0B1B2B3B4B5B6B7ULL, 0xB8B9BABBBCBDBEBFULL,
+    0xC0C1C2C3C4C5C6C7ULL, 0xC8C9CACBCCCDCECFULL, 0xD0D1D2D3D4D5D6D7ULL, 0xD8D9DADBDCDDDEDFULL,
+    0xE0E1E2E3E4E5E6E7ULL, 0xE8E9EAEBECEDEEEFULL, 0xF0F1F2F3F4F5F6F7ULL, 0xF8F9FAFBFCFDFEFFULL};
+
+/** Operand indices and signs of the W_j terms (f0 in the specification). */
+const unsigned char BMW_WIDX[16][5] = {
+    {5, 7, 10, 13, 14}, {6, 8, 11, 14, 15}, {0, 7, 9, 12, 15}, {0, 1, 8, 10, 13},
+    {1, 2, 9, 11, 14}, {3, 2, 10, 12, 15}, {4, 0, 3, 11, 13}, {1, 4, 5, 12, 14},
+    {2, 5, 6, 13, 15}, {0, 3, 6, 7, 14}, {8, 1, 4, 7, 15}, {8, 0, 2, 5, 9},
+    {1, 3, 6, 9, 10}, {2, 4, 7, 10, 11}, {3, 5, 8, 11, 12}, {12, 4, 6, 9, 13}};
+const char BMW_WSIGN[16][4] = {
+    {'-', '+', '+', '+'}, {'-', '+', '+', '-'}, {'+', '+', '-', '+'}, {'-', '+', '-', '+'},
+    {'+', '+', '-', '-'}, {'-', '+', '-', '+'}, {'-', '-', '-', '+'}, {'-', '-', '-', '-'},
+    {'-', '-', '+', '-'}, {'-', '+', '-', '+'}, {'-', '-', '-', '+'}, {'-', '-', '-', '+'},
+    {'+', '-', '-', '+'}, {'+', '+', '+', '+'}, {'-', '+', '-', '-'}, {'-', '-', '-', '+'}};
+
+__m256i inline BmwS0(__m256i x) { return Xor(Xor(ShR(x, 1), ShL(x, 3)), Xor(RotL(x, 4), RotL(x, 37))); }
+__m256i inline BmwS1(__m256i x) { return Xor(Xor(ShR(x, 1), ShL(x, 2)), Xor(RotL(x, 13), RotL(x, 43))); }
+__m256i inline BmwS2(__m256i x) { return Xor(Xor(ShR(x, 2), ShL(x, 1)), Xor(RotL(x, 19), RotL(x, 53))); }
+__m256i inline BmwS3(__m256i x) { return Xor(Xor(ShR(x, 2), ShL(x, 2)), Xor(RotL(x, 28), RotL(x, 59))); }
+__m256i inline BmwS4(__m256i x) { return Xor(ShR(x, 1), x); }
+__m256i inline BmwS5(__m256i x) { return Xor(ShR(x, 2), x); }
+
+__m256i inline BmwS(int i, __m256i x)
+{
+    switch (i) {
+    case 0: return BmwS0(x);
+    case 1: return BmwS1(x);
+    case 2: return BmwS2(x);
+    case 3: return BmwS3(x);
+    default: return BmwS4(x);
+    }
+}
+
+__m256i inline BmwAddElt(const __m256i* m, const __m256i* h, int j)
+{
+    int j3 = (j + 3) & 15, j10 = (j + 10) & 15;
+    __m256i x = Sub(Add(RotL(m[j], j + 1), RotL(m[j3], j3 + 1)), RotL(m[j10], j10 + 1));
+    return Xor(Add(x, K((uint64_t)(j + 16) * 0x0555555555555555ULL)), h[(j + 7) & 15]);
+}
+
+void BmwCompress(const __m256i* m, const __m256i* h, __m256i* dh)
+{
+    __m256i q[32];
+    for (int j = 0; j < 16; j++) {
+        const unsigned char* idx = BMW_WIDX[j];
+        __m256i w = Xor(m[idx[0]], h[idx[0]]);
+        for (int k = 0; k < 4; k++) {
+            __m256i t = Xor(m[idx[k + 1]], h[idx[k + 1]]);
+            w = BMW_WSIGN[j][k] == '+' ? Add(w, t) : Sub(w, t);
+        }
+        q[j] = Add(BmwS(j == 15 ? 0 : j % 5, w), h[(j + 1) & 15]);
+    }
+    for (int i = 16; i < 18; i++) {
+        __m256i x = BmwAddElt(m, h, i - 16);
+        for (int k = 0; k < 16; k++)
+            x = Add(x, BmwS((k + 1) & 3, q[i - 16 + k]));
+        q[i] = x;
+    }
+    for (int i = 18; i < 32; i++) {
+        __m256i x = BmwAddElt(m, h, i - 16);
+        x = Add(x, Add(q[i - 16], RotL(q[i - 15], 5)));
+        x = Add(x, Add(q[i - 14], RotL(q[i - 13], 11)));
+        x = Add(x, Add(q[i - 12], RotL(q[i - 11], 27)));
+        x = Add(x, Add(q[i - 10], RotL(q[i - 9], 32)));
+        x = Add(x, Add(q[i - 8], RotL(q[i - 7], 37)));
+        x = Add(x, Add(q[i - 6], RotL(q[i - 5], 43)));
+        x = Add(x, Add(q[i - 4], RotL(q[i - 3], 53)));
+        q[i] = Add(x, Add(BmwS4(q[i - 2]), BmwS5(q[i - 1])));
+    }
+
+    __m256i xl = Xor(Xor(Xor(q[16], q[17]), Xor(q[18], q[19])), Xor(Xor(q[20], q[21]), Xor(q[22], q[23])));
+    __m256i xh = Xor(xl, Xor(Xor(Xor(q[24], q[25]), Xor(q[26], q[27])), Xor(Xor(q[28], q[29]), Xor(q[30], q[31]))));
+    dh[0] = Add(Xor(ShL(xh, 5), ShR(q[16], 5), m[0]), Xor(xl, q[24], q[0]));
+    dh[1] = Add(Xor(ShR(xh, 7), ShL(q[17], 8), m[1]), Xor(xl, q[25], q[1]));
+    dh[2] = Add(Xor(ShR(xh, 5), ShL(q[18], 5), m[2]), Xor(xl, q[26], q[2]));
+    dh[3] = Add(Xor(ShR(xh, 1), ShL(q[19], 5), m[3]), Xor(xl, q[27], q[3]));
+    dh[4] = Add(Xor(ShR(xh, 3), q[20], m[4]), Xor(xl, q[28], q[4]));
+    dh[5] = Add(Xor(ShL(xh, 6), ShR(q[21], 6), m[5]), Xor(xl, q[29], q[5]));
+    dh[6] = Add(Xor(ShR(xh, 4), ShL(q[22], 6), m[6]), Xor(xl, q[30], q[6]));
+    dh[7] = Add(Xor(ShR(xh, 11), ShL(q[23], 2), m[7]), Xor(xl, q[31], q[7]));
+    dh[8] = Add(Add(RotL(dh[4], 9), Xor(xh, q[24], m[8])), Xor(ShL(xl, 8), q[23], q[8]));
+    dh[9] = Add(Add(RotL(dh[5], 10), Xor(xh, q[25], m[9])), Xor(ShR(xl, 6), q[16], q[9]));
+    dh[10] = Add(Add(RotL(dh[6], 11), Xor(xh, q[26], m[10])), Xor(ShL(xl, 6), q[17], q[10]));
+    dh[11] = Add(Add(RotL(dh[7], 12), Xor(xh, q[27], m[11])), Xor(ShL(xl, 4), q[18], q[11]));
+    dh[12] = Add(Add(RotL(dh[0], 13), Xor(xh, q[28], m[12])), Xor(ShR(xl, 3), q[19], q[12]));
+    dh[13] = Add(Add(RotL(dh[1], 14), Xor(xh, q[29], m[13])), Xor(ShR(xl, 4), q[20], q[13]));
+    dh[14] = Add(Add(RotL(dh[2], 15), Xor(xh, q[30], m[14])), Xor(ShR(xl, 7), q[21], q[14]));
+    dh[15] = Add(Add(RotL(dh[3], 16), Xor(xh, q[31], m[15])), Xor(ShR(xl, 2), q[22], q[15]));
+}
+
+/* ----------- JH-512 ---------------------------------------------------- */
+
+const uint64_t JH_IV[16] = {
+    0x6fd14b963e00aa17ULL, 0x636a2e057a15d543ULL, 0x8a225e8d0c97ef0bULL, 0xe9341259f2b3c361ULL,
+    0x891da0c1536f801eULL, 0x2aa9056bea2b6d80ULL, 0x588eccdb2075baa6ULL, 0xa90f3a76baf83bf7ULL,
+    0x0169e60541e34a69ULL, 0x46b58a8e2e6fe65aULL, 0x1047a7d0c1843c24ULL, 0x3b6e71b12d5ac199ULL,
+    0xcf57f6ec9db1f856ULL, 0xa706887c5716b156ULL, 0xe3c2fcdfe68517fbULL, 0x545a4678cc8cdd4bULL};
+
+const uint64_t JH_C[168] = {
+    0x72d5dea2df15f867ULL, 0x7b84150ab7231557ULL, 0x81abd6904d5a87f6ULL, 0x4e9f4fc5c3d12b40ULL,
+    0xea983ae05c45fa9cULL, 0x03c5d29966b2999aULL, 0x660296b4f2bb538aULL, 0xb556141a88dba231ULL,
+    0x03a35a5c9a190edbULL, 0x403fb20a87c14410ULL, 0x1c051980849e951dULL, 0x6f33ebad5ee7cddcULL,
+    0x10ba139202bf6b41ULL, 0xdc786515f7bb27d0ULL, 0x0a2c813937aa7850ULL, 0x3f1abfd2410091d3ULL,
+    0x422d5a0df6cc7e90ULL, 0xdd629f9c92c097ceULL, 0x185ca70bc72b44acULL, 0xd1df65d663c6fc23ULL,
+    0x976e6c039ee0b81aULL, 0x2105457e446ceca8ULL, 0xeef103bb5d8e61faULL, 0xfd9697b294838197ULL,
+    0x4a8e8537db03302fULL, 0x2a678d2dfb9f6a95ULL, 0x8afe7381f8b8696cULL, 0x8ac77246c07f4214ULL,
+    0xc5f4158fbdc75ec4ULL, 0x75446fa78f11bb80ULL, 0x52de75b7aee488bcULL, 0x82b8001e98a6a3f4ULL,
+    0x8ef48f33a9a36315ULL, 0xaa5f5624d5b7f989ULL, 0xb6f1ed207c5ae0fdULL, 0x36cae95a06422c36ULL,
+    0xce2935434efe983dULL, 0x533af974739a4ba7ULL, 0xd0f51f596f4e8186ULL, 0x0e9dad81afd85a9fULL,
+    0xa7050667ee34626aULL, 0x8b0b28be6eb91727ULL, 0x47740726c680103fULL, 0xe0a07e6fc67e487bULL,
+    0x0d550aa54af8a4c0ULL, 0x91e3e79f978ef19eULL, 0x8676728150608dd4ULL, 0x7e9e5a41f3e5b062ULL,
+    0xfc9f1fec4054207aULL, 0xe3e41a00cef4c984ULL, 0x4fd794f59dfa95d8ULL, 0x552e7e1124c354a5ULL,
+    0x5bdf7228bdfe6e28ULL, 0x78f57fe20fa5c4b2ULL, 0x05897cefee49d32eULL, 0x447e9385eb28597fULL,
+    0x705f6937b324314aULL, 0x5e8628f11dd6e465ULL, 0xc71b770451b920e7ULL, 0x74fe43e823d4878aULL,
+    0x7d29e8a3927694f2ULL, 0xddcb7a099b30d9c1ULL, 0x1d1b30fb5bdc1be0ULL, 0xda24494ff29c82bfULL,
+    0xa4e7ba31b470bfffULL, 0x0d324405def8bc48ULL, 0x3baefc3253bbd339ULL, 0x459fc3c1e0298ba0ULL,
+    0xe5c905fdf7ae090fULL, 0x947034124290f134ULL, 0xa271b701e344ed95ULL, 0xe93b8e364f2f984aULL,
+    0x88401d63a06cf615ULL, 0x47c1444b8752afffULL, 0x7ebb4af1e20ac630ULL, 0x4670b6c5cc6e8ce6ULL,
+    0xa4d5a456bd4fca00ULL, 0xda9d844bc83e18aeULL, 0x7357ce453064d1adULL, 0xe8a6ce68145c2567ULL,
+    0xa3da8cf2cb0ee116ULL, 0x33e906589a94999aULL, 0x1f60b220c26f847bULL, 0xd1ceac7fa0d18518ULL,
+    0x32595ba18ddd19d3ULL, 0x509a1cc0aaa5b446ULL, 0x9f3d6367e4046bbaULL, 0xf6ca19ab0b56ee7eULL,
+    0x1fb179eaa9282174ULL, 0xe9bdf7353b3651eeULL, 0x1d57ac5a7550d376ULL, 0x3a46c2fea37d7001ULL,
+    0xf735c1af98a4d842ULL, 0x78edec209e6b6779ULL, 0x41836315ea3adba8ULL, 0xfac33b4d32832c83ULL,
+    0xa7403b1f1c2747f3ULL, 0x5940f034b72d769aULL, 0xe73e4e6cd2214ffdULL, 0xb8fd8d39dc5759efULL,
+    0x8d9b0c492b49ebdaULL, 0x5ba2d74968f3700dULL, 0x7d3baed07a8d5584ULL, 0xf5a5e9f0e4f88e65ULL,
+    0xa0b8a2f436103b53ULL, 0x0ca8079e753eec5aULL, 0x9168949256e8884fULL, 0x5bb05c55f8babc4cULL,
+    0xe3bb3b99f387947bULL, 0x75daf4d6726b1c5dULL, 0x64aeac28dc34b36dULL, 0x6c34a550b828db71ULL,
+    0xf861e2f2108d512aULL, 0xe3db643359dd75fcULL, 0x1cacbcf143ce3fa2ULL, 0x67bbd13c02e843b0ULL,
+    0x330a5bca8829a175ULL, 0x7f34194db416535cULL, 0x923b94c30e794d1eULL, 0x797475d7b6eeaf3fULL,
+    0xeaa8d4f7be1a3921ULL, 0x5cf47e094c232751ULL, 0x26a32453ba323cd2ULL, 0x44a3174a6da6d5adULL,
+    0xb51d3ea6aff2c908ULL, 0x83593d98916b3c56ULL, 0x4cf87ca17286604dULL, 0x46e23ecc086ec7f6ULL,
+    0x2f9833b3b1bc765eULL, 0x2bd666a5efc4e62aULL, 0x06f4b6e8bec1d436ULL, 0x74ee8215bcef2163ULL,
+    0xfdc14e0df453c969ULL, 0xa77d5ac406585826ULL, 0x7ec1141606e0fa16ULL, 0x7e90af3d28639d3fULL,
+    0xd2c9f2e3009bd20cULL, 0x5faace30b7d40c30ULL, 0x742a5116f2e03298ULL, 0x0deb30d8e3cef89aULL,
+    0x4bc59e7bb5f17992ULL, 0xff51e66e048668d3ULL, 0x9b234d57e6966731ULL, 0xcce6a6f3170a7505ULL,
+    0xb17681d913326cceULL, 0x3c175284f805a262ULL, 0xf42bcbb378471547ULL, 0xff46548223936a48ULL,
+    0x38df58074e5e6565ULL, 0xf2fc7c89fc86508eULL, 0x31702e44d00bca86ULL, 0xf04009a23078474eULL,
+    0x65a0ee39d1f73883ULL, 0xf75ee937e42c3abdULL, 0x2197b2260113f86fULL, 0xa344edd1ef9fdee7ULL,
+    0x8ba0df15762592d9ULL, 0x3c85f7f612dc42beULL, 0xd8a7ec7cab27b07eULL, 0x538d7ddaaa3ea8deULL,
+    0xaa25ce93bd0269d8ULL, 0x5af643fd1a7308f9ULL, 0xc05fefda174a19a5ULL, 0x974d66334cfd216aULL,
+    0x35b49831db411570ULL, 0xea1e0fbbedcd549bULL, 0x9ad063a151974072ULL, 0xf6759dbf91476fe2ULL};
+
+/** One S-box layer on four bit-sliced words, with round constant c. */
+void inline JhSb(__m256i& x0, __m256i& x1, __m256i& x2, __m256i& x3, __m256i c)
+{
+    x3 = Not(x3);
+    x0 = Xor(x0, AndNot(x2, c));
+    __m256i tmp = Xor(c, And(x0, x1));
+    x0 = Xor(x0, And(x2, x3));
+    x3 = Xor(x3, AndNot(x1, x2));
+    x1 = Xor(x1, And(x0, x2));
+    x2 = Xor(x2, AndNot(x3, x0));
+    x0 = Xor(x0, Or(x1, x3));
+    x3 = Xor(x3, And(x1, x2));
+    x1 = Xor(x1, And(tmp, x0));
+    x2 = Xor(x2, tmp);
+}
+
+/** The linear transformation L (an MDS code over GF(2^4)). */
+void inline JhLb(__m256i& x0, __m256i& x1, __m256i& x2, __m256i& x3, __m256i& x4, __m256i& x5, __m256i& x6, __m256i& x7)
+{
+    x4 = Xor(x4, x1);
+    x5 = Xor(x5, x2);
+    x6 = Xor(x6, x3, x0);
+    x7 = Xor(x7, x0);
+    x0 = Xor(x0, x5);
+    x1 = Xor(x1, x6);
+    x2 = Xor(x2, x7, x4);
+    x3 = Xor(x3, x4);
+}
+
+/** Swap adjacent bit groups of n bits within a word (permutation omega_ro). */
+void inline JhW(__m256i* hx, int ro)
+{
+    static const uint64_t MASK[6] = {
+        0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+        0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
+    if (ro == 6) {
+        __m256i t = hx[0];
+        hx[0] = hx[1];
+        hx[1] = t;
+        return;
+    }
+    __m256i c = K(MASK[ro]);
+    int n = 1 << ro;
+    for (int i = 0; i < 2; i++)
+        hx[i] = Or(And(ShR(hx[i], n), c), ShL(And(hx[i], c), n));
+}
+
+/**
+ * The E8 bijection. h[2 * i] and h[2 * i + 1] are the high and low halves of
+ * the 128-bit state word i, as in the sph code.
+ */
+void JhE8(__m256i* h)
+{
+    for (int r = 0; r < 42; r++) {
+        const uint64_t* c = JH_C + 4 * r;
+        JhSb(h[0], h[4], h[8], h[12], K(c[0]));
+        JhSb(h[1], h[5], h[9], h[13], K(c[1]));
+        JhSb(h[2], h[6], h[10], h[14], K(c[2]));
+        JhSb(h[3], h[7], h[11], h[15], K(c[3]));
+        JhLb(h[0], h[4], h[8], h[12], h[2], h[6], h[10], h[14]);
+        JhLb(h[1], h[5], h[9], h[13], h[3], h[7], h[11], h[15]);
+        for (int i = 2; i < 16; i += 4)
+            JhW(h + i, r % 7);
+    }
+}
+
+/* ----------- Keccak-512 ------------------------------------------------ */
+
+const uint64_t KECCAK_RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
+
+/** Rotation offsets, indexed by x + 5 * y. */
+const unsigned char KECCAK_RHO[25] = {
+    0, 1, 62, 28, 27, 36, 44, 6, 55, 20, 3, 10, 43, 25, 39, 41, 45, 15, 21, 8, 18, 2, 61, 56, 14};
+
+void KeccakF(__m256i* a)
+{
+    __m256i b[25], c[5], d[5];
+    for (int r = 0; r < 24; r++) {
+        for (int x = 0; x < 5; x++)
+            c[x] = Xor(Xor(a[x], a[x + 5]), Xor(Xor(a[x + 10], a[x + 15]), a[x + 20]));
+        for (int x = 0; x < 5; x++)
+            d[x] = Xor(c[(x + 4) % 5], RotL(c[(x + 1) % 5], 1));
+        for (int y = 0; y < 25; y += 5)
+            for (int x = 0; x < 5; x++)
+                b[y / 5 + 5 * ((2 * x + 3 * (y / 5)) % 5)] = RotL(Xor(a[x + y], d[x]), KECCAK_RHO[x + y]);
+        for (int y = 0; y < 25; y += 5)
+            for (int x = 0; x < 5; x++)
+                a[x + y] = Xor(b[x + y], AndNot(b[(x + 1) % 5 + y], b[(x + 2) % 5 + y]));
+        a[0] = Xor(a[0], K(KECCAK_RC[r]));
+    }
+}
+
+/* ----------- Skein-512 ------------------------------------------------- */
+
+const uint64_t SKEIN_IV[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL, 0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL, 0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL};
+
+/** Word order of the four MIX layers of a Threefish round group. */
+const unsigned char SKEIN_PERM[4][8] = {
+    {0, 1, 2, 3, 4, 5, 6, 7}, {2, 1, 4, 7, 6, 5, 0, 3}, {4, 1, 6, 3, 0, 5, 2, 7}, {6, 1, 0, 7, 2, 5, 4, 3}};
+const unsigned char SKEIN_ROT[8][4] = {
+    {46, 36, 19, 37}, {33, 27, 14, 42}, {17, 49, 36, 39}, {44, 9, 54, 56},
+    {39, 30, 34, 24}, {13, 50, 10, 17}, {25, 29, 39, 43}, {8, 35, 56, 22}};
+
+/** One UBI block: h = Threefish_h,t(m) ^ m. */
+void SkeinUbi(__m256i* h, const __m256i* m, uint64_t t0, uint64_t t1)
+{
+    __m256i k[9], p[8];
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+    k[8] = K(0x1BD11BDAA9FC1A22ULL);
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] = Xor(k[8], h[i]);
+        p[i] = m[i];
+    }
+    for (int s = 0; s <= 18; s++) {
+        for (int i = 0; i < 8; i++)
+            p[i] = Add(p[i], k[(s + i) % 9]);
+        p[5] = Add(p[5], K(t[s % 3]));
+        p[6] = Add(p[6], K(t[(s + 1) % 3]));
+        p[7] = Add(p[7], K(s));
+        if (s == 18)
+            break;
+        for (int l = 0; l < 4; l++) {
+            const unsigned char* o = SKEIN_PERM[l];
+            const unsigned char* rc = SKEIN_ROT[4 * (s & 1) + l];
+            for (int i = 0; i < 4; i++) {
+                p[o[2 * i]] = Add(p[o[2 * i]], p[o[2 * i + 1]]);
+                p[o[2 * i + 1]] = Xor(RotL(p[o[2 * i + 1]], rc[i]), p[o[2 * i]]);
+            }
+        }
+    }
+    for (int i = 0; i < 8; i++)
+        h[i] = Xor(m[i], p[i]);
+}
+
+} // namespace
+
+void Blake512_4way(unsigned char* out, const unsigned char* in, size_t len)
+{
+    // Pad each lane to a single 128 byte block; len must be at most 111.
+    unsigned char block[4][128];
+    for (int l = 0; l < 4; l++) {
+        memset(block[l], 0, sizeof(block[l]));
+        memcpy(block[l], in + l * len, len);
+        block[l][len] = 0x80;
+        block[l][111] |= 1;
+        WriteBE64(block[l] + 120, (uint64_t)len << 3);
+    }
+
+    __m256i m[16], v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = _mm256_set_epi64x(ReadBE64(block[3] + 8 * i), ReadBE64(block[2] + 8 * i),
+                                 ReadBE64(block[1] + 8 * i), ReadBE64(block[0] + 8 * i));
+    for (int i = 0; i < 8; i++)
+        v[i] = K(BLAKE_IV[i]);
+    for (int i = 0; i < 4; i++)
+        v[8 + i] = K(BLAKE_CB[i]);
+    v[12] = K(((uint64_t)len << 3) ^ BLAKE_CB[4]);
+    v[13] = K(((uint64_t)len << 3) ^ BLAKE_CB[5]);
+    v[14] = K(BLAKE_CB[6]);
+    v[15] = K(BLAKE_CB[7]);
+
+    for (int r = 0; r < 16; r++) {
+        const unsigned char* s = BLAKE_SIGMA[r % 10];
+        BlakeG(v, m, s, 0, 4, 8, 12, 0);
+        BlakeG(v, m, s, 1, 5, 9, 13, 1);
+        BlakeG(v, m, s, 2, 6, 10, 14, 2);
+        BlakeG(v, m, s, 3, 7, 11, 15, 3);
+        BlakeG(v, m, s, 0, 5, 10, 15, 4);
+        BlakeG(v, m, s, 1, 6, 11, 12, 5);
+        BlakeG(v, m, s, 2, 7, 8, 13, 6);
+        BlakeG(v, m, s, 3, 4, 9, 14, 7);
+    }
+    for (int i = 0; i < 8; i++)
+        StoreBE(out, i, Xor(K(BLAKE_IV[i]), v[i], v[i + 8]));
+}
+
+void Bmw512_4way(unsigned char* out, const unsigned char* in)
+{
+    __m256i m[16], h[16], dh[16];
+    for (int i = 0; i < 8; i++)
+        m[i] = LoadLE(in, 64, i);
+    m[8] = K(0x80);
+    for (int i = 9; i < 15; i++)
+        m[i] = _mm256_setzero_si256();
+    m[15] = K(512);
+    for (int i = 0; i < 16; i++)
+        h[i] = K(BMW_IV[i]);
+    BmwCompress(m, h, dh);
+
+    for (int i = 0; i < 16; i++)
+        h[i] = K(0xaaaaaaaaaaaaaaa0ULL + i);
+    BmwCompress(dh, h, m);
+    for (int i = 0; i < 8; i++)
+        StoreLE(out, i, m[i + 8]);
+}
+
+void Jh512_4way(unsigned char* out, const unsigned char* in)
+{
+    __m256i h[16], m[8];
+    for (int i = 0; i < 16; i++)
+        h[i] = K(JH_IV[i]);
+
+    // Message block, then the padding block holding 0x80 and the bit length.
+    for (int i = 0; i < 8; i++) {
+        m[i] = LoadBE(in, 64, i);
+        h[i] = Xor(h[i], m[i]);
+    }
+    JhE8(h);
+    for (int i = 0; i < 8; i++)
+        h[i + 8] = Xor(h[i + 8], m[i]);
+
+    h[0] = Xor(h[0], K(0x8000000000000000ULL));
+    h[7] = Xor(h[7], K(512));
+    JhE8(h);
+    h[8] = Xor(h[8], K(0x8000000000000000ULL));
+    h[15] = Xor(h[15], K(512));
+
+    for (int i = 0; i < 8; i++)
+        StoreBE(out, i, h[i + 8]);
+}
+
+void Keccak512_4way(unsigned char* out, const unsigned char* in)
+{
+    __m256i a[25];
+    for (int i = 0; i < 8; i++)
+        a[i] = LoadLE(in, 64, i);
+    a[8] = K(0x8000000000000001ULL);
+    for (int i = 9; i < 25; i++)
+        a[i] = _mm256_setzero_si256();
+    KeccakF(a);
+    for (int i = 0; i < 8; i++)
+        StoreLE(out, i, a[i]);
+}
+
+void Skein512_4way(unsigned char* out, const unsigned char* in)
+{
+    __m256i h[8], m[8];
+    for (int i = 0; i < 8; i++) {
+        h[i] = K(SKEIN_IV[i]);
+        m[i] = LoadLE(in, 64, i);
+    }
+    // Single message block (first | final | type 48), then the output block.
+    SkeinUbi(h, m, 64, (uint64_t)480 << 55);
+    for (int i = 0; i < 8; i++)
+        m[i] = _mm256_setzero_si256();
+    SkeinUbi(h, m, 8, (uint64_t)510 << 55);
+    for (int i = 0; i < 8; i++)
+        StoreLE(out, i, h[i]);
+}
+
+} // namespace quark_avx2
+
+#endif // ENABLE_AVX2
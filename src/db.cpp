@@ -218,7 +218,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activeTxn(NULL), fInBatch(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -273,7 +273,39 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activ
 
             bitdb.mapDb[strFile] = pdb;
         }
+
+        // Join a write batch this thread has open on the file, readers too:
+        // outside the transaction they would wait on its locks
+        std::map<std::string, std::pair<boost::thread::id, DbTxn*> >::const_iterator mi = bitdb.mapBatch.find(strFile);
+        if (mi != bitdb.mapBatch.end() && mi->second.first == boost::this_thread::get_id()) {
+            activeTxn = mi->second.second;
+            fInBatch = true;
+        }
+    }
+}
+
+bool CDB::BeginBatch()
+{
+    if (!pdb || activeTxn || fReadOnly)
+        return false;
+
+    LOCK(bitdb.cs_db);
+    if (bitdb.mapBatch.count(strFile) || !TxnBegin())
+        return false;
+    bitdb.mapBatch[strFile] = std::make_pair(boost::this_thread::get_id(), activeTxn);
+    return true;
+}
+
+bool CDB::EndBatch()
+{
+    if (!pdb || !activeTxn || fInBatch)
+        return false;
+
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.mapBatch.erase(strFile);
     }
+    return TxnCommit();
 }
 
 void CDB::Flush()
@@ -293,12 +325,24 @@ void CDB::Close()
 {
     if (!pdb)
         return;
-    if (activeTxn)
+    if (activeTxn && !fInBatch) {
+        {
+            // A batch that was never ended is rolled back with its transaction
+            LOCK(bitdb.cs_db);
+            std::map<std::string, std::pair<boost::thread::id, DbTxn*> >::iterator mi = bitdb.mapBatch.find(strFile);
+            if (mi != bitdb.mapBatch.end() && mi->second.second == activeTxn)
+                bitdb.mapBatch.erase(mi);
+        }
         activeTxn->abort();
+    }
+    // The owner of a batch checkpoints once it has committed
+    bool fFlush = !fInBatch;
     activeTxn = NULL;
+    fInBatch = false;
     pdb = NULL;
 
-    Flush();
+    if (fFlush)
+        Flush();
 
     {
         LOCK(bitdb.cs_db);
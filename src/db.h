@@ -17,6 +17,7 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <db_cxx.h>
 
@@ -46,6 +47,8 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    //! Write batches in progress: the thread that began each one and its transaction
+    std::map<std::string, std::pair<boost::thread::id, DbTxn*> > mapBatch;
 
     CDBEnv();
     ~CDBEnv();
@@ -101,6 +104,8 @@ protected:
     std::string strFile;
     DbTxn* activeTxn;
     bool fReadOnly;
+    //! activeTxn belongs to a write batch begun by another CDB on this file
+    bool fInBatch;
 
     explicit CDB(const std::string& strFilename, const char* pszMode = "r+");
     ~CDB() { Close(); }
@@ -224,7 +229,7 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(activeTxn, &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -268,6 +273,15 @@ protected:
     }
 
 public:
+    /**
+     * Begin a write batch: until EndBatch, every CDB this thread opens on the
+     * same file writes through one transaction and skips the log checkpoint
+     * on close, so many small writes cost a single commit. Returns false if a
+     * batch is already in progress here; this CDB then takes part in it.
+     */
+    bool BeginBatch();
+    bool EndBatch();
+
     bool TxnBegin()
     {
         if (!pdb || activeTxn)
@@ -281,7 +295,7 @@ public:
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || !activeTxn || fInBatch)
             return false;
         int ret = activeTxn->commit(0);
         activeTxn = NULL;
@@ -290,7 +304,7 @@ public:
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || !activeTxn || fInBatch)
             return false;
         int ret = activeTxn->abort();
         activeTxn = NULL;
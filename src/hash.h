@@ -15,6 +15,7 @@
 #include "uint256.h"
 #include "version.h"
 
+#include "crypto/quark.h"
 #include "crypto/sph_blake.h"
 #include "crypto/sph_bmw.h"
 #include "crypto/sph_groestl.h"
@@ -405,6 +406,20 @@ inline uint256 HashQuark(const T1 pbegin, const T1 pend)
     return hash[8].trim256();
 }
 
+/**
+ * Quark hashes of n consecutive 80 byte block headers at pdata, as HashQuark
+ * would compute them one by one. Uses the multi-buffer implementation picked
+ * by QuarkAutoDetect when there are enough headers to fill it.
+ */
+inline void HashQuarkN(const unsigned char* pdata, size_t n, uint256* phash)
+{
+    std::vector<unsigned char> vOut(n * 32);
+    if (n > 0)
+        QuarkHash80N(&vOut[0], pdata, n);
+    for (size_t i = 0; i < n; i++)
+        memcpy(phash[i].begin(), &vOut[i * 32], 32);
+}
+
 void scrypt_hash(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char* output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen);
 
 #endif // MasterStake_HASH_H
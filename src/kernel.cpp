@@ -3,10 +3,16 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <atomic>
+#include <list>
+
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "db.h"
+#include "init.h"
 #include "kernel.h"
 #include "script/interpreter.h"
 #include "timedata.h"
@@ -241,10 +247,67 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     return true;
 }
 
+// Kernel stake modifiers by hashBlockFrom, most recently used first
+struct CKernelStakeModifier {
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+};
+typedef std::list<std::pair<uint256, CKernelStakeModifier> > StakeModifierList;
+static StakeModifierList listStakeModifiers;
+static boost::unordered_map<uint256, StakeModifierList::iterator, BlockHasher> mapStakeModifiers;
+static CCriticalSection cs_stakeModifiers;
+
+static bool GetCachedStakeModifier(const uint256& hashBlockFrom, CKernelStakeModifier& modifier)
+{
+    LOCK(cs_stakeModifiers);
+    boost::unordered_map<uint256, StakeModifierList::iterator, BlockHasher>::iterator it = mapStakeModifiers.find(hashBlockFrom);
+    if (it == mapStakeModifiers.end())
+        return false;
+    listStakeModifiers.splice(listStakeModifiers.begin(), listStakeModifiers, it->second);
+    modifier = it->second->second;
+    return true;
+}
+
+static void CacheStakeModifier(const uint256& hashBlockFrom, const CKernelStakeModifier& modifier)
+{
+    LOCK(cs_stakeModifiers);
+    if (mapStakeModifiers.count(hashBlockFrom))
+        return;
+    listStakeModifiers.push_front(std::make_pair(hashBlockFrom, modifier));
+    mapStakeModifiers[hashBlockFrom] = listStakeModifiers.begin();
+    if (listStakeModifiers.size() > MAX_STAKE_MODIFIER_CACHE_SIZE) {
+        mapStakeModifiers.erase(listStakeModifiers.back().first);
+        listStakeModifiers.pop_back();
+    }
+}
+
+void InvalidateStakeModifierCache(int nHeight)
+{
+    // A cached modifier only depends on the blocks up to the one that generated it
+    LOCK(cs_stakeModifiers);
+    for (StakeModifierList::iterator it = listStakeModifiers.begin(); it != listStakeModifiers.end();) {
+        if (it->second.nStakeModifierHeight >= nHeight) {
+            mapStakeModifiers.erase(it->first);
+            it = listStakeModifiers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
+    CKernelStakeModifier cached;
+    if (GetCachedStakeModifier(hashBlockFrom, cached)) {
+        nStakeModifier = cached.nStakeModifier;
+        nStakeModifierHeight = cached.nStakeModifierHeight;
+        nStakeModifierTime = cached.nStakeModifierTime;
+        return true;
+    }
+
     nStakeModifier = 0;
     if (!mapBlockIndex.count(hashBlockFrom))
         return error("GetKernelStakeModifier() : block not indexed");
@@ -270,6 +333,11 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+
+    cached.nStakeModifier = nStakeModifier;
+    cached.nStakeModifierHeight = nStakeModifierHeight;
+    cached.nStakeModifierTime = nStakeModifierTime;
+    CacheStakeModifier(hashBlockFrom, cached);
     return true;
 }
 
@@ -294,8 +362,16 @@ bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t
     return stakeTargetHit(hashProofOfStake, nValueIn, bnTarget);
 }
 
-bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake)
+bool PrepareStakeKernel(CStakeKernelCandidate& candidate, unsigned int nTimeTx)
 {
+    CStakeInput* stakeInput = candidate.stakeInput;
+    CBlockIndex* pindex = stakeInput->GetIndexFrom();
+    if (!pindex || pindex->nHeight < 1) {
+        LogPrintf("*** no pindexfrom\n");
+        return false;
+    }
+
+    unsigned int nTimeBlockFrom = pindex->GetBlockTime();
     if (nTimeTx < nTimeBlockFrom)
         return error("CheckStakeKernelHash() : nTime violation");
 
@@ -303,43 +379,98 @@ bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockF
         return error("CheckStakeKernelHash() : min age violation - nTimeBlockFrom=%d nStakeMinAge=%d nTimeTx=%d",
                      nTimeBlockFrom, nStakeMinAge, nTimeTx);
 
-    //grab difficulty
-    uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
-
     //grab stake modifier
-    uint64_t nStakeModifier = 0;
-    if (!stakeInput->GetModifier(nStakeModifier))
+    if (!stakeInput->GetModifier(candidate.nStakeModifier))
         return error("failed to get kernel stake modifier");
 
-    bool fSuccess = false;
-    unsigned int nTryTime = 0;
-    int nHeightStart = chainActive.Height();
+    candidate.nTimeBlockFrom = nTimeBlockFrom;
+    candidate.ssUniqueID = stakeInput->GetUniqueness();
+    candidate.nValueIn = stakeInput->GetValue();
+    candidate.fSearched = false;
+    return true;
+}
+
+/**
+ * Hash the kernel of one candidate for each timestamp of the hash drift.
+ * fInterrupted is set if the search was abandoned before trying them all.
+ */
+static bool SearchStakeKernel(CStakeKernelCandidate& candidate, const uint256& bnTargetPerCoinDay, unsigned int nTimeTx,
+                              int nHeightStart, const std::atomic<bool>& fStop, bool& fInterrupted)
+{
     int nHashDrift = 30;
-    CDataStream ssUniqueID = stakeInput->GetUniqueness();
-    CAmount nValueIn = stakeInput->GetValue();
+    fInterrupted = false;
     for (int i = 0; i < nHashDrift; i++) //iterate the hashing
     {
-        //new block came in, move on
-        if (chainActive.Height() != nHeightStart)
-            break;
+        //new block came in or the kernel was found elsewhere, move on
+        if (chainActive.Height() != nHeightStart || fStop) {
+            fInterrupted = true;
+            return false;
+        }
 
         //hash this iteration
-        nTryTime = nTimeTx + nHashDrift - i;
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
 
         // if stake hash does not meet the target then continue to next iteration
-        if (!CheckStake(ssUniqueID, nValueIn, nStakeModifier, bnTargetPerCoinDay, nTimeBlockFrom, nTryTime, hashProofOfStake))
+        if (!CheckStake(candidate.ssUniqueID, candidate.nValueIn, candidate.nStakeModifier, bnTargetPerCoinDay, candidate.nTimeBlockFrom, nTryTime, candidate.hashProofOfStake))
             continue;
 
-        fSuccess = true; // if we make it this far then we have successfully created a stake hash
-        //LogPrintf("%s: hashproof=%s\n", __func__, hashProofOfStake.GetHex());
-        nTimeTx = nTryTime;
-        break;
+        candidate.nTimeTx = nTryTime;
+        return true;
     }
+    return false;
+}
+
+int FindStakeKernel(std::vector<CStakeKernelCandidate>& vCandidates, unsigned int nBits, unsigned int nTimeTx, int nThreads)
+{
+    //grab difficulty
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    std::vector<size_t> vPending;
+    for (size_t i = 0; i < vCandidates.size(); i++) {
+        if (!vCandidates[i].fSearched)
+            vPending.push_back(i);
+    }
+
+    int nHeightStart = chainActive.Height();
+    std::atomic<bool> fStop(false);
+    std::atomic<int> nFound(-1);
+    std::atomic<size_t> nNext(0);
+
+    // Each thread takes the next pending candidate until one of them finds a kernel
+    auto worker = [&]() {
+        while (!fStop && !ShutdownRequested()) {
+            size_t n = nNext++;
+            if (n >= vPending.size())
+                return;
+
+            CStakeKernelCandidate& candidate = vCandidates[vPending[n]];
+            bool fInterrupted = false;
+            if (SearchStakeKernel(candidate, bnTargetPerCoinDay, nTimeTx, nHeightStart, fStop, fInterrupted)) {
+                int nExpected = -1;
+                fStop = true;
+                // a kernel that lost the race stays pending for the next call
+                if (!nFound.compare_exchange_strong(nExpected, (int)vPending[n]))
+                    continue;
+            }
+            if (!fInterrupted)
+                candidate.fSearched = true;
+        }
+    };
+
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, (int)vPending.size()));
+
+    boost::thread_group threads;
+    for (int i = 1; i < nThreads; i++)
+        threads.create_thread(worker);
+    worker();
+    threads.join_all();
 
     mapHashedBlocks.clear();
     mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
-    return fSuccess;
+    return nFound;
 }
 
 // Check kernel hash target and coinstake signature
@@ -372,6 +503,10 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
 
         CMasterStake* masterInput = new CMasterStake();
         masterInput->SetInput(txPrev, txin.prevout.n);
+        // Spare GetIndexFrom() a second transaction lookup
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+            masterInput->SetIndexFrom(mi->second);
         stake = std::unique_ptr<CStakeInput>(masterInput);
     }
 
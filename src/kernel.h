@@ -19,13 +19,46 @@ extern unsigned int getIntervalVersion(bool fTestNet);
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+//! number of kernel stake modifiers GetKernelStakeModifier() remembers
+static const unsigned int MAX_STAKE_MODIFIER_CACHE_SIZE = 20000;
+
 // Compute the hash modifier for proof-of-stake
 bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
+// Forget the cached kernel stake modifiers that depend on blocks at nHeight or above
+void InvalidateStakeModifierCache(int nHeight);
 
 bool CheckStake(const CDataStream& ssUniqueID, CAmount nValueIn, const uint64_t nStakeModifier, const uint256& bnTarget, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool Stake(CStakeInput* stakeInput, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int& nTimeTx, uint256& hashProofOfStake);
+//! -stakethreads default, 0 = one per core
+static const int DEFAULT_STAKETHREADS = 0;
+
+/** A stake input with the kernel hash inputs that do not depend on the time looked up */
+class CStakeKernelCandidate
+{
+public:
+    CStakeInput* stakeInput;
+    CDataStream ssUniqueID;
+    CAmount nValueIn;
+    uint64_t nStakeModifier;
+    unsigned int nTimeBlockFrom;
+    //! whether every timestamp was tried without finding a kernel
+    bool fSearched;
+
+    //! kernel found by FindStakeKernel()
+    unsigned int nTimeTx;
+    uint256 hashProofOfStake;
+
+    explicit CStakeKernelCandidate(CStakeInput* stakeInputIn) : stakeInput(stakeInputIn), ssUniqueID(SER_GETHASH, 0), nValueIn(0),
+        nStakeModifier(0), nTimeBlockFrom(0), fSearched(true), nTimeTx(0), hashProofOfStake(0) {}
+};
+
+// Look up the kernel inputs of a candidate, requires cs_main
+bool PrepareStakeKernel(CStakeKernelCandidate& candidate, unsigned int nTimeTx);
+
+// Search the candidates not yet searched for a kernel at nTimeTx, spread over nThreads threads
+// (0 = one per core). Stops as soon as one is found or the tip changes. Returns its index, or -1.
+int FindStakeKernel(std::vector<CStakeKernelCandidate>& vCandidates, unsigned int nBits, unsigned int nTimeTx, int nThreads);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
@@ -43,7 +43,7 @@ Accumulator::Accumulator(const ZerocoinParams* p, const CoinDenomination d, cons
 
 void Accumulator::increment(const CBigNum& bnValue) {
     // Compute new accumulator = "old accumulator"^{element} mod N
-    this->value = this->value.pow_mod(bnValue, this->params->accumulatorModulus);
+    this->value = this->value.pow_mod(bnValue, this->params->accumulatorModulus, *this->params->getAccumulatorMont());
 }
 
 void Accumulator::accumulate(const PublicCoin& coin) {
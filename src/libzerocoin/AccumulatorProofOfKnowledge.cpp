@@ -28,6 +28,9 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 	CBigNum g_n = params->accumulatorQRNCommitmentGroup.g;
 	CBigNum h_n = params->accumulatorQRNCommitmentGroup.h;
 
+	std::shared_ptr<const CAutoBN_MONT_CTX> montPoK = params->accumulatorPoKCommitmentGroup.getMont();
+	std::shared_ptr<const CAutoBN_MONT_CTX> montQRN = params->getAccumulatorMont();
+
 	CBigNum e = commitmentToCoin.getContents();
 	CBigNum r = commitmentToCoin.getRandomness();
 
@@ -37,9 +40,9 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 	CBigNum r_2 = CBigNum::randBignum(params->accumulatorModulus/4);
 	CBigNum r_3 = CBigNum::randBignum(params->accumulatorModulus/4);
 
-	this->C_e = g_n.pow_mod(e, params->accumulatorModulus) * h_n.pow_mod(r_1, params->accumulatorModulus);
-	this->C_u = witness.getValue() * h_n.pow_mod(r_2, params->accumulatorModulus);
-	this->C_r = g_n.pow_mod(r_2, params->accumulatorModulus) * h_n.pow_mod(r_3, params->accumulatorModulus);
+	this->C_e = g_n.pow_mod(e, params->accumulatorModulus, *montQRN) * h_n.pow_mod(r_1, params->accumulatorModulus, *montQRN);
+	this->C_u = witness.getValue() * h_n.pow_mod(r_2, params->accumulatorModulus, *montQRN);
+	this->C_r = g_n.pow_mod(r_2, params->accumulatorModulus, *montQRN) * h_n.pow_mod(r_3, params->accumulatorModulus, *montQRN);
 
 	CBigNum r_alpha = CBigNum::randBignum(params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime));
 	if(!(CBigNum::randBignum(CBigNum(3)) % 2)) {
@@ -74,14 +77,14 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 		r_delta = 0-r_delta;
 	}
 
-	this->st_1 = (sg.pow_mod(r_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_2 = (((commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(r_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(r_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_3 = ((sg * commitmentToCoin.getCommitmentValue()).pow_mod(r_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	this->st_1 = params->accumulatorPoKCommitmentGroup.powGH(r_alpha, r_phi);
+	this->st_2 = (((commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(r_gamma, params->accumulatorPoKCommitmentGroup.modulus, *montPoK)) * params->accumulatorPoKCommitmentGroup.powH(r_psi)) % params->accumulatorPoKCommitmentGroup.modulus;
+	this->st_3 = ((sg * commitmentToCoin.getCommitmentValue()).pow_mod(r_sigma, params->accumulatorPoKCommitmentGroup.modulus, *montPoK) * params->accumulatorPoKCommitmentGroup.powH(r_xi)) % params->accumulatorPoKCommitmentGroup.modulus;
 
-	this->t_1 = (h_n.pow_mod(r_zeta, params->accumulatorModulus) * g_n.pow_mod(r_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_2 = (h_n.pow_mod(r_eta, params->accumulatorModulus) * g_n.pow_mod(r_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_3 = (C_u.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	this->t_4 = (C_r.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	this->t_1 = (h_n.pow_mod(r_zeta, params->accumulatorModulus, *montQRN) * g_n.pow_mod(r_epsilon, params->accumulatorModulus, *montQRN)) % params->accumulatorModulus;
+	this->t_2 = (h_n.pow_mod(r_eta, params->accumulatorModulus, *montQRN) * g_n.pow_mod(r_alpha, params->accumulatorModulus, *montQRN)) % params->accumulatorModulus;
+	this->t_3 = (C_u.pow_mod(r_alpha, params->accumulatorModulus, *montQRN) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus, *montQRN))) % params->accumulatorModulus;
+	this->t_4 = (C_r.pow_mod(r_alpha, params->accumulatorModulus, *montQRN) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_delta, params->accumulatorModulus, *montQRN)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus, *montQRN))) % params->accumulatorModulus;
 
 	CHashWriter hasher(0,0);
 	hasher << *params << sg << sh << g_n << h_n << commitmentToCoin.getCommitmentValue() << C_e << C_u << C_r << st_1 << st_2 << st_3 << t_1 << t_2 << t_3 << t_4;
@@ -105,39 +108,69 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 /** Verifies that a commitment c is accumulated in accumulator a
  */
 bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& valueOfCommitmentToCoin) const {
-	CBigNum sg = params->accumulatorPoKCommitmentGroup.g;
-	CBigNum sh = params->accumulatorPoKCommitmentGroup.h;
+	return AccumulatorProofVerifier(params, a).Verify(*this, valueOfCommitmentToCoin);
+}
 
-	CBigNum g_n = params->accumulatorQRNCommitmentGroup.g;
-	CBigNum h_n = params->accumulatorQRNCommitmentGroup.h;
+AccumulatorProofVerifier::AccumulatorProofVerifier(const AccumulatorAndProofParams* p, const Accumulator& a): params(p),
+	accumulatorValue(a.getValue()),
+	montPoK(p->accumulatorPoKCommitmentGroup.getMont()),
+	montQRN(p->getAccumulatorMont()),
+	hasherPrefix(0,0) {
+
+	const CBigNum& sg = params->accumulatorPoKCommitmentGroup.g;
+	const CBigNum& sh = params->accumulatorPoKCommitmentGroup.h;
+
+	const CBigNum& g_n = params->accumulatorQRNCommitmentGroup.g;
+	const CBigNum& h_n = params->accumulatorQRNCommitmentGroup.h;
+
+	sg_inv = sg.inverse(params->accumulatorPoKCommitmentGroup.modulus);
+	g_n_inv = g_n.inverse(params->accumulatorModulus);
+	h_n_inv = h_n.inverse(params->accumulatorModulus);
+	alphaBound = params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime + 1);
+
+	hasherPrefix << *params << sg << sh << g_n << h_n;
+}
+
+bool AccumulatorProofVerifier::Verify(const AccumulatorProofOfKnowledge& proof, const CBigNum& valueOfCommitmentToCoin) const {
+	const CBigNum& sg = params->accumulatorPoKCommitmentGroup.g;
+	const CBigNum& p = params->accumulatorPoKCommitmentGroup.modulus;
+
+	const CBigNum& g_n = params->accumulatorQRNCommitmentGroup.g;
+	const CBigNum& h_n = params->accumulatorQRNCommitmentGroup.h;
+	const CBigNum& n = params->accumulatorModulus;
 
 	//According to the proof, this hash should be of length k_prime bits.  It is currently greater than that, which should not be a problem, but we should check this.
-	CHashWriter hasher(0,0);
-	hasher << *params << sg << sh << g_n << h_n << valueOfCommitmentToCoin << C_e << C_u << C_r << st_1 << st_2 << st_3 << t_1 << t_2 << t_3 << t_4;
+	CHashWriter hasher(hasherPrefix);
+	hasher << valueOfCommitmentToCoin << proof.C_e << proof.C_u << proof.C_r << proof.st_1 << proof.st_2 << proof.st_3 << proof.t_1 << proof.t_2 << proof.t_3 << proof.t_4;
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	// Each check is a product of three exponentiations, evaluated with a single
+	// simultaneous multi-exponentiation. Negative responses invert their base.
+	// In the known order group the powers of sg and sh come from the
+	// fixed-base tables instead.
+	const IntegerGroupParams& pok = params->accumulatorPoKCommitmentGroup;
+	CBigNum st_1_prime = CBigNum::mul_pow_mod({valueOfCommitmentToCoin}, {c}, p, *montPoK).mul_mod(pok.powGH(proof.s_alpha, proof.s_phi), p);
+	CBigNum st_2_prime = CBigNum::mul_pow_mod({valueOfCommitmentToCoin * sg_inv}, {proof.s_gamma}, p, *montPoK).mul_mod(pok.powGH(c, proof.s_psi), p);
+	CBigNum st_3_prime = CBigNum::mul_pow_mod({sg * valueOfCommitmentToCoin}, {proof.s_sigma}, p, *montPoK).mul_mod(pok.powGH(c, proof.s_xi), p);
 
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	CBigNum t_1_prime = CBigNum::mul_pow_mod({proof.C_r, h_n, g_n}, {c, proof.s_zeta, proof.s_epsilon}, n, *montQRN);
+	CBigNum t_2_prime = CBigNum::mul_pow_mod({proof.C_e, h_n, g_n}, {c, proof.s_eta, proof.s_alpha}, n, *montQRN);
+	CBigNum t_3_prime = CBigNum::mul_pow_mod({accumulatorValue, proof.C_u, h_n_inv}, {c, proof.s_alpha, proof.s_beta}, n, *montQRN);
+	CBigNum t_4_prime = CBigNum::mul_pow_mod({proof.C_r, h_n_inv, g_n_inv}, {proof.s_alpha, proof.s_delta, proof.s_beta}, n, *montQRN);
 
 	bool result = false;
 
-	bool result_st1 = (st_1 == st_1_prime);
-	bool result_st2 = (st_2 == st_2_prime);
-	bool result_st3 = (st_3 == st_3_prime);
+	bool result_st1 = (proof.st_1 == st_1_prime);
+	bool result_st2 = (proof.st_2 == st_2_prime);
+	bool result_st3 = (proof.st_3 == st_3_prime);
 
-	bool result_t1 = (t_1 == t_1_prime);
-	bool result_t2 = (t_2 == t_2_prime);
-	bool result_t3 = (t_3 == t_3_prime);
-	bool result_t4 = (t_4 == t_4_prime);
+	bool result_t1 = (proof.t_1 == t_1_prime);
+	bool result_t2 = (proof.t_2 == t_2_prime);
+	bool result_t3 = (proof.t_3 == t_3_prime);
+	bool result_t4 = (proof.t_4 == t_4_prime);
 
-	bool result_range = ((s_alpha >= -(params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime + 1))) && (s_alpha <= (params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime + 1))));
+	bool result_range = ((proof.s_alpha >= -alphaBound) && (proof.s_alpha <= alphaBound));
 
 	result = result_st1 && result_st2 && result_st3 && result_t1 && result_t2 && result_t3 && result_t4 && result_range;
 
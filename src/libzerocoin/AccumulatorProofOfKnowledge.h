@@ -16,9 +16,12 @@
 
 #include "Accumulator.h"
 #include "Commitment.h"
+#include "hash.h"
 
 namespace libzerocoin {
 
+class AccumulatorProofVerifier;
+
 /**A prove that a value insde the commitment commitmentToCoin is in an accumulator a.
  *
  */
@@ -36,6 +39,8 @@ public:
 	/** Verifies that  a commitment c is accumulated in accumulated a
 	 */
 	bool Verify(const Accumulator& a,const CBigNum& valueOfCommitmentToCoin) const;
+
+	const AccumulatorAndProofParams* getParams() const { return params; }
 	
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
@@ -89,6 +94,38 @@ private:
 	CBigNum s_phi;
 	CBigNum s_gamma;
 	CBigNum s_psi;
+
+	friend class AccumulatorProofVerifier;
+};
+
+/** Verifies accumulator proofs against one accumulator. Everything that only
+ * depends on the parameters and the accumulator (inverses of the fixed bases,
+ * Montgomery contexts, the hash of the parameters) is computed once, so that
+ * checking many spends of the same checkpoint only pays for the per-proof
+ * multi-exponentiations.
+ */
+class AccumulatorProofVerifier {
+public:
+	AccumulatorProofVerifier(const AccumulatorAndProofParams* p, const Accumulator& a);
+
+	bool Verify(const AccumulatorProofOfKnowledge& proof, const CBigNum& valueOfCommitmentToCoin) const;
+
+	const AccumulatorAndProofParams* getParams() const { return params; }
+
+private:
+	const AccumulatorAndProofParams* params;
+	CBigNum accumulatorValue;
+
+	CBigNum sg_inv;
+	CBigNum g_n_inv;
+	CBigNum h_n_inv;
+	CBigNum alphaBound;
+
+	std::shared_ptr<const CAutoBN_MONT_CTX> montPoK;
+	std::shared_ptr<const CAutoBN_MONT_CTX> montQRN;
+
+	//! Hasher already fed with the parameters and generators
+	CHashWriter hasherPrefix;
 };
 
 } /* namespace libzerocoin */
@@ -13,6 +13,7 @@
 
 #include "CoinSpend.h"
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 namespace libzerocoin
@@ -73,6 +74,32 @@ namespace libzerocoin
 }
 
 bool CoinSpend::Verify(const Accumulator& a) const
+{
+    AccumulatorProofVerifier verifier(accumulatorPoK.getParams(), a);
+    return Verify(a, verifier);
+}
+
+bool CoinSpend::BatchVerify(const Accumulator& a, const std::vector<const CoinSpend*>& vSpends, std::vector<bool>& vResults)
+{
+    vResults.assign(vSpends.size(), false);
+
+    // Spends normally all carry the same accumulator parameters; only rebuild the
+    // shared verifier if one of them does not.
+    std::unique_ptr<AccumulatorProofVerifier> verifier;
+    bool fAllValid = true;
+    for (unsigned int i = 0; i < vSpends.size(); i++) {
+        const CoinSpend* spend = vSpends[i];
+        if (!verifier || verifier->getParams() != spend->accumulatorPoK.getParams())
+            verifier.reset(new AccumulatorProofVerifier(spend->accumulatorPoK.getParams(), a));
+
+        vResults[i] = spend->Verify(a, *verifier);
+        fAllValid &= vResults[i];
+    }
+
+    return fAllValid;
+}
+
+bool CoinSpend::Verify(const Accumulator& a, const AccumulatorProofVerifier& verifier) const
 {
     // Double check that the version is the same as marked in the serial
     if (ExtractVersionFromSerial(coinSerialNumber) != version) {
@@ -91,7 +118,7 @@ bool CoinSpend::Verify(const Accumulator& a) const
         return false;
     }
 
-    if (!accumulatorPoK.Verify(a, accCommitmentToCoinValue)) {
+    if (!verifier.Verify(accumulatorPoK, accCommitmentToCoinValue)) {
         //std::cout << "CoinsSpend::Verify: accumulatorPoK failed\n";
         return false;
     }
@@ -116,6 +116,19 @@ public:
     std::vector<unsigned char> getSignature() const { return vchSig; }
 
     bool Verify(const Accumulator& a) const;
+
+    /**Verifies several spends against the same accumulator.
+     *
+     * The accumulator proofs of all spends share one AccumulatorProofVerifier,
+     * so the work that only depends on the parameters and the accumulator is
+     * done once per batch. Results are identical to calling Verify on each spend.
+     *
+     * @param a the accumulator every spend claims membership in
+     * @param vSpends the spends to verify
+     * @param vResults receives the result for each spend, in order
+     * @return true if every spend verified
+     */
+    static bool BatchVerify(const Accumulator& a, const std::vector<const CoinSpend*>& vSpends, std::vector<bool>& vResults);
     bool HasValidSerial(ZerocoinParams* params) const;
     bool HasValidSignature() const;
     CBigNum CalculateValidSerial(ZerocoinParams* params);
@@ -147,6 +160,7 @@ public:
 
 private:
     const uint256 signatureHash() const;
+    bool Verify(const Accumulator& a, const AccumulatorProofVerifier& verifier) const;
     CoinDenomination denomination;
     uint32_t accChecksum;
     uint256 ptxHash;
@@ -48,6 +48,26 @@ int64_t ZerocoinDenominationToInt(const CoinDenomination& denomination)
     return Value;
 }
 
+// Position of the denomination in zerocoinDenomList, -1 for an invalid denomination
+int ZerocoinDenominationToIndex(const CoinDenomination& denomination)
+{
+    int Index = -1;
+    switch (denomination) {
+    case CoinDenomination::ZQ_ONE: Index = 0; break;
+    case CoinDenomination::ZQ_FIVE: Index = 1; break;
+    case CoinDenomination::ZQ_TEN: Index = 2; break;
+    case CoinDenomination::ZQ_FIFTY : Index = 3; break;
+    case CoinDenomination::ZQ_ONE_HUNDRED: Index = 4; break;
+    case CoinDenomination::ZQ_FIVE_HUNDRED: Index = 5; break;
+    case CoinDenomination::ZQ_ONE_THOUSAND: Index = 6; break;
+    case CoinDenomination::ZQ_FIVE_THOUSAND: Index = 7; break;
+    default:
+        // Error Case
+        Index = -1; break;
+    }
+    return Index;
+}
+
 CoinDenomination AmountToZerocoinDenomination(CAmount amount)
 {
     // Check to make sure amount is an exact integer number of COINS
@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "FixedBaseExp.h"
+
+namespace libzerocoin {
+
+FixedBaseExp::FixedBaseExp(const CBigNum& b, const CBigNum& m, const CBigNum& q, const std::shared_ptr<const CAutoBN_MONT_CTX>& montCtx): base(b), modulus(m), order(q), mont(montCtx) {
+	if (order <= 1)
+		throw std::runtime_error("FixedBaseExp: group order is not set");
+
+	CAutoBN_CTX pctx;
+	const unsigned int nDigits = 1 << FIXED_BASE_WINDOW;
+	nWindows = (order.bitSize() + FIXED_BASE_WINDOW - 1) / FIXED_BASE_WINDOW;
+	vTable.resize(nWindows << FIXED_BASE_WINDOW);
+
+	CBigNum reduced = base % modulus;
+	if (!BN_to_montgomery(vTable[1].bn, reduced.bn, *mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_to_montgomery failed");
+
+	for (unsigned int i = 0; i < nWindows; i++) {
+		CBigNum* row = &vTable[i << FIXED_BASE_WINDOW];
+		// row[1] = base^(2^(w*i)) = previous row[2^w - 1] * previous row[1]
+		if (i > 0 && !BN_mod_mul_montgomery(row[1].bn, row[-1].bn, row[1 - (int)nDigits].bn, *mont, pctx))
+			throw bignum_error("FixedBaseExp : BN_mod_mul_montgomery failed");
+		for (unsigned int d = 2; d < nDigits; d++) {
+			if (!BN_mod_mul_montgomery(row[d].bn, row[d - 1].bn, row[1].bn, *mont, pctx))
+				throw bignum_error("FixedBaseExp : BN_mod_mul_montgomery failed");
+		}
+	}
+}
+
+bool FixedBaseExp::isTableFor(const CBigNum& b, const CBigNum& m, const CBigNum& q) const {
+	return base == b && modulus == m && order == q;
+}
+
+void FixedBaseExp::accumulate(CBigNum& acc, const CBigNum& e, BN_CTX* pctx) const {
+	// base^e = base^(e mod order), also for negative e
+	CBigNum exp;
+	if (!BN_nnmod(exp.bn, e.bn, order.bn, pctx))
+		throw bignum_error("FixedBaseExp : BN_nnmod failed");
+
+	for (unsigned int i = 0; i < nWindows; i++) {
+		int nDigit = 0;
+		for (int j = FIXED_BASE_WINDOW - 1; j >= 0; j--)
+			nDigit = (nDigit << 1) | BN_is_bit_set(exp.bn, i * FIXED_BASE_WINDOW + j);
+		if (nDigit == 0)
+			continue;
+		if (!BN_mod_mul_montgomery(acc.bn, acc.bn, vTable[(i << FIXED_BASE_WINDOW) + nDigit].bn, *mont, pctx))
+			throw bignum_error("FixedBaseExp : BN_mod_mul_montgomery failed");
+	}
+}
+
+CBigNum FixedBaseExp::pow(const CBigNum& e) const {
+	CAutoBN_CTX pctx;
+	CBigNum acc;
+	if (!BN_to_montgomery(acc.bn, CBigNum(1).bn, *mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_to_montgomery failed");
+
+	accumulate(acc, e, pctx);
+
+	CBigNum ret;
+	if (!BN_from_montgomery(ret.bn, acc.bn, *mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_from_montgomery failed");
+	return ret;
+}
+
+CBigNum FixedBaseExp::mul_pow(const FixedBaseExp& a, const CBigNum& x, const FixedBaseExp& b, const CBigNum& y) {
+	// The Montgomery form only depends on the modulus, so both tables can
+	// multiply into the same accumulator.
+	if (a.modulus != b.modulus)
+		throw std::runtime_error("FixedBaseExp::mul_pow: tables use different moduli");
+
+	CAutoBN_CTX pctx;
+	CBigNum acc;
+	if (!BN_to_montgomery(acc.bn, CBigNum(1).bn, *a.mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_to_montgomery failed");
+
+	a.accumulate(acc, x, pctx);
+	b.accumulate(acc, y, pctx);
+
+	CBigNum ret;
+	if (!BN_from_montgomery(ret.bn, acc.bn, *a.mont, pctx))
+		throw bignum_error("FixedBaseExp : BN_from_montgomery failed");
+	return ret;
+}
+
+} /* namespace libzerocoin */
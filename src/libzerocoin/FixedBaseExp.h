@@ -0,0 +1,64 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FIXEDBASEEXP_H_
+#define FIXEDBASEEXP_H_
+
+#include "bignum.h"
+
+#include <memory>
+
+namespace libzerocoin {
+
+/** Window width (in bits) of the fixed-base precomputation tables */
+static const unsigned int FIXED_BASE_WINDOW = 5;
+
+/**
+ * Modular exponentiation with a fixed base of known order.
+ *
+ * The constructor precomputes base^(d * 2^(w*i)) mod m, in Montgomery form, for
+ * every window position i of an exponent below the order and every window digit
+ * d. base^e then costs one multiplication per non-zero window of e and no
+ * squarings, several times cheaper than pow_mod for the exponents used by the
+ * commitment groups.
+ *
+ * Exponents are reduced modulo the order first, so negative and oversized
+ * exponents give exactly the same result as pow_mod. This requires
+ * base^order = 1 mod m, which holds for the generators of every group produced
+ * by deriveIntegerGroupParams.
+ */
+class FixedBaseExp {
+public:
+	/** mont must be a Montgomery context for modulus. It is shared with other
+	 * users of the same modulus. */
+	FixedBaseExp(const CBigNum& base, const CBigNum& modulus, const CBigNum& order, const std::shared_ptr<const CAutoBN_MONT_CTX>& mont);
+
+	/** Whether this table was built for the given base, modulus and order */
+	bool isTableFor(const CBigNum& base, const CBigNum& modulus, const CBigNum& order) const;
+
+	/** base^e mod modulus */
+	CBigNum pow(const CBigNum& e) const;
+
+	/** a.base^x * b.base^y mod modulus, for two tables over the same modulus */
+	static CBigNum mul_pow(const FixedBaseExp& a, const CBigNum& x, const FixedBaseExp& b, const CBigNum& y);
+
+private:
+	FixedBaseExp(const FixedBaseExp&);
+	FixedBaseExp& operator=(const FixedBaseExp&);
+
+	/** Multiplies base^e into acc, which is in Montgomery form */
+	void accumulate(CBigNum& acc, const CBigNum& e, BN_CTX* pctx) const;
+
+	CBigNum base;
+	CBigNum modulus;
+	CBigNum order;
+	std::shared_ptr<const CAutoBN_MONT_CTX> mont;
+	unsigned int nWindows;
+	// vTable[(i << FIXED_BASE_WINDOW) + d] holds base^(d * 2^(FIXED_BASE_WINDOW * i))
+	std::vector<CBigNum> vTable;
+};
+
+} /* namespace libzerocoin */
+
+#endif /* FIXEDBASEEXP_H_ */
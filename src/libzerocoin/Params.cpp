@@ -30,6 +30,16 @@ ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	this->initialized = true;
 }
 
+std::shared_ptr<const CAutoBN_MONT_CTX> MontgomeryCache::get(const CBigNum& modulus) const {
+	std::shared_ptr<const Entry> e = std::atomic_load(&entry);
+	if (!e || e->modulus != modulus) {
+		e = std::make_shared<const Entry>(modulus);
+		std::atomic_store(&entry, e);
+	}
+	// Points into the entry and keeps it alive
+	return std::shared_ptr<const CAutoBN_MONT_CTX>(e, &e->mont);
+}
+
 AccumulatorAndProofParams::AccumulatorAndProofParams() {
 	this->initialized = false;
 }
@@ -42,7 +52,32 @@ CBigNum IntegerGroupParams::randomElement() const {
 	// The generator of the group raised
 	// to a random number less than the order of the group
 	// provides us with a uniformly distributed random number.
-	return this->g.pow_mod(CBigNum::randBignum(this->groupOrder),this->modulus);
+	return this->powG(CBigNum::randBignum(this->groupOrder));
+}
+
+std::shared_ptr<const FixedBaseExp> IntegerGroupParams::getFixedBase(const CBigNum& base, std::shared_ptr<const FixedBaseExp>& cache) const {
+	// The table is rebuilt if the group was changed after it was built.
+	// Concurrent first uses may each build one; only the last is kept.
+	std::shared_ptr<const FixedBaseExp> table = std::atomic_load(&cache);
+	if (!table || !table->isTableFor(base, this->modulus, this->groupOrder)) {
+		table = std::make_shared<const FixedBaseExp>(base, this->modulus, this->groupOrder, getMont());
+		std::atomic_store(&cache, table);
+	}
+	return table;
+}
+
+CBigNum IntegerGroupParams::powG(const CBigNum& e) const {
+	return getFixedBase(this->g, fixedBaseG)->pow(e);
+}
+
+CBigNum IntegerGroupParams::powH(const CBigNum& e) const {
+	return getFixedBase(this->h, fixedBaseH)->pow(e);
+}
+
+CBigNum IntegerGroupParams::powGH(const CBigNum& a, const CBigNum& b) const {
+	std::shared_ptr<const FixedBaseExp> tableG = getFixedBase(this->g, fixedBaseG);
+	std::shared_ptr<const FixedBaseExp> tableH = getFixedBase(this->h, fixedBaseH);
+	return FixedBaseExp::mul_pow(*tableG, a, *tableH, b);
 }
 
 } /* namespace libzerocoin */
@@ -15,10 +15,31 @@
 #define PARAMS_H_
 
 #include "bignum.h"
+#include "FixedBaseExp.h"
 #include "ZerocoinDefines.h"
 
+#include <memory>
+
 namespace libzerocoin {
 
+/**
+ * A Montgomery context for a parameter modulus, built on first use so that
+ * exponentiations modulo that modulus do not each set up their own. Copies
+ * share the context; it is rebuilt if the modulus changes.
+ */
+class MontgomeryCache {
+public:
+	std::shared_ptr<const CAutoBN_MONT_CTX> get(const CBigNum& modulus) const;
+
+private:
+	struct Entry {
+		CBigNum modulus;
+		CAutoBN_MONT_CTX mont;
+		explicit Entry(const CBigNum& m): modulus(m), mont(m) {}
+	};
+	mutable std::shared_ptr<const Entry> entry;
+};
+
 class IntegerGroupParams {
 public:
 	/** @brief Integer group class, default constructor
@@ -32,6 +53,20 @@ public:
 	 * @return a random element in the group.
 	 */
 	CBigNum randomElement() const;
+
+	/**
+	 * Fixed-base exponentiations of the generators. The precomputation
+	 * tables are built on first use and shared by all copies of the
+	 * parameters.
+	 * @return g^e, h^e and g^a * h^b mod modulus respectively.
+	 */
+	CBigNum powG(const CBigNum& e) const;
+	CBigNum powH(const CBigNum& e) const;
+	CBigNum powGH(const CBigNum& a, const CBigNum& b) const;
+
+	/** @return a Montgomery context for modulus */
+	std::shared_ptr<const CAutoBN_MONT_CTX> getMont() const { return montModulus.get(modulus); }
+
 	bool initialized;
 
 	/**
@@ -64,6 +99,13 @@ public:
 		    READWRITE(modulus);
 		    READWRITE(groupOrder);
 	}	
+
+private:
+	std::shared_ptr<const FixedBaseExp> getFixedBase(const CBigNum& base, std::shared_ptr<const FixedBaseExp>& cache) const;
+
+	mutable std::shared_ptr<const FixedBaseExp> fixedBaseG;
+	mutable std::shared_ptr<const FixedBaseExp> fixedBaseH;
+	MontgomeryCache montModulus;
 };
 
 class AccumulatorAndProofParams {
@@ -88,6 +130,9 @@ public:
 
 	//AccumulatorAndProofParams(CBigNum accumulatorModulus);
 
+	/** @return a Montgomery context for accumulatorModulus */
+	std::shared_ptr<const CAutoBN_MONT_CTX> getAccumulatorMont() const { return montAccumulator.get(accumulatorModulus); }
+
 	bool initialized;
 
 	/**
@@ -151,6 +196,9 @@ public:
 	    READWRITE(k_prime);
 	    READWRITE(k_dprime);
   }
+
+private:
+	MontgomeryCache montAccumulator;
 };
 
 class ZerocoinParams {
@@ -7,9 +7,17 @@
 #ifndef BITCOIN_BIGNUM_H
 #define BITCOIN_BIGNUM_H
 
+#if defined(HAVE_CONFIG_H)
+#include "config/masterstake-config.h"
+#endif
+
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
 #include <openssl/bn.h>
+#if defined(USE_ZEROCOIN_GMP)
+#include <gmp.h>
+#endif
 #include "serialize.h"
 #include "uint256.h"
 #include "version.h"
@@ -50,10 +58,38 @@ public:
 };
 
 
+class CBigNum;
+namespace libzerocoin { class FixedBaseExp; }
+
+/** RAII encapsulated BN_MONT_CTX (OpenSSL Montgomery context for a fixed odd modulus) */
+class CAutoBN_MONT_CTX
+{
+protected:
+    BN_MONT_CTX* pmont;
+
+private:
+    CAutoBN_MONT_CTX(const CAutoBN_MONT_CTX&);
+    CAutoBN_MONT_CTX& operator=(const CAutoBN_MONT_CTX&);
+
+public:
+    explicit CAutoBN_MONT_CTX(const CBigNum& m);
+
+    ~CAutoBN_MONT_CTX()
+    {
+        if (pmont != NULL)
+            BN_MONT_CTX_free(pmont);
+    }
+
+    operator BN_MONT_CTX*() const { return pmont; }
+};
+
+
 /** C++ wrapper for BIGNUM (OpenSSL bignum) */
 class CBigNum
 {
     BIGNUM* bn;
+    friend class CAutoBN_MONT_CTX;
+    friend class libzerocoin::FixedBaseExp;
 public:
     CBigNum()
     {
@@ -508,18 +544,170 @@ public:
      * @param m modulus
      */
     CBigNum pow_mod(const CBigNum& e, const CBigNum& m) const {
+#if defined(USE_ZEROCOIN_GMP)
+        return pow_mod_gmp(e, m);
+#else
+        return pow_mod_openssl(e, m, NULL);
+#endif
+    }
+
+    /** pow_mod using an existing Montgomery context for m */
+    CBigNum pow_mod(const CBigNum& e, const CBigNum& m, const CAutoBN_MONT_CTX& mont) const {
+#if defined(USE_ZEROCOIN_GMP)
+        return pow_mod_gmp(e, m);
+#else
+        return pow_mod_openssl(e, m, &mont);
+#endif
+    }
+
+    /** pow_mod on the OpenSSL backend, regardless of the configured one */
+    CBigNum pow_mod_openssl(const CBigNum& e, const CBigNum& m, const CAutoBN_MONT_CTX* pmont) const {
         CAutoBN_CTX pctx;
         CBigNum ret;
         if( e < 0){
             // g^-x = (g^-1)^x
             CBigNum inv = this->inverse(m);
             CBigNum posE = e * -1;
-            if (!BN_mod_exp(ret.bn, inv.bn, posE.bn, m.bn, pctx))
-                throw bignum_error("CBigNum::pow_mod: BN_mod_exp failed on negative exponent");
-        }else
-            if (!BN_mod_exp(ret.bn, bn, e.bn, m.bn, pctx))
-                throw bignum_error("CBigNum::pow_mod : BN_mod_exp failed");
+            return inv.pow_mod_openssl(posE, m, pmont);
+        }
+
+        if (pmont != NULL && BN_is_odd(m.bn)) {
+            if (!BN_mod_exp_mont(ret.bn, bn, e.bn, m.bn, pctx, *pmont))
+                throw bignum_error("CBigNum::pow_mod : BN_mod_exp_mont failed");
+        } else if (!BN_mod_exp(ret.bn, bn, e.bn, m.bn, pctx))
+            throw bignum_error("CBigNum::pow_mod : BN_mod_exp failed");
+
+        return ret;
+    }
+
+#if defined(USE_ZEROCOIN_GMP)
+    /** pow_mod on the GMP backend (mpz_powm) */
+    CBigNum pow_mod_gmp(const CBigNum& e, const CBigNum& m) const {
+        // Leave the error cases (zero or negative modulus) to OpenSSL
+        if (BN_is_zero(m.bn) || BN_is_negative(m.bn))
+            return pow_mod_openssl(e, m, NULL);
+        if (e < 0) {
+            // g^-x = (g^-1)^x
+            CBigNum inv = this->inverse(m);
+            CBigNum posE = e * -1;
+            return inv.pow_mod_gmp(posE, m);
+        }
 
+        mpz_t zBase, zExp, zMod, zRet;
+        mpz_init(zBase);
+        mpz_init(zExp);
+        mpz_init(zMod);
+        mpz_init(zRet);
+        to_mpz(zBase);
+        e.to_mpz(zExp);
+        m.to_mpz(zMod);
+        mpz_powm(zRet, zBase, zExp, zMod);
+        CBigNum ret;
+        ret.from_mpz(zRet);
+        mpz_clear(zBase);
+        mpz_clear(zExp);
+        mpz_clear(zMod);
+        mpz_clear(zRet);
+        return ret;
+    }
+
+private:
+    void to_mpz(mpz_t z) const {
+        std::vector<unsigned char> vch(BN_num_bytes(bn));
+        if (!vch.empty())
+            BN_bn2bin(bn, &vch[0]);
+        mpz_import(z, vch.size(), 1, 1, 1, 0, vch.empty() ? NULL : &vch[0]);
+        if (BN_is_negative(bn))
+            mpz_neg(z, z);
+    }
+
+    void from_mpz(const mpz_t z) {
+        std::vector<unsigned char> vch((mpz_sizeinbase(z, 2) + 7) / 8);
+        size_t nSize = 0;
+        mpz_export(&vch[0], &nSize, 1, 1, 1, 0, z);
+        if (!BN_bin2bn(&vch[0], nSize, bn))
+            throw bignum_error("CBigNum::from_mpz : BN_bin2bn failed");
+        BN_set_negative(bn, mpz_sgn(z) < 0);
+    }
+
+public:
+#endif
+
+    /**
+     * Simultaneous modular multi-exponentiation: prod(bases[i]^exps[i]) mod m.
+     * All terms share one chain of squarings (interleaved fixed-window method),
+     * which is considerably cheaper than multiplying separate pow_mod results.
+     * Negative exponents use the inverse of their base, as pow_mod does.
+     * @param bases the bases
+     * @param exps the exponents, one per base
+     * @param m an odd modulus
+     */
+    static CBigNum mul_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps, const CBigNum& m) {
+        CAutoBN_MONT_CTX mont(m);
+        return mul_pow_mod(bases, exps, m, mont);
+    }
+
+    /** mul_pow_mod using an existing Montgomery context for m */
+    static CBigNum mul_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps, const CBigNum& m, const CAutoBN_MONT_CTX& mont) {
+        static const int WINDOW = 4;
+        if (bases.size() != exps.size())
+            throw bignum_error("CBigNum::mul_pow_mod : bases and exponents differ in size");
+        if (!BN_is_odd(m.bn))
+            throw bignum_error("CBigNum::mul_pow_mod : modulus must be odd");
+
+        CAutoBN_CTX pctx;
+        const size_t nTerms = bases.size();
+        std::vector<CBigNum> vExp(nTerms);
+        // vTable[i * 2^WINDOW + d] holds bases[i]^d in Montgomery form
+        std::vector<CBigNum> vTable(nTerms << WINDOW);
+        int nMaxBits = 0;
+        for (size_t i = 0; i < nTerms; i++) {
+            CBigNum base;
+            if (exps[i] < 0) {
+                base = bases[i].inverse(m);
+                vExp[i] = exps[i] * -1;
+            } else {
+                base = bases[i] % m;
+                vExp[i] = exps[i];
+            }
+            nMaxBits = std::max(nMaxBits, vExp[i].bitSize());
+
+            CBigNum* table = &vTable[i << WINDOW];
+            if (!BN_to_montgomery(table[1].bn, base.bn, mont, pctx))
+                throw bignum_error("CBigNum::mul_pow_mod : BN_to_montgomery failed");
+            for (int d = 2; d < (1 << WINDOW); d++) {
+                if (!BN_mod_mul_montgomery(table[d].bn, table[d - 1].bn, table[1].bn, mont, pctx))
+                    throw bignum_error("CBigNum::mul_pow_mod : BN_mod_mul_montgomery failed");
+            }
+        }
+
+        CBigNum acc;
+        if (!BN_to_montgomery(acc.bn, CBigNum(1).bn, mont, pctx))
+            throw bignum_error("CBigNum::mul_pow_mod : BN_to_montgomery failed");
+
+        bool fStarted = false;
+        for (int nPos = ((nMaxBits + WINDOW - 1) / WINDOW - 1) * WINDOW; nPos >= 0; nPos -= WINDOW) {
+            if (fStarted) {
+                for (int j = 0; j < WINDOW; j++) {
+                    if (!BN_mod_mul_montgomery(acc.bn, acc.bn, acc.bn, mont, pctx))
+                        throw bignum_error("CBigNum::mul_pow_mod : BN_mod_mul_montgomery failed");
+                }
+            }
+            for (size_t i = 0; i < nTerms; i++) {
+                int nDigit = 0;
+                for (int j = WINDOW - 1; j >= 0; j--)
+                    nDigit = (nDigit << 1) | BN_is_bit_set(vExp[i].bn, nPos + j);
+                if (nDigit == 0)
+                    continue;
+                if (!BN_mod_mul_montgomery(acc.bn, acc.bn, vTable[(i << WINDOW) + nDigit].bn, mont, pctx))
+                    throw bignum_error("CBigNum::mul_pow_mod : BN_mod_mul_montgomery failed");
+                fStarted = true;
+            }
+        }
+
+        CBigNum ret;
+        if (!BN_from_montgomery(ret.bn, acc.bn, mont, pctx))
+            throw bignum_error("CBigNum::mul_pow_mod : BN_from_montgomery failed");
         return ret;
     }
 
@@ -764,6 +952,18 @@ inline const CBigNum operator>>(const CBigNum& a, unsigned int shift)
     return r;
 }
 
+inline CAutoBN_MONT_CTX::CAutoBN_MONT_CTX(const CBigNum& m)
+{
+    CAutoBN_CTX pctx;
+    pmont = BN_MONT_CTX_new();
+    if (pmont == NULL)
+        throw bignum_error("CAutoBN_MONT_CTX : BN_MONT_CTX_new() returned NULL");
+    if (!BN_MONT_CTX_set(pmont, m.bn, pctx)) {
+        BN_MONT_CTX_free(pmont);
+        throw bignum_error("CAutoBN_MONT_CTX : BN_MONT_CTX_set failed");
+    }
+}
+
 inline bool operator==(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.bn, b.bn) == 0); }
 inline bool operator!=(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.bn, b.bn) != 0); }
 inline bool operator<=(const CBigNum& a, const CBigNum& b) { return (BN_cmp(a.bn, b.bn) <= 0); }
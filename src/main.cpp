@@ -35,6 +35,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "validationinterface.h"
+#include "zerocoinspendcache.h"
 #include "zmasterchain.h"
 
 #include "primitives/zerocoin.h"
@@ -64,6 +65,8 @@ using namespace libzerocoin;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+/** Owns every CBlockIndex in mapBlockIndex. Declared before instance_of_cmaincleanup so it outlives it. */
+static CBlockIndexArena blockIndexArena;
 map<uint256, uint256> mapProofOfStake;
 map<COutPoint, int> mapStakeSpent;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
@@ -97,9 +100,21 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nTxSize;
+    uint64_t nSequence;
 };
 map<uint256, COrphanTx> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
+//! Orphans by the outpoints they spend, so the children of a transaction are one range lookup away
+map<COutPoint, set<uint256> > mapOrphanTransactionsByPrev;
+struct COrphanTxPeer {
+    size_t nBytes;
+    //! The peer's orphans, oldest first
+    map<uint64_t, uint256> mapBySequence;
+    COrphanTxPeer() : nBytes(0) {}
+};
+map<NodeId, COrphanTxPeer> mapOrphanTransactionsByPeer;
+size_t nOrphanTransactionsBytes = 0;
 map<uint256, int64_t> mapRejectedBlocks;
 map<uint256, int64_t> mapZerocoinspends; //txid, time received
 
@@ -545,6 +560,8 @@ CSporkDB* pSporkDB = NULL;
 
 bool AddOrphanTx(const CTransaction& tx, NodeId peer)
 {
+    static uint64_t nOrphanSequence = 0;
+
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
         return false;
@@ -554,21 +571,28 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer)
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
     unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-    if (sz > 5000) {
+    if (sz > MAX_ORPHAN_TX_SIZE) {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nTxSize = sz;
+    orphan.nSequence = nOrphanSequence++;
     BOOST_FOREACH (const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(hash);
+
+    COrphanTxPeer& orphanPeer = mapOrphanTransactionsByPeer[peer];
+    orphanPeer.nBytes += sz;
+    orphanPeer.mapBySequence.insert(make_pair(orphan.nSequence, hash));
+    nOrphanTransactionsBytes += sz;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-        mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u bytes %u peer=%d bytes %u)\n", hash.ToString(),
+        mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTransactionsBytes, peer, orphanPeer.nBytes);
     return true;
 }
 
@@ -578,46 +602,134 @@ void static EraseOrphanTx(uint256 hash)
     if (it == mapOrphanTransactions.end())
         return;
     BOOST_FOREACH (const CTxIn& txin, it->second.tx.vin) {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    map<NodeId, COrphanTxPeer>::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    assert(itPeer != mapOrphanTransactionsByPeer.end());
+    itPeer->second.nBytes -= it->second.nTxSize;
+    itPeer->second.mapBySequence.erase(it->second.nSequence);
+    if (itPeer->second.mapBySequence.empty())
+        mapOrphanTransactionsByPeer.erase(itPeer);
+    nOrphanTransactionsBytes -= it->second.nTxSize;
+
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end()) {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer) {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    map<NodeId, COrphanTxPeer>::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer == mapOrphanTransactionsByPeer.end())
+        return;
+
+    // Erasing the peer's last orphan also erases its entry, so copy the hashes out first
+    vector<uint256> vErase;
+    vErase.reserve(itPeer->second.mapBySequence.size());
+    for (map<uint64_t, uint256>::const_iterator it = itPeer->second.mapBySequence.begin(); it != itPeer->second.mapBySequence.end(); ++it)
+        vErase.push_back(it->second);
+    BOOST_FOREACH (const uint256& hash, vErase)
+        EraseOrphanTx(hash);
+    LogPrint("mempool", "Erased %d orphan tx from peer %d\n", vErase.size(), peer);
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxBytes)
 {
+    static int64_t nNextSweep = 0;
+
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans) {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        // Sweep out expired orphans, at most once per ORPHAN_TX_EXPIRE_INTERVAL
+        vector<uint256> vExpired;
+        for (map<uint256, COrphanTx>::const_iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it) {
+            if (it->second.nTimeExpire <= nNow)
+                vExpired.push_back(it->first);
+        }
+        BOOST_FOREACH (const uint256& hash, vExpired)
+            EraseOrphanTx(hash);
+        nEvicted += vExpired.size();
+        nNextSweep = nNow + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (!vExpired.empty())
+            LogPrint("mempool", "Erased %u expired orphan tx\n", vExpired.size());
+    }
+
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsBytes > nMaxBytes) {
+        // Evict the oldest orphan of the peer holding the most orphan bytes, so one peer
+        // flooding the pool cannot push out the chains other peers are relaying
+        map<NodeId, COrphanTxPeer>::iterator itHeaviest = mapOrphanTransactionsByPeer.begin();
+        for (map<NodeId, COrphanTxPeer>::iterator it = itHeaviest; it != mapOrphanTransactionsByPeer.end(); ++it) {
+            if (it->second.nBytes > itHeaviest->second.nBytes)
+                itHeaviest = it;
+        }
+        EraseOrphanTx(itHeaviest->second.mapBySequence.begin()->second);
         ++nEvicted;
     }
     return nEvicted;
 }
 
+/**
+ * Retry the orphans that spend outputs of a transaction that was just accepted to the mempool.
+ * The orphans are retried a generation at a time, oldest first: first the children of
+ * hashParent, then the children of those that got accepted, and so on. An orphan that
+ * spends several outputs of one generation is tried only once for it.
+ */
+void static ProcessOrphanTxs(const uint256& hashParent)
+{
+    AssertLockHeld(cs_main);
+
+    vector<uint256> vParents(1, hashParent);
+    set<NodeId> setMisbehaving;
+    while (!vParents.empty()) {
+        map<uint64_t, uint256> mapBatch;
+        BOOST_FOREACH (const uint256& hash, vParents) {
+            for (map<COutPoint, set<uint256> >::const_iterator it = mapOrphanTransactionsByPrev.lower_bound(COutPoint(hash, 0));
+                 it != mapOrphanTransactionsByPrev.end() && it->first.hash == hash; ++it) {
+                BOOST_FOREACH (const uint256& orphanHash, it->second)
+                    mapBatch.insert(make_pair(mapOrphanTransactions[orphanHash].nSequence, orphanHash));
+            }
+        }
+        vParents.clear();
+
+        for (map<uint64_t, uint256>::const_iterator it = mapBatch.begin(); it != mapBatch.end(); ++it) {
+            const uint256& orphanHash = it->second;
+            const COrphanTx& orphan = mapOrphanTransactions[orphanHash];
+            if (setMisbehaving.count(orphan.fromPeer))
+                continue;
+
+            bool fMissingInputs = false;
+            // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+            // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+            // anyone relaying LegitTxX banned)
+            CValidationState stateDummy;
+            if (AcceptToMemoryPool(mempool, stateDummy, orphan.tx, true, &fMissingInputs)) {
+                LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                RelayTransaction(orphan.tx);
+                vParents.push_back(orphanHash);
+                EraseOrphanTx(orphanHash);
+            } else if (!fMissingInputs) {
+                int nDos = 0;
+                if (stateDummy.IsInvalid(nDos) && nDos > 0) {
+                    // Punish peer that gave us an invalid orphan tx
+                    Misbehaving(orphan.fromPeer, nDos);
+                    setMisbehaving.insert(orphan.fromPeer);
+                    LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                }
+                // Has inputs but not accepted to mempool
+                // Probably non-standard or insufficient fee/priority
+                LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                EraseOrphanTx(orphanHash);
+            }
+            mempool.check(pcoinsTip);
+        }
+    }
+}
+
 bool IsStandardTx(const CTransaction& tx, string& reason)
 {
     AssertLockHeld(cs_main);
@@ -982,7 +1094,7 @@ bool ContextualCheckZerocoinSpend(const CTransaction& tx, const CoinSpend& spend
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state)
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1037,12 +1149,15 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
                 return state.DoS(100, error("%s: Zerocoinspend could not find accumulator associated with checksum %s", __func__, HexStr(BEGIN(nChecksum), END(nChecksum))));
             }
 
-            Accumulator accumulator(Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start()),
-                                    newSpend.getDenomination(), bnAccumulatorValue);
-
-            //Check that the coin has been accumulated
-            if(!newSpend.Verify(accumulator))
-                    return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+            libzerocoin::ZerocoinParams* paramsAccumulator = Params().Zerocoin_Params(chainActive.Height() < Params().Zerocoin_Block_V2_Start());
+            CZerocoinSpendCheck check(newSpend, paramsAccumulator, bnAccumulatorValue, tx.GetHash());
+            if (pvChecks) {
+                pvChecks->push_back(CZerocoinSpendCheck());
+                check.swap(pvChecks->back());
+            } else if (!check()) {
+                //Check that the coin has been accumulated
+                return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+            }
         }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1062,7 +1177,7 @@ bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidati
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1118,7 +1233,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationS
 
             // Do not require signature verification if this is initial sync and a block over 24 hours old
             bool fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
-            if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+            if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1212,19 +1327,94 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+/**
+ * The fee policy of AcceptToMemoryPool() for a transaction of nSize bytes paying nFees, or
+ * nModifiedFees with its PrioritiseTransaction delta, with its inputs in view. fCountFree
+ * adds the transaction to the free relay rate limiter; without it the check leaves no trace.
+ */
+static bool CheckFeePolicy(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, const CCoinsViewCache& view, CAmount nFees, CAmount nModifiedFees, unsigned int nSize, int nHeight, bool fLimitFree, bool fCountFree)
+{
+    // Once the pool has been trimmed, the cheapest packages are what got evicted. Transactions
+    // re-added after a reorg or resubmitted by the wallet do not have to beat them.
+    if (fLimitFree && !tx.IsZerocoinSpend()) {
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee)
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+    }
+
+    CAmount txMinFee = GetMinRelayFee(tx, nSize, true);
+    if (fLimitFree && nFees < txMinFee && !tx.IsZerocoinSpend())
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient fee");
+
+    // Require that free transactions have sufficient priority to be mined in the next block.
+    if (tx.IsZerocoinMint()) {
+        if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient fee for zerocoinmint");
+    } else if (!tx.IsZerocoinSpend() && GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, nHeight + 1))) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
+    }
+
+    // Continuously rate-limit free (really, very-low-fee) transactions
+    // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
+    // be annoying or make others' transactions take longer to confirm.
+    if (fLimitFree && nFees < ::minRelayTxFee.GetFee(nSize) && !tx.IsZerocoinSpend()) {
+        static CCriticalSection csFreeLimiter;
+        static double dFreeCount;
+        static int64_t nLastTime;
+        int64_t nNow = GetTime();
+
+        LOCK(csFreeLimiter);
+
+        // Use an exponentially decaying ~10-minute window:
+        double dFreeCountNow = dFreeCount * pow(1.0 - 1.0 / 600.0, (double)(nNow - nLastTime));
+        // -limitfreerelay unit is thousand-bytes-per-minute
+        // At default rate it would take over a month to fill 1GB
+        if (dFreeCountNow >= GetArg("-limitfreerelay", 30) * 10 * 1000)
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "rate limited free transaction");
+        if (fCountFree) {
+            LogPrint("mempool", "Rate limit dFreeCount: %g => %g\n", dFreeCountNow, dFreeCountNow + nSize);
+            dFreeCount = dFreeCountNow + nSize;
+            nLastTime = nNow;
+        }
+    }
+
+    return true;
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees, int64_t nAcceptTime, const CTxPreValidation* pPreValidation)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
         *pfMissingInputs = false;
+    if (pPreValidation && pPreValidation->hashTx != tx.GetHash())
+        pPreValidation = NULL;
 
     //Temporarily disable zerocoin for maintenance
     if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
         return state.DoS(10, error("AcceptToMemoryPool : Zerocoin transactions are temporarily disabled for maintenance"), REJECT_INVALID, "bad-tx");
 
-    if (!CheckTransaction(tx, chainActive.Height() >= Params().Zerocoin_StartHeight(), state))
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+    if (!CheckTransaction(tx, chainActive.Height() >= Params().Zerocoin_StartHeight(), state, &vZerocoinChecks))
         return state.DoS(100, error("AcceptToMemoryPool: : CheckTransaction failed"), REJECT_INVALID, "bad-tx");
 
+    // Spend proofs only need verifying again if the accumulator parameters changed since pre-validation
+    int nV2Start = Params().Zerocoin_Block_V2_Start();
+    if (!pPreValidation || !pPreValidation->fZerocoinChecked || (pPreValidation->nHeight < nV2Start) != (chainActive.Height() < nV2Start)) {
+        BOOST_FOREACH (CZerocoinSpendCheck& check, vZerocoinChecks) {
+            if (!check())
+                return state.DoS(100, error("AcceptToMemoryPool: : zerocoin spend did not verify"), REJECT_INVALID, "bad-tx");
+        }
+    }
+
     // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
         return state.DoS(100, error("AcceptToMemoryPool: : coinbase as individual tx"),
@@ -1375,52 +1565,21 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = 0;
         if (!tx.IsZerocoinSpend())
-            view.GetPriority(tx, chainActive.Height());
+            dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime ? nAcceptTime : GetTime(), dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
+        double dPriorityDelta = 0;
+        CAmount nModifiedFees = nFees;
+        pool.ApplyDeltas(hash, dPriorityDelta, nModifiedFees);
+
         // Don't accept it if it can't get into a block
         // but prioritise dstx and don't check fees for it
         if (mapObfuscationBroadcastTxes.count(hash)) {
             mempool.PrioritiseTransaction(hash, hash.ToString(), 1000, 0.1 * COIN);
-        } else if (!ignoreFees) {
-            CAmount txMinFee = GetMinRelayFee(tx, nSize, true);
-            if (fLimitFree && nFees < txMinFee && !tx.IsZerocoinSpend())
-                return state.DoS(0, error("AcceptToMemoryPool : not enough fees %s, %d < %d",
-                                        hash.ToString(), nFees, txMinFee),
-                    REJECT_INSUFFICIENTFEE, "insufficient fee");
-
-            // Require that free transactions have sufficient priority to be mined in the next block.
-            if (tx.IsZerocoinMint()) {
-                if(nFees < Params().Zerocoin_MintFee() * tx.GetZerocoinMintCount())
-                    return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient fee for zerocoinmint");
-            } else if (!tx.IsZerocoinSpend() && GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
-            }
-
-            // Continuously rate-limit free (really, very-low-fee) transactions
-            // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
-            // be annoying or make others' transactions take longer to confirm.
-            if (fLimitFree && nFees < ::minRelayTxFee.GetFee(nSize) && !tx.IsZerocoinSpend()) {
-                static CCriticalSection csFreeLimiter;
-                static double dFreeCount;
-                static int64_t nLastTime;
-                int64_t nNow = GetTime();
-
-                LOCK(csFreeLimiter);
-
-                // Use an exponentially decaying ~10-minute window:
-                dFreeCount *= pow(1.0 - 1.0 / 600.0, (double)(nNow - nLastTime));
-                nLastTime = nNow;
-                // -limitfreerelay unit is thousand-bytes-per-minute
-                // At default rate it would take over a month to fill 1GB
-                if (dFreeCount >= GetArg("-limitfreerelay", 30) * 10 * 1000)
-                    return state.DoS(0, error("AcceptToMemoryPool : free transaction rejected by rate limiter"),
-                        REJECT_INSUFFICIENTFEE, "rate limited free transaction");
-                LogPrint("mempool", "Rate limit dFreeCount: %g => %g\n", dFreeCount, dFreeCount + nSize);
-                dFreeCount += nSize;
-            }
+        } else if (!ignoreFees && !CheckFeePolicy(pool, state, tx, view, nFees, nModifiedFees, nSize, chainActive.Height(), fLimitFree, true)) {
+            return error("AcceptToMemoryPool : %s %s, fees %d (modified %d)", state.GetRejectReason(), hash.ToString(), nFees, nModifiedFees);
         }
 
         if (fRejectInsaneFee && nFees > ::minRelayTxFee.GetFee(nSize) * 10000)
@@ -1430,7 +1589,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
+        bool fScriptChecks = !pPreValidation || !pPreValidation->fScriptsChecked;
+        if (!CheckInputs(tx, state, view, fScriptChecks, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
 
@@ -1443,12 +1603,18 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true)) {
+        if (fScriptChecks && !CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true)) {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Trim the mempool, which may evict the transaction just added
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, error("AcceptToMemoryPool : mempool full, %s not accepted", hash.ToString()),
+                REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1659,6 +1825,145 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+class CompareEntryByAncestorCount
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetCountWithAncestors() < b.GetCountWithAncestors();
+    }
+};
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<CTxMemPoolEntry> vEntries;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vEntries.assign(mempool.mapTx.begin(), mempool.mapTx.end());
+    }
+    // Reloading then finds every parent already in the pool
+    std::stable_sort(vEntries.begin(), vEntries.end(), CompareEntryByAncestorCount());
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            LogPrintf("%s: Failed to open %s\n", __func__, pathTmp.string());
+            return;
+        }
+
+        file << MEMPOOL_DUMP_VERSION;
+        file << (uint64_t)vEntries.size();
+        BOOST_FOREACH (const CTxMemPoolEntry& entry, vEntries) {
+            const uint256& hash = entry.GetTx().GetHash();
+            std::pair<double, CAmount> deltas(0, 0);
+            std::map<uint256, std::pair<double, CAmount> >::iterator it = mapDeltas.find(hash);
+            if (it != mapDeltas.end()) {
+                deltas = it->second;
+                mapDeltas.erase(it);
+            }
+            file << entry.GetTx();
+            file << entry.GetTime();
+            file << deltas;
+        }
+        // Prioritisations of transactions that are not in the pool
+        file << mapDeltas;
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(pathTmp, GetDataDir() / "mempool.dat");
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Failed to dump mempool: %s. Continuing anyway.\n", __func__, e.what());
+        return;
+    }
+
+    int64_t nEnd = GetTimeMicros();
+    LogPrintf("Dumped mempool: %u transactions, %.2fms to copy, %.2fms to dump\n", vEntries.size(), 0.001 * (nMid - nStart), 0.001 * (nEnd - nMid));
+}
+
+bool LoadMempool()
+{
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("%s: Failed to open %s. Continuing anyway.\n", __func__, path.string());
+        return false;
+    }
+
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
+    uint64_t nTotal = 0;
+    unsigned int nAccepted = 0, nFailed = 0, nExpired = 0, nAlreadyThere = 0;
+    std::map<std::string, unsigned int> mapRejectReasons;
+
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("%s: Unknown mempool file version %u. Continuing anyway.\n", __func__, nVersion);
+            return false;
+        }
+        file >> nTotal;
+
+        // Transactions are read and accepted one at a time, the file is never held in memory
+        for (uint64_t i = 0; i < nTotal; i++) {
+            CTransaction tx;
+            int64_t nTime;
+            std::pair<double, CAmount> deltas;
+            file >> tx;
+            file >> nTime;
+            file >> deltas;
+
+            const uint256& hash = tx.GetHash();
+            if (deltas.first != 0 || deltas.second != 0)
+                mempool.PrioritiseTransaction(hash, hash.ToString(), deltas.first, deltas.second);
+
+            if (nTime + nExpiryTimeout <= nNow) {
+                nExpired++;
+            } else if (mempool.exists(hash)) {
+                nAlreadyThere++;
+            } else {
+                // These were accepted before the restart, so don't rate-limit them as free relays
+                LOCK(cs_main);
+                CValidationState state;
+                if (AcceptToMemoryPool(mempool, state, tx, false, NULL, false, false, nTime)) {
+                    nAccepted++;
+                } else {
+                    nFailed++;
+                    mapRejectReasons[state.GetRejectReason().empty() ? "unknown" : state.GetRejectReason()]++;
+                }
+            }
+
+            if (ShutdownRequested())
+                return false;
+        }
+
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", __func__, e.what());
+        return false;
+    }
+
+    double dSeconds = 0.000001 * (GetTimeMicros() - nStart);
+    LogPrintf("Imported mempool transactions from disk: %u accepted, %u rejected, %u expired, %u already there in %.2fs (%.0f tx/s)\n",
+              nAccepted, nFailed, nExpired, nAlreadyThere, dSeconds, dSeconds > 0 ? nTotal / dSeconds : 0.0);
+    for (std::map<std::string, unsigned int>::const_iterator it = mapRejectReasons.begin(); it != mapRejectReasons.end(); ++it)
+        LogPrintf("  rejected %u: %s\n", it->second, it->first);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
@@ -2054,6 +2359,81 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CZerocoinSpendCheck::operator()()
+{
+    try {
+        std::vector<const CoinSpend*> vUnverified;
+        std::vector<unsigned int> vIndex;
+        for (unsigned int i = 0; i < vSpends.size(); i++) {
+            if (!IsZerocoinSpendVerified(*vSpends[i], paramsAccumulator, bnAccumulatorValue)) {
+                vUnverified.push_back(vSpends[i].get());
+                vIndex.push_back(i);
+            }
+        }
+        if (vUnverified.empty())
+            return true;
+
+        // Every spend still gets its own result, which tells the bad one apart
+        Accumulator accumulator(paramsAccumulator, vUnverified[0]->getDenomination(), bnAccumulatorValue);
+        std::vector<bool> vResults;
+        CoinSpend::BatchVerify(accumulator, vUnverified, vResults);
+        for (unsigned int i = 0; i < vUnverified.size(); i++) {
+            if (!vResults[i])
+                return ::error("CZerocoinSpendCheck(): zerocoin spend with serial %s in tx %s did not verify",
+                               vUnverified[i]->getCoinSerialNumber().GetHex().substr(0, 10), vTxid[vIndex[i]].GetHex());
+            SetZerocoinSpendVerified(*vUnverified[i], paramsAccumulator, bnAccumulatorValue);
+        }
+    } catch (const std::exception& e) {
+        return ::error("CZerocoinSpendCheck(): exception verifying spend in tx %s: %s", vTxid.empty() ? "" : vTxid[0].GetHex(), e.what());
+    }
+    return true;
+}
+
+bool CZerocoinSpendCheck::SameAccumulator(const CZerocoinSpendCheck& check) const
+{
+    return paramsAccumulator == check.paramsAccumulator && bnAccumulatorValue == check.bnAccumulatorValue &&
+           !vSpends.empty() && !check.vSpends.empty() && vSpends[0]->getDenomination() == check.vSpends[0]->getDenomination();
+}
+
+void CZerocoinSpendCheck::Merge(CZerocoinSpendCheck& check)
+{
+    vSpends.insert(vSpends.end(), check.vSpends.begin(), check.vSpends.end());
+    vTxid.insert(vTxid.end(), check.vTxid.begin(), check.vTxid.end());
+    check.vSpends.clear();
+    check.vTxid.clear();
+}
+
+/**
+ * Merge the checks of spends against the same accumulator into at most nGroups checks per
+ * accumulator, dealt out in turn, so that each group verifies with one shared verifier while
+ * the groups still run in parallel.
+ */
+static void MergeZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks, unsigned int nGroups)
+{
+    std::vector<CZerocoinSpendCheck> vMerged;
+    // The merged checks of each accumulator, and the next one to deal a spend to
+    std::vector<std::pair<std::vector<size_t>, size_t> > vAccumulators;
+    BOOST_FOREACH (CZerocoinSpendCheck& check, vChecks) {
+        std::pair<std::vector<size_t>, size_t>* pgroups = NULL;
+        for (unsigned int i = 0; i < vAccumulators.size() && !pgroups; i++) {
+            if (vMerged[vAccumulators[i].first[0]].SameAccumulator(check))
+                pgroups = &vAccumulators[i];
+        }
+        if (!pgroups) {
+            vAccumulators.push_back(std::make_pair(std::vector<size_t>(), 0));
+            pgroups = &vAccumulators.back();
+        }
+        if (pgroups->first.size() < std::max(1U, nGroups)) {
+            vMerged.push_back(CZerocoinSpendCheck());
+            vMerged.back().swap(check);
+            pgroups->first.push_back(vMerged.size() - 1);
+        } else {
+            vMerged[pgroups->first[pgroups->second++ % pgroups->first.size()]].Merge(check);
+        }
+    }
+    vChecks.swap(vMerged);
+}
+
 CBitcoinAddress addressExp1("DQZzqnSR6PXxagep1byLiRg9ZurCZ5KieQ");
 CBitcoinAddress addressExp2("DTQYdnNqKuEHXyNeeYhPQGGGdqHbXYwjpj");
 
@@ -2126,6 +2506,35 @@ CAmount GetInvalidUTXOValue()
     return nValue;
 }
 
+/** Verify the script of input nIn of tx, setting state on failure as CheckInputs() does */
+static bool CheckInputScript(const CCoins& coins, const CTransaction& tx, unsigned int nIn, unsigned int flags, bool cacheStore, CValidationState& state)
+{
+    CScriptCheck check(coins, tx, nIn, flags, cacheStore);
+    if (check())
+        return true;
+
+    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // non-standard DER encodings or non-null dummy
+        // arguments; if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        CScriptCheck check(coins, tx, nIn,
+            flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+        if (check())
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after a soft-fork
+    // super-majority vote has passed.
+    return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck>* pvChecks)
 {
     if (!tx.IsCoinBase() && !tx.IsZerocoinSpend()) {
@@ -2193,31 +2602,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
-                            flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
-                        if (check())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after a soft-fork
-                    // super-majority vote has passed.
-                    return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    CScriptCheck(*coins, tx, i, flags, cacheStore).swap(pvChecks->back());
+                } else if (!CheckInputScript(*coins, tx, i, flags, cacheStore, state)) {
+                    return false;
                 }
             }
         }
@@ -2359,6 +2748,9 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             if(!EraseAccumulatorValues(nCheckpoint, pindex->pprev->nAccumulatorCheckpoint))
                 return error("DisconnectBlock(): failed to erase checkpoint");
         }
+
+        if (!zerocoinDB->EraseBlockMints(pindex->nHeight))
+            return error("DisconnectBlock(): failed to erase block mint index");
     }
 
     if (pfClean) {
@@ -2395,6 +2787,8 @@ void static FlushBlockFile(bool fFinalize = false)
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+//! ConnectBlock and transaction pre-validation share the queue; only one of them may drive it at a time
+static boost::mutex csScriptCheckQueue;
 
 void ThreadScriptCheck()
 {
@@ -2402,7 +2796,142 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
-void RecalculateZMASTERMinted()
+static CCheckQueue<CZerocoinSpendCheck> zerocoinspendcheckqueue(8);
+//! CheckBlock may run concurrently from several threads; only one of them may drive the queue at a time
+static boost::mutex csZerocoinSpendCheckQueue;
+
+void ThreadZerocoinSpendCheck()
+{
+    RenameThread("masterstake-zcspendch");
+    zerocoinspendcheckqueue.Thread();
+}
+
+bool PreValidateTransaction(const CTransaction& tx, CValidationState& state, CTxPreValidation& prevalidation, bool fLimitFree, bool ignoreFees)
+{
+    prevalidation = CTxPreValidation();
+    prevalidation.hashTx = tx.GetHash();
+
+    // Snapshot the chain height and the spent coins; nothing below needs cs_main. Transactions
+    // AcceptToMemoryPool() rejects without any expensive check are left to it: already known,
+    // conflicting, or not paying the fee policy. Only the rest get their proofs and scripts run.
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    bool fHaveInputs = !tx.IsCoinBase() && !tx.IsZerocoinSpend();
+    {
+        LOCK(cs_main);
+        if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
+            return true;
+        string reason;
+        if (Params().RequireStandard() && !IsStandardTx(tx, reason))
+            return true;
+        if (tx.IsCoinBase() || tx.IsCoinStake())
+            return true;
+
+        prevalidation.nHeight = chainActive.Height();
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (mapLockedInputs.count(txin.prevout) && mapLockedInputs[txin.prevout] != prevalidation.hashTx)
+                return true;
+        }
+
+        LOCK(mempool.cs);
+        if (mempool.exists(prevalidation.hashTx))
+            return true;
+        if (fHaveInputs) {
+            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+                if (mempool.mapNextTx.count(txin.prevout))
+                    return true;
+            }
+
+            CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+            view.SetBackend(viewMemPool);
+            if (view.HaveCoins(prevalidation.hashTx)) {
+                view.SetBackend(dummy);
+                return true;
+            }
+            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+                if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+                    fHaveInputs = false;
+                    break;
+                }
+            }
+            view.SetBackend(dummy);
+
+            if (fHaveInputs && !ignoreFees && !mapObfuscationBroadcastTxes.count(prevalidation.hashTx)) {
+                CAmount nFees = view.GetValueIn(tx) - tx.GetValueOut();
+                double dPriorityDelta = 0;
+                CAmount nModifiedFees = nFees;
+                mempool.ApplyDeltas(prevalidation.hashTx, dPriorityDelta, nModifiedFees);
+                unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+                CValidationState stateFees;
+                if (!CheckFeePolicy(mempool, stateFees, tx, view, nFees, nModifiedFees, nSize, prevalidation.nHeight, fLimitFree, false))
+                    return true;
+            }
+        }
+    }
+
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+    if (!CheckTransaction(tx, prevalidation.nHeight >= Params().Zerocoin_StartHeight(), state, &vZerocoinChecks))
+        return state.DoS(100, error("PreValidateTransaction : CheckTransaction failed"), REJECT_INVALID, "bad-tx");
+
+    if (!vZerocoinChecks.empty()) {
+        boost::unique_lock<boost::mutex> lockZerocoinQueue(csZerocoinSpendCheckQueue, boost::try_to_lock);
+        bool fParallelZerocoin = nScriptCheckThreads && lockZerocoinQueue.owns_lock();
+        CCheckQueueControl<CZerocoinSpendCheck> control(fParallelZerocoin ? &zerocoinspendcheckqueue : NULL);
+        if (fParallelZerocoin) {
+            control.Add(vZerocoinChecks);
+        } else {
+            BOOST_FOREACH (CZerocoinSpendCheck& check, vZerocoinChecks) {
+                if (!check())
+                    return state.DoS(100, error("PreValidateTransaction : zerocoin spend did not verify"), REJECT_INVALID, "bad-tx");
+            }
+        }
+        if (!control.Wait())
+            return state.DoS(100, error("PreValidateTransaction : zerocoin spend did not verify"), REJECT_INVALID, "bad-tx");
+    }
+    prevalidation.fZerocoinChecked = true;
+
+    // Inputs that are missing or already spent are for AcceptToMemoryPool() to report
+    if (!fHaveInputs)
+        return true;
+
+    // Non-standard inputs and excess sigops are rejected before any script runs
+    if (Params().RequireStandard() && !AreInputsStandard(tx, view))
+        return true;
+    if (GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view) > MAX_TX_SIGOPS_CURRENT)
+        return true;
+
+    bool fScriptsOk = false;
+    if (nScriptCheckThreads && tx.vin.size() > 1) {
+        boost::unique_lock<boost::mutex> lockScriptQueue(csScriptCheckQueue, boost::try_to_lock);
+        if (lockScriptQueue.owns_lock()) {
+            std::vector<CScriptCheck> vChecks;
+            vChecks.reserve(tx.vin.size());
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                vChecks.push_back(CScriptCheck());
+                CScriptCheck(*view.AccessCoins(tx.vin[i].prevout.hash), tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, true).swap(vChecks.back());
+            }
+            CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+            control.Add(vChecks);
+            fScriptsOk = control.Wait();
+        }
+    }
+
+    // Verify inline if the queue was not used, or again to find out why it failed. Successful
+    // signatures are in the signature cache by now, so the mandatory flags pass is cheap.
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const CCoins& coins = *view.AccessCoins(tx.vin[i].prevout.hash);
+        if (!fScriptsOk && !CheckInputScript(coins, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, true, state))
+            return error("PreValidateTransaction : script verification failed for %s", prevalidation.hashTx.ToString());
+        if (!CheckInputScript(coins, tx, i, MANDATORY_SCRIPT_VERIFY_FLAGS, true, state))
+            return error("PreValidateTransaction : BUG! PLEASE REPORT THIS! input %u failed against MANDATORY but not STANDARD flags %s", i, prevalidation.hashTx.ToString());
+    }
+    prevalidation.fScriptsChecked = true;
+
+    return true;
+}
+
+bool RecalculateZMASTERMinted()
 {
     CBlockIndex *pindex = chainActive[Params().Zerocoin_StartHeight()];
     int nHeightEnd = chainActive.Height();
@@ -2411,22 +2940,20 @@ void RecalculateZMASTERMinted()
             LogPrintf("%s : block %d...\n", __func__, pindex->nHeight);
 
         //overwrite possibly wrong vMintsInBlock data
-        CBlock block;
-        assert(ReadBlockFromDisk(block, pindex));
+        std::list<PublicCoin> listPubcoins;
+        if (!BlockIndexToPubcoinList(pindex, listPubcoins))
+            return error("%s : failed to get the mints of block %d", __func__, pindex->nHeight);
 
-        std::list<CZerocoinMint> listMints;
-        BlockToZerocoinMintList(block, listMints, true);
-
-        vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
-        for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+        pindex->zerocoinMintsInBlock.clear();
+        for (const PublicCoin& pubcoin : listPubcoins)
+            pindex->zerocoinMintsInBlock.push_back(pubcoin.getDenomination());
 
         if (pindex->nHeight < nHeightEnd)
             pindex = chainActive.Next(pindex);
         else
             break;
     }
+    return true;
 }
 
 void RecalculateZMASTERSpent()
@@ -2443,17 +2970,15 @@ void RecalculateZMASTERSpent()
         list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block, true);
 
         //Reset the supply to previous block
-        pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
+        pindex->zerocoinSupply = pindex->pprev->zerocoinSupply;
 
         //Add mints to zMASTERsupply
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-            pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
-        }
+        for (auto denom : libzerocoin::zerocoinDenomList)
+            pindex->zerocoinSupply.at(denom) += pindex->zerocoinMintsInBlock.count(denom);
 
         //Remove spends from zMASTERsupply
         for (auto denom : listDenomsSpent)
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->zerocoinSupply.at(denom)--;
 
         //Rewrite money supply
         assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
@@ -2533,8 +3058,15 @@ bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError
         //search the chain to see when zerocoin started
         int nZerocoinStart = Params().Zerocoin_Block_V2_Start();
 
-        // find each checkpoint that is missing
+        // find each checkpoint that is missing, after the last one that an interrupted reindex recalculated
         CBlockIndex* pindex = chainActive[nZerocoinStart];
+        int nHeightDone;
+        uint256 hashBlockDone;
+        if (zerocoinDB->ReadReindexProgress("accumulators", nHeightDone, hashBlockDone) && nHeightDone <= chainActive.Height() &&
+            chainActive[nHeightDone]->GetBlockHash() == hashBlockDone) {
+            LogPrintf("%s : resuming after block %d\n", __func__, nHeightDone);
+            pindex = chainActive[nHeightDone + 1];
+        }
         while (pindex) {
             uiInterface.ShowProgress(_("Calculating missing accumulators..."), std::max(1, std::min(99, (int)((double)(pindex->nHeight - nZerocoinStart) / (double)(chainActive.Height() - nZerocoinStart) * 100))));
 
@@ -2564,11 +3096,18 @@ bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError
                     DatabaseChecksums(mapAccumulators);
                     auto it = find(listMissingCheckpoints.begin(), listMissingCheckpoints.end(), pindex->nAccumulatorCheckpoint);
                     listMissingCheckpoints.erase(it);
+                    if (!zerocoinDB->WriteReindexProgress("accumulators", pindex->nHeight, pindex->GetBlockHash())) {
+                        strError = _("Error writing zerocoinDB to disk");
+                        return error("%s: %s", __func__, strError);
+                    }
                 }
             }
             pindex = chainActive.Next(pindex);
         }
         uiInterface.ShowProgress("", 100);
+
+        if (!ShutdownRequested())
+            zerocoinDB->EraseReindexProgress("accumulators");
     }
     return true;
 }
@@ -2581,21 +3120,18 @@ bool UpdateZMASTERSupply(const CBlock& block, CBlockIndex* pindex)
     std::list<libzerocoin::CoinDenomination> listSpends = ZerocoinSpendListFromBlock(block, fFilterInvalid);
 
     // Initialize zerocoin supply to the supply from previous block
-    if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3) {
-        for (auto& denom : zerocoinDenomList) {
-            pindex->mapZerocoinSupply.at(denom) = pindex->pprev->mapZerocoinSupply.at(denom);
-        }
-    }
+    if (pindex->pprev && pindex->pprev->GetBlockHeader().nVersion > 3)
+        pindex->zerocoinSupply = pindex->pprev->zerocoinSupply;
 
     // Track zerocoin money supply
     CAmount nAmountZerocoinSpent = 0;
-    pindex->vMintDenominationsInBlock.clear();
+    pindex->zerocoinMintsInBlock.clear();
     if (pindex->pprev) {
         std::set<uint256> setAddedToWallet;
         for (auto& m : listMints) {
             libzerocoin::CoinDenomination denom = m.GetDenomination();
-            pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
-            pindex->mapZerocoinSupply.at(denom)++;
+            pindex->zerocoinMintsInBlock.push_back(m.GetDenomination());
+            pindex->zerocoinSupply.at(denom)++;
 
             //Remove any of our own mints from the mintpool
             if (pwalletMain) {
@@ -2620,17 +3156,17 @@ bool UpdateZMASTERSupply(const CBlock& block, CBlockIndex* pindex)
         }
 
         for (auto& denom : listSpends) {
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->zerocoinSupply.at(denom)--;
             nAmountZerocoinSpent += libzerocoin::ZerocoinDenominationToAmount(denom);
 
             // zerocoin failsafe
-            if (pindex->mapZerocoinSupply.at(denom) < 0)
+            if (pindex->zerocoinSupply.at(denom) < 0)
                 return error("Block contains zerocoins that spend more than are in the available supply to spend");
         }
     }
 
     for (auto& denom : zerocoinDenomList)
-        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->mapZerocoinSupply.at(denom));
+        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->zerocoinSupply.at(denom));
 
     return true;
 }
@@ -2692,6 +3228,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
+    boost::unique_lock<boost::mutex> lockScriptQueue(csScriptCheckQueue, boost::defer_lock);
+    if (fScriptChecks && nScriptCheckThreads)
+        lockScriptQueue.lock();
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
@@ -2919,6 +3458,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (!zerocoinDB->WriteCoinSpendBatch(vSpends)) return state.Abort(("Failed to record coin serials to database"));
     if (!zerocoinDB->WriteCoinMintBatch(vMints)) return state.Abort(("Failed to record new mints to database"));
 
+    //Index the mints by height and denomination for the accumulator and witness calculations
+    if (pindex->nHeight >= Params().Zerocoin_StartHeight()) {
+        std::list<PublicCoin> listPubcoins;
+        if (!BlockToPubcoinList(block, listPubcoins, true) || !WriteBlockMintIndex(pindex, listPubcoins))
+            return state.Abort(("Failed to record block mint index to database"));
+    }
+
     //Record accumulator checksums
     DatabaseChecksums(mapAccumulators);
 
@@ -3116,10 +3662,14 @@ bool static DisconnectTip(CValidationState& state)
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    InvalidateStakeModifierCache(pindexDelete->nHeight);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-        SyncWithWallets(tx, NULL);
+    {
+        CWalletBatch walletBatch(pwalletMain);
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            SyncWithWallets(tx, NULL);
+        }
     }
     return true;
 }
@@ -3191,14 +3741,18 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
-    // Tell wallet about transactions that went from mempool
-    // to conflicted:
-    BOOST_FOREACH (const CTransaction& tx, txConflicted) {
-        SyncWithWallets(tx, NULL);
-    }
-    // ... and about transactions that got confirmed:
-    BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
-        SyncWithWallets(tx, pblock);
+    {
+        // The wallet commits its updates for the block in one batch
+        CWalletBatch walletBatch(pwalletMain);
+        // Tell wallet about transactions that went from mempool
+        // to conflicted:
+        BOOST_FOREACH (const CTransaction& tx, txConflicted) {
+            SyncWithWallets(tx, NULL);
+        }
+        // ... and about transactions that got confirmed:
+        BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
+            SyncWithWallets(tx, pblock);
+        }
     }
 
     int64_t nTime6 = GetTimeMicros();
@@ -3584,8 +4138,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3905,11 +4458,15 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
-    // Check transactions
+    // Check transactions, handing zerocoin spend proofs to the verification threads when the queue is free
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
+    boost::unique_lock<boost::mutex> lockZerocoinQueue(csZerocoinSpendCheckQueue, boost::try_to_lock);
+    bool fParallelZerocoin = nScriptCheckThreads && lockZerocoinQueue.owns_lock();
+    CCheckQueueControl<CZerocoinSpendCheck> control(fParallelZerocoin ? &zerocoinspendcheckqueue : NULL);
     vector<CBigNum> vBlockSerials;
+    std::vector<CZerocoinSpendCheck> vZerocoinChecks;
     for (const CTransaction& tx : block.vtx) {
-        if (!CheckTransaction(tx, fZerocoinActive, state))
+        if (!CheckTransaction(tx, fZerocoinActive, state, &vZerocoinChecks))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zMASTERspends in this block
@@ -3926,6 +4483,18 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
+    // Spends against the same accumulator share one proof verifier, per verification thread
+    MergeZerocoinSpendChecks(vZerocoinChecks, fParallelZerocoin ? nScriptCheckThreads : 1);
+    if (fParallelZerocoin) {
+        control.Add(vZerocoinChecks);
+    } else {
+        BOOST_FOREACH (CZerocoinSpendCheck& check, vZerocoinChecks) {
+            if (!check())
+                return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"),
+                    REJECT_INVALID, "bad-zerocoinspend");
+        }
+    }
+
 
     unsigned int nSigOps = 0;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -3936,6 +4505,10 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
             REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (!control.Wait())
+        return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"),
+            REJECT_INVALID, "bad-zerocoinspend");
+
     return true;
 }
 
@@ -4507,9 +5080,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
     //mark as PoS seen
@@ -4521,6 +5092,12 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+void ReserveBlockIndex(size_t nCount)
+{
+    blockIndexArena.Reserve(nCount);
+    mapBlockIndex.rehash(mapBlockIndex.size() + nCount);
+}
+
 bool static LoadBlockIndexDB(string& strError)
 {
     if (!pblocktree->LoadBlockIndexGuts())
@@ -5720,8 +6297,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
 
     else if (strCommand == "tx" || strCommand == "dstx") {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
 
         //masternode signed transaction
@@ -5773,69 +6348,31 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify scripts and spend proofs before taking cs_main, so that block validation
+        // and the rest of the node are not held up by them
+        CValidationState state;
+        CTxPreValidation prevalidation;
+        bool fPreValid = PreValidateTransaction(tx, state, prevalidation, true, ignoreFees);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
         bool fMissingZerocoinInputs = false;
-        CValidationState state;
 
         mapAlreadyAskedFor.erase(inv);
 
-        if (!tx.IsZerocoinSpend() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees)) {
+        if (fPreValid && !tx.IsZerocoinSpend() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees, 0, &prevalidation)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s : accepted %s (poolsz %u)\n",
                      pfrom->id, pfrom->cleanSubVer,
                      tx.GetHash().ToString(),
                      mempool.mapTx.size());
 
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for(unsigned int i = 0; i < vWorkQueue.size(); i++) {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if(itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for(set<uint256>::iterator mi = itByPrev->second.begin();
-                    mi != itByPrev->second.end();
-                    ++mi) {
-                    const uint256 &orphanHash = *mi;
-                    const CTransaction &orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if(setMisbehaving.count(fromPeer))
-                        continue;
-                    if(AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    } else if(!fMissingInputs2) {
-                        int nDos = 0;
-                        if(stateDummy.IsInvalid(nDos) && nDos > 0) {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH (uint256 hash, vEraseQueue)EraseOrphanTx(hash);
-        } else if (tx.IsZerocoinSpend() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingZerocoinInputs, false, ignoreFees)) {
+            // Retry any orphan transactions that depended on this one
+            ProcessOrphanTxs(inv.hash);
+        } else if (fPreValid && tx.IsZerocoinSpend() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingZerocoinInputs, false, ignoreFees, 0, &prevalidation)) {
             //Presstab: ZCoin has a bunch of code commented out here. Is this something that should have more going on?
             //Also there is nothing that handles fMissingZerocoinInputs. Does there need to be?
             RelayTransaction(tx);
@@ -5848,7 +6385,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            size_t nMaxOrphanBytes = (size_t)std::max((int64_t)0, GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_POOL_SIZE)) * 1000000;
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanBytes);
             if (nEvicted > 0)
                 LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
         } else if (pfrom->fWhitelisted) {
@@ -5894,6 +6432,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the whole message before taking cs_main; Quark headers are
+        // hashed several at a time.
+        std::vector<uint256> vHeaderHashes(nCount);
+        std::vector<unsigned char> vQuarkHeaders;
+        vQuarkHeaders.reserve(nCount * QUARK_HEADER_SIZE);
+        for (unsigned int n = 0; n < nCount; n++) {
+            if (headers[n].nVersion < 4)
+                vQuarkHeaders.insert(vQuarkHeaders.end(), BEGIN(headers[n].nVersion), END(headers[n].nNonce));
+            else
+                vHeaderHashes[n] = headers[n].GetHash();
+        }
+        if (!vQuarkHeaders.empty()) {
+            std::vector<uint256> vQuarkHashes(vQuarkHeaders.size() / QUARK_HEADER_SIZE);
+            HashQuarkN(&vQuarkHeaders[0], vQuarkHashes.size(), &vQuarkHashes[0]);
+            for (unsigned int n = 0, i = 0; n < nCount; n++)
+                if (headers[n].nVersion < 4)
+                    vHeaderHashes[n] = vQuarkHashes[i++];
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5901,13 +6458,21 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
         CBlockIndex* pindexLast = NULL;
-        BOOST_FOREACH (const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
+            if (n > 0 && header.hashPrevBlock != vHeaderHashes[n - 1]) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
 
+            // Headers we already have valid entries for need no further checks
+            BlockMap::iterator mi = mapBlockIndex.find(vHeaderHashes[n]);
+            if (mi != mapBlockIndex.end() && !(mi->second->nStatus & BLOCK_FAILED_MASK)) {
+                pindexLast = mi->second;
+                continue;
+            }
+
             /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
              * before headers are reimplemented on mainnet
              */
@@ -5916,7 +6481,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
                         Misbehaving(pfrom->GetId(), nDoS);
-                    std::string strError = "invalid header received " + header.GetHash().ToString();
+                    std::string strError = "invalid header received " + vHeaderHashes[n].ToString();
                     return error(strError.c_str());
                 }
             }
@@ -6631,14 +7196,12 @@ public:
     CMainCleanup() {}
     ~CMainCleanup()
     {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, freed with blockIndexArena
         mapBlockIndex.clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactionsByPeer.clear();
     }
 } instance_of_cmaincleanup;
@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -51,6 +52,7 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -62,6 +64,12 @@ static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool, saving the mempool on shutdown and reloading it on startup */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -76,7 +84,15 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS_CURRENT = MAX_BLOCK_SIGOPS_CURRENT / 5;
 static const unsigned int MAX_TX_SIGOPS_LEGACY = MAX_BLOCK_SIGOPS_LEGACY / 5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
-static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 1000;
+/** Default for -maxorphansize, maximum megabytes of orphan transactions kept in memory */
+static const unsigned int DEFAULT_MAX_ORPHAN_POOL_SIZE = 2;
+/** Orphan transactions larger than this are not kept */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Expiration time for orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time between sweeps for expired orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -221,6 +237,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the zerocoin spend proof verification thread */
+void ThreadZerocoinSpendCheck();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -248,6 +266,8 @@ CAmount GetBlockValue(int nHeight);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex* InsertBlockIndex(uint256 hash);
+/** Prepare mapBlockIndex and its allocator for nCount more entries */
+void ReserveBlockIndex(size_t nCount);
 /** Abort with a message */
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
@@ -258,11 +278,38 @@ void Misbehaving(NodeId nodeid, int howmuch);
 void FlushStateToDisk();
 
 
+/** The checks PreValidateTransaction() completed for a transaction, which AcceptToMemoryPool() can skip */
+struct CTxPreValidation {
+    uint256 hashTx;
+    //! Every input script passed the standard and mandatory verification flags
+    bool fScriptsChecked;
+    //! Every zerocoin spend proof verified against the accumulator parameters for nHeight
+    bool fZerocoinChecked;
+    int nHeight;
+
+    CTxPreValidation() : fScriptsChecked(false), fZerocoinChecked(false), nHeight(-1) {}
+};
+
+/**
+ * Run the expensive checks of AcceptToMemoryPool() without holding cs_main: context-free
+ * transaction checks, zerocoin spend proofs and input scripts, against a snapshot of the inputs.
+ * Transactions that AcceptToMemoryPool() rejects cheaply, with the same fLimitFree and
+ * ignoreFees, are left unchecked. Returns false if the transaction is invalid; otherwise
+ * records in prevalidation what was checked.
+ */
+bool PreValidateTransaction(const CTransaction& tx, CValidationState& state, CTxPreValidation& prevalidation, bool fLimitFree, bool ignoreFees);
+
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false, int64_t nAcceptTime = 0, const CTxPreValidation* pPreValidation = NULL);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
 
+/** Write the mempool to mempool.dat, parents before their children */
+void DumpMempool();
+
+/** Re-accept the transactions saved in mempool.dat, keeping their original entry times */
+bool LoadMempool();
+
 int GetInputAge(CTxIn& vin);
 int GetInputAgeIX(uint256 nTXHash, CTxIn& vin);
 bool GetCoinAge(const CTransaction& tx, unsigned int nTxTime, uint64_t& nCoinAge);
@@ -353,17 +400,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state);
+/**
+ * Context-independent validity checks. If pvZerocoinChecks is not NULL, zerocoin spend proof
+ * verifications are pushed onto it instead of being performed inline.
+ */
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvChecks = NULL);
 bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend& spend, CBlockIndex* pindex);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx);
 bool IsBlockHashInChain(const uint256& hashBlock);
 bool ValidOutPoint(const COutPoint out, int nHeight);
 void RecalculateZMASTERSpent();
-void RecalculateZMASTERMinted();
+bool RecalculateZMASTERMinted();
 bool RecalculateMASTERSupply(int nHeightStart);
 bool ReindexAccumulators(list<uint256>& listMissingCheckpoints, string& strError);
 
@@ -437,6 +487,41 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing zerocoin spend proof verifications (commitment PoK,
+ * accumulator PoK and serial number SoK) against a known accumulator value.
+ * Spends merged into one check share a single accumulator proof verifier.
+ */
+class CZerocoinSpendCheck
+{
+private:
+    std::vector<std::shared_ptr<const libzerocoin::CoinSpend> > vSpends;
+    std::vector<uint256> vTxid;
+    libzerocoin::ZerocoinParams* paramsAccumulator;
+    CBigNum bnAccumulatorValue;
+
+public:
+    CZerocoinSpendCheck() : paramsAccumulator(NULL) {}
+    CZerocoinSpendCheck(const libzerocoin::CoinSpend& spendIn, libzerocoin::ZerocoinParams* paramsIn, const CBigNum& bnAccumulatorValueIn, const uint256& txidIn) :
+                                                                                 vSpends(1, std::make_shared<const libzerocoin::CoinSpend>(spendIn)), vTxid(1, txidIn),
+                                                                                 paramsAccumulator(paramsIn), bnAccumulatorValue(bnAccumulatorValueIn) {}
+
+    bool operator()();
+
+    //! Whether check verifies against the same accumulator, so that the two can be merged
+    bool SameAccumulator(const CZerocoinSpendCheck& check) const;
+    //! Take over the spends of check, which must verify against the same accumulator
+    void Merge(CZerocoinSpendCheck& check);
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        vSpends.swap(check.vSpends);
+        vTxid.swap(check.vTxid);
+        std::swap(paramsAccumulator, check.paramsAccumulator);
+        std::swap(bnAccumulatorValue, check.bnAccumulatorValue);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
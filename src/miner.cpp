@@ -32,7 +32,6 @@
 
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -41,53 +40,327 @@ using namespace std;
 // MasterStakeMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastCoinStakeSearchInterval = 0;
+
+// Give a high priority to zerocoinspends to get into the next block
+// Priority = (age^6+100000)*amount - gives higher priority to zmasters that have been in mempool long
+// and higher priority to zmasters that are large in value
+static double GetZerocoinSpendPriority(const CTransaction& tx)
 {
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    int64_t nTimeSeen = GetAdjustedTime();
+    double nConfs = 100000;
+
+    auto it = mapZerocoinspends.find(tx.GetHash());
+    if (it != mapZerocoinspends.end()) {
+        nTimeSeen = it->second;
+    } else {
+        //for some reason not in map, add it
+        mapZerocoinspends[tx.GetHash()] = nTimeSeen;
+    }
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
+
+    // zMASTERspends can have very large priority, use non-overflowing safe functions
+    double dPriority = double_safe_addition(0, (nTimePriority * nConfs));
+    return double_safe_multiplication(dPriority, tx.GetZerocoinSpent());
+}
+
+typedef std::pair<double, CTxMemPool::txiter> TxPriority;
+class CompareTxPriority
+{
+public:
+    bool operator()(const TxPriority& a, const TxPriority& b) const
     {
+        if (a.first == b.first)
+            return a.second->GetTx().GetHash() < b.second->GetTx().GetHash();
+        return a.first < b.first;
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
+class CompareTxByAncestorCount
+{
+public:
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() == b->GetCountWithAncestors())
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+    }
+};
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/**
+ * Fills a block template with mempool transactions. High-priority transactions
+ * are taken first, up to -blockprioritysize, and the rest of the block is filled
+ * with ancestor packages in the order of the mempool's ancestor_score index,
+ * which the mempool keeps sorted as transactions come and go. Parents always go in before
+ * their children, so no per-template dependency tracking is needed.
+ *
+ * Requires cs_main and mempool.cs.
+ */
+class CBlockTxSelector
 {
-    bool byFee;
+private:
+    typedef CTxMemPool::txiter txiter;
+
+    CBlockTemplate* pblocktemplate;
+    CCoinsViewCache view;
+    const int nHeight;
+    const bool fPrintPriority;
+
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed;
+    std::vector<CBigNum> vBlockSerials;
+
+    bool AddTx(txiter it, double dPriority, const CFeeRate& feeRate);
 
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+    unsigned int nPackagesConsidered;
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+    CBlockTxSelector(CBlockTemplate* pblocktemplateIn, int nHeightIn);
+
+    void AddPriorityTxs();
+    void AddPackageTxs();
+};
+
+CBlockTxSelector::CBlockTxSelector(CBlockTemplate* pblocktemplateIn, int nHeightIn) : pblocktemplate(pblocktemplateIn),
+                                                                                      view(pcoinsTip),
+                                                                                      nHeight(nHeightIn),
+                                                                                      fPrintPriority(GetBoolArg("-printpriority", false)),
+                                                                                      nBlockSize(1000),
+                                                                                      nBlockTx(0),
+                                                                                      nBlockSigOps(100),
+                                                                                      nFees(0),
+                                                                                      nPackagesConsidered(0)
+{
+    // Largest block you're willing to create:
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    unsigned int nBlockMaxSizeNetwork = MAX_BLOCK_SIZE_CURRENT;
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((nBlockMaxSizeNetwork - 1000), nBlockMaxSize));
+
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+}
+
+bool CBlockTxSelector::AddTx(txiter it, double dPriority, const CFeeRate& feeRate)
+{
+    const CTransaction& tx = it->GetTx();
+    const uint256& hash = tx.GetHash();
+
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+        return false;
+    if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
+        return false;
+
+    // Size limits
+    unsigned int nTxSize = it->GetTxSize();
+    if (nBlockSize + nTxSize >= nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        return false;
+
+    if (!tx.IsZerocoinSpend()) {
+        for (const CTxIn& txin : tx.vin) {
+            //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
+            if (invalid_out::ContainsOutPoint(txin.prevout)) {
+                LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), hash.ToString());
+                return false;
+            }
         }
     }
-};
+
+    if (!view.HaveInputs(tx))
+        return false;
+
+    // double check that there are no double spent zMASTERspends in this block or tx
+    vector<CBigNum> vTxSerials;
+    if (tx.IsZerocoinSpend()) {
+        int nHeightTx = 0;
+        if (IsTransactionInChain(hash, nHeightTx))
+            return false;
+
+        for (const CTxIn txIn : tx.vin) {
+            if (txIn.scriptSig.IsZerocoinSpend()) {
+                libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+                bool fUseV1Params = libzerocoin::ExtractVersionFromSerial(spend.getCoinSerialNumber()) < libzerocoin::PrivateCoin::PUBKEY_VERSION;
+                //This zMASTERserial has already been included in the block, do not add this tx.
+                if (!spend.HasValidSerial(Params().Zerocoin_Params(fUseV1Params)) ||
+                    count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()) ||
+                    count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
+                    return false;
+                vTxSerials.emplace_back(spend.getCoinSerialNumber());
+            }
+        }
+    }
+
+    CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, nHeight);
+
+    // Added
+    pblocktemplate->block.vtx.push_back(tx);
+    pblocktemplate->vTxFees.push_back(nTxFees);
+    pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+    nBlockSize += nTxSize;
+    ++nBlockTx;
+    nBlockSigOps += nTxSigOps;
+    nFees += nTxFees;
+    setInBlock.insert(hash);
+
+    for (const CBigNum bnSerial : vTxSerials)
+        vBlockSerials.emplace_back(bnSerial);
+
+    if (fPrintPriority) {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority, feeRate.ToString(), hash.ToString());
+    }
+    return true;
+}
+
+void CBlockTxSelector::AddPriorityTxs()
+{
+    if (nBlockPrioritySize == 0)
+        return;
+
+    // Transactions with all their mempool parents in the block, as a max-heap on priority.
+    // Priorities grow with the chain height, so they are computed per template
+    // from the values cached in the mempool entries.
+    vector<TxPriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size());
+    for (txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it) {
+        if (!mempool.mapLinks[it->GetTx().GetHash()].parents.empty())
+            continue;
+        const CTransaction& tx = it->GetTx();
+        double dPriority = tx.IsZerocoinSpend() ? GetZerocoinSpendPriority(tx) : it->GetPriority(nHeight);
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(it->GetTx().GetHash(), dPriority, nFeeDelta);
+        vecPriority.push_back(TxPriority(dPriority, it));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), CompareTxPriority());
+
+    while (!vecPriority.empty()) {
+        double dPriority = vecPriority.front().first;
+        txiter it = vecPriority.front().second;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), CompareTxPriority());
+        vecPriority.pop_back();
+
+        // Leave the rest of the block to fee rate once past the priority size or
+        // we run out of high-priority transactions
+        if (nBlockSize + it->GetTxSize() >= nBlockPrioritySize || !AllowFree(dPriority))
+            break;
+
+        if (!AddTx(it, dPriority, CFeeRate(it->GetModifiedFee(), it->GetTxSize()))) {
+            setFailed.insert(it->GetTx().GetHash());
+            continue;
+        }
+
+        // Children become candidates once all their parents are in the block
+        BOOST_FOREACH (const uint256& child, mempool.mapLinks[it->GetTx().GetHash()].children) {
+            bool fReady = true;
+            BOOST_FOREACH (const uint256& parent, mempool.mapLinks[child].parents)
+                fReady &= setInBlock.count(parent) > 0;
+            if (!fReady)
+                continue;
+            txiter itChild = mempool.mapTx.find(child);
+            const CTransaction& txChild = itChild->GetTx();
+            double dChildPriority = txChild.IsZerocoinSpend() ? GetZerocoinSpendPriority(txChild) : itChild->GetPriority(nHeight);
+            CAmount nFeeDelta = 0;
+            mempool.ApplyDeltas(child, dChildPriority, nFeeDelta);
+            vecPriority.push_back(TxPriority(dChildPriority, itChild));
+            std::push_heap(vecPriority.begin(), vecPriority.end(), CompareTxPriority());
+        }
+    }
+}
+
+void CBlockTxSelector::AddPackageTxs()
+{
+    // The ancestor totals cached in the mempool still count ancestors that are
+    // already in the block, so the walk order is approximate for such packages;
+    // their remaining fees and sizes are recomputed below before they are used.
+    typedef CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator scoreiter;
+    for (scoreiter itScore = mempool.mapTx.get<ancestor_score>().begin(); itScore != mempool.mapTx.get<ancestor_score>().end(); ++itScore) {
+        txiter it = mempool.mapTx.project<0>(itScore);
+        if (setInBlock.count(it->GetTx().GetHash()) || setFailed.count(it->GetTx().GetHash()))
+            continue;
+        nPackagesConsidered++;
+
+        std::set<uint256> setAncestors;
+        mempool.CalculateAncestors(it->GetTx().GetHash(), setAncestors);
+        vector<txiter> vPackage(1, it);
+        uint64_t nPackageSize = it->GetTxSize();
+        CAmount nPackageFees = it->GetModifiedFee();
+        bool fFailedAncestor = false;
+        BOOST_FOREACH (const uint256& ancestor, setAncestors) {
+            if (setInBlock.count(ancestor))
+                continue;
+            if (setFailed.count(ancestor)) {
+                fFailedAncestor = true;
+                break;
+            }
+            txiter itAncestor = mempool.mapTx.find(ancestor);
+            vPackage.push_back(itAncestor);
+            nPackageSize += itAncestor->GetTxSize();
+            nPackageFees += itAncestor->GetModifiedFee();
+        }
+        if (fFailedAncestor) {
+            setFailed.insert(it->GetTx().GetHash());
+            continue;
+        }
+
+        if (nBlockSize + nPackageSize >= nBlockMaxSize)
+            continue;
+
+        // Skip free transactions if we're past the minimum block size:
+        CFeeRate feeRate(nPackageFees, nPackageSize);
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(it->GetTx().GetHash(), dPriorityDelta, nFeeDelta);
+        if (!it->GetTx().IsZerocoinSpend() && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nPackageSize >= nBlockMinSize))
+            continue;
+
+        // An ancestor always has fewer ancestors than its descendants, so this puts parents first
+        std::sort(vPackage.begin(), vPackage.end(), CompareTxByAncestorCount());
+        BOOST_FOREACH (txiter itTx, vPackage) {
+            if (!AddTx(itTx, itTx->GetPriority(nHeight), feeRate)) {
+                setFailed.insert(itTx->GetTx().GetHash());
+                break;
+            }
+        }
+    }
+}
 
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
@@ -158,22 +431,6 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
             return NULL;
     }
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    unsigned int nBlockMaxSizeNetwork = MAX_BLOCK_SIZE_CURRENT;
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((nBlockMaxSizeNetwork - 1000), nBlockMaxSize));
-
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
-
     // Collect memory pool transactions into the block
     CAmount nFees = 0;
 
@@ -182,246 +439,17 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            uint256 txid = tx.GetHash();
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (tx.IsZerocoinSpend()) {
-                    nTotalIn = tx.GetZerocoinSpent();
-
-                    //Give a high priority to zerocoinspends to get into the next block
-                    //Priority = (age^6+100000)*amount - gives higher priority to zmasters that have been in mempool long
-                    //and higher priority to zmasters that are large in value
-                    int64_t nTimeSeen = GetAdjustedTime();
-                    double nConfs = 100000;
-
-                    auto it = mapZerocoinspends.find(txid);
-                    if (it != mapZerocoinspends.end()) {
-                        nTimeSeen = it->second;
-                    } else {
-                        //for some reason not in map, add it
-                        mapZerocoinspends[txid] = nTimeSeen;
-                    }
-
-                    double nTimePriority = std::pow(GetAdjustedTime() - nTimeSeen, 6);
-
-                    // zMASTERspends can have very large priority, use non-overflowing safe functions
-                    dPriority = double_safe_addition(dPriority, (nTimePriority * nConfs));
-                    dPriority = double_safe_multiplication(dPriority, nTotalIn);
-
-                    continue;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                //Check for invalid/fraudulent inputs. They shouldn't make it through mempool, but check anyways.
-                if (invalid_out::ContainsOutPoint(txin.prevout)) {
-                    LogPrintf("%s : found invalid input %s in tx %s", __func__, txin.prevout.ToString(), tx.GetHash().ToString());
-                    fMissingInputs = true;
-                    break;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zMASTERspends can have very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        vector<CBigNum> vBlockSerials;
-        vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (!tx.IsZerocoinSpend() && fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // double check that there are no double spent zMASTERspends in this block or tx
-            if (tx.IsZerocoinSpend()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
-                    continue;
-
-                bool fDoubleSerial = false;
-                for (const CTxIn txIn : tx.vin) {
-                    if (txIn.scriptSig.IsZerocoinSpend()) {
-                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
-                        bool fUseV1Params = libzerocoin::ExtractVersionFromSerial(spend.getCoinSerialNumber()) < libzerocoin::PrivateCoin::PUBKEY_VERSION;
-                        if (!spend.HasValidSerial(Params().Zerocoin_Params(fUseV1Params)))
-                            fDoubleSerial = true;
-                        if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
-                            break;
-                        vTxSerials.emplace_back(spend.getCoinSerialNumber());
-                    }
-                }
-                //This zMASTERserial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
-                    continue;
-            }
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
+        int64_t nTimeStart = GetTimeMicros();
+        CBlockTxSelector selector(pblocktemplate.get(), nHeight);
+        selector.AddPriorityTxs();
+        int64_t nTime1 = GetTimeMicros();
+        selector.AddPackageTxs();
+        int64_t nTime2 = GetTimeMicros();
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        uint64_t nBlockSize = selector.nBlockSize;
+        uint64_t nBlockTx = selector.nBlockTx;
+        nFees = selector.nFees;
 
         if (!fProofOfStake) {
             //Masternode and general budget payments
@@ -478,12 +506,18 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         pblock->nAccumulatorCheckpoint = pCheckpointCache.second.second;
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
+        int64_t nTime3 = GetTimeMicros();
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
             LogPrintf("CreateNewBlock() : TestBlockValidity failed\n");
             mempool.clear();
             return NULL;
         }
+        int64_t nTime4 = GetTimeMicros();
+
+        LogPrint("bench", "CreateNewBlock(): %u txs from %u in mempool, %u packages: priority %.2fms, packages %.2fms, validity %.2fms, total %.2fms\n",
+                 (unsigned int)nBlockTx, (unsigned int)mempool.mapTx.size(), selector.nPackagesConsidered,
+                 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime2 - nTime1), 0.001 * (nTime4 - nTime3), 0.001 * (nTime4 - nTimeStart));
 
 //        if (pblock->IsZerocoinStake()) {
 //            CWalletTx wtx(pwalletMain, pblock->vtx[1]);
@@ -520,6 +554,21 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 double dHashesPerSec = 0.0;
 int64_t nHPSTimerStart = 0;
 
+/** Number of nonces the PoW search hashes at once for Quark (pre-v4) headers. */
+static const unsigned int MINER_QUARK_BATCH = 8;
+
+/** Quark hashes of pblock's header with nonces nNonce .. nNonce + n - 1. */
+static void HashQuarkNonces(const CBlock* pblock, unsigned int n, uint256* phash)
+{
+    unsigned char vHeaders[MINER_QUARK_BATCH * QUARK_HEADER_SIZE];
+    CBlockHeader header = pblock->GetBlockHeader();
+    for (unsigned int i = 0; i < n; i++) {
+        header.nNonce = pblock->nNonce + i;
+        memcpy(vHeaders + i * QUARK_HEADER_SIZE, BEGIN(header.nVersion), QUARK_HEADER_SIZE);
+    }
+    HashQuarkN(vHeaders, n, phash);
+}
+
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake)
 {
     CPubKey pubkey;
@@ -573,6 +622,108 @@ bool fGenerateBitcoins = false;
 bool fMintableCoins = false;
 int nMintableLastCheck = 0;
 
+/**
+ * Wakes the stake minter when it may be able to stake: on a new tip, a change
+ * of the wallet lock state or a wallet transaction. Also times how long it
+ * takes from the arrival of a tip to the broadcast of a block staked on it.
+ */
+class CStakeMinterEvents : public CValidationInterface
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fWake;
+    //! set when the wallet changed, so that its mintable coins are rechecked
+    bool fWalletChanged;
+
+    uint256 hashTip;
+    int64_t nTimeTipArrived;
+    int64_t nLastLatency;
+    int64_t nTotalLatency;
+    int nLatencySamples;
+
+public:
+    CStakeMinterEvents() : fWake(false), fWalletChanged(false), nTimeTipArrived(0), nLastLatency(0), nTotalLatency(0), nLatencySamples(0) {}
+
+    void Wake()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fWake = true;
+        cond.notify_all();
+    }
+
+    void WalletChanged()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fWalletChanged = true;
+        fWake = true;
+        cond.notify_all();
+    }
+
+    /** Wait until woken or nMilliseconds have passed. Returns whether woken. */
+    bool Wait(int64_t nMilliseconds)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(nMilliseconds);
+        while (!fWake) {
+            if (!cond.timed_wait(lock, timeout))
+                break;
+        }
+        bool fWoken = fWake;
+        fWake = false;
+        return fWoken;
+    }
+
+    bool TestAndClearWalletChanged()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        bool fChanged = fWalletChanged;
+        fWalletChanged = false;
+        return fChanged;
+    }
+
+    /** When hashBlock arrived as the tip, in microseconds, or 0 if it is not the tip */
+    int64_t GetTipArrivalTime(const uint256& hashBlock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return hashBlock == hashTip ? nTimeTipArrived : 0;
+    }
+
+    void AddLatency(int64_t nLatency)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nLastLatency = nLatency;
+        nTotalLatency += nLatency;
+        nLatencySamples++;
+    }
+
+    void GetLatency(int64_t& nLast, int64_t& nAverage, int& nSamples)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nLast = nLastLatency;
+        nAverage = nLatencySamples ? nTotalLatency / nLatencySamples : 0;
+        nSamples = nLatencySamples;
+    }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            hashTip = pindex->GetBlockHash();
+            nTimeTipArrived = GetTimeMicros();
+        }
+        Wake();
+    }
+};
+
+static CStakeMinterEvents stakeMinterEvents;
+
+void GetStakingLatency(int64_t& nLast, int64_t& nAverage, int& nSamples)
+{
+    stakeMinterEvents.GetLatency(nLast, nAverage, nSamples);
+}
+
 // ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
 
 void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
@@ -585,40 +736,48 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    if (fProofOfStake) {
+        // Wake up on new tips, wallet unlocks and wallet transactions instead of polling
+        static bool fEventsRegistered = false;
+        if (!fEventsRegistered) {
+            RegisterValidationInterface(&stakeMinterEvents);
+            pwallet->NotifyStatusChanged.connect(boost::bind(&CStakeMinterEvents::Wake, &stakeMinterEvents));
+            pwallet->NotifyTransactionChanged.connect(boost::bind(&CStakeMinterEvents::WalletChanged, &stakeMinterEvents));
+            fEventsRegistered = true;
+        }
+    }
+
     while (fGenerateBitcoins || fProofOfStake) {
         if (fProofOfStake) {
-            //control the amount of times the client will check for mintable coins
-            if ((GetTime() - nMintableLastCheck > 5 * 60)) // 5 minute check time
-            {
+            //control the amount of times the client will check for mintable coins: every 5 minutes, every minute
+            //while there are none, and at most every 5 seconds after the wallet changed
+            int nMintableCheckTime = fMintableCoins ? 5 * 60 : 1 * 60;
+            bool fCheckMintable = GetTime() - nMintableLastCheck > nMintableCheckTime;
+            if (!fCheckMintable && GetTime() - nMintableLastCheck > 5)
+                fCheckMintable = stakeMinterEvents.TestAndClearWalletChanged();
+            if (fCheckMintable) {
                 nMintableLastCheck = GetTime();
                 fMintableCoins = pwallet->MintableCoins();
             }
 
             if (chainActive.Tip()->nHeight < Params().LAST_POW_BLOCK()) {
-                MilliSleep(5000);
+                stakeMinterEvents.Wait(5000);
                 continue;
             }
 
-            while (vNodes.empty() || pwallet->IsLocked() || !fMintableCoins || (pwallet->GetBalance() > 0 && nReserveBalance >= pwallet->GetBalance()) /*|| !masternodeSync.IsSynced()*/) {
+            if (vNodes.empty() || pwallet->IsLocked() || !fMintableCoins || (pwallet->GetBalance() > 0 && nReserveBalance >= pwallet->GetBalance()) /*|| !masternodeSync.IsSynced()*/) {
                 nLastCoinStakeSearchInterval = 0;
-                // Do a separate 1 minute check here to ensure fMintableCoins is updated
-                if (!fMintableCoins) {
-                    if (GetTime() - nMintableLastCheck > 1 * 60) // 1 minute check time
-                    {
-                        nMintableLastCheck = GetTime();
-                        fMintableCoins = pwallet->MintableCoins();
-                    }
-                }
-                MilliSleep(5000);
-                if (!fGenerateBitcoins && !fProofOfStake)
-                    continue;
+                // peers connecting are not signalled, so keep a timeout
+                stakeMinterEvents.Wait(5000);
+                continue;
             }
 
             if (mapHashedBlocks.count(chainActive.Tip()->nHeight)) //search our map of hashed blocks, see if bestblock has been hashed yet
             {
-                if (GetTime() - mapHashedBlocks[chainActive.Tip()->nHeight] < max(pwallet->nHashInterval, (unsigned int)1)) // wait half of the nHashDrift with max wait of 3 minutes
-                {
-                    MilliSleep(5000);
+                // wait for the hash interval to pass, or for a new tip
+                int64_t nWait = max(pwallet->nHashInterval, (unsigned int)1) - (GetTime() - mapHashedBlocks[chainActive.Tip()->nHeight]);
+                if (nWait > 0) {
+                    stakeMinterEvents.Wait(nWait * 1000);
                     continue;
                 }
             }
@@ -664,7 +823,10 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 
             LogPrintf("CPUMiner : proof-of-stake block was signed %s \n", pblock->GetHash().ToString().c_str());
             SetThreadPriority(THREAD_PRIORITY_NORMAL);
-            ProcessBlockFound(pblock, *pwallet, reservekey);
+            // our block becomes the tip while it is processed
+            int64_t nTimeTipArrived = stakeMinterEvents.GetTipArrivalTime(pblock->hashPrevBlock);
+            if (ProcessBlockFound(pblock, *pwallet, reservekey) && nTimeTipArrived)
+                stakeMinterEvents.AddLatency(GetTimeMicros() - nTimeTipArrived);
             SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
             continue;
@@ -681,11 +843,25 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
         while (true) {
             unsigned int nHashesDone = 0;
 
-            uint256 hash;
+            uint256 vHash[MINER_QUARK_BATCH];
             while (true) {
-                hash = pblock->GetHash();
-                if (hash <= hashTarget) {
+                // Quark headers are hashed a batch of nonces at a time, never
+                // running past the next multiple of 256 checked below
+                unsigned int nBatch = 1;
+                if (pblock->nVersion < 4) {
+                    nBatch = std::min(MINER_QUARK_BATCH, 0x100 - (pblock->nNonce & 0xFF));
+                    HashQuarkNonces(pblock, nBatch, vHash);
+                } else
+                    vHash[0] = pblock->GetHash();
+
+                unsigned int i = 0;
+                while (i < nBatch && vHash[i] > hashTarget)
+                    i++;
+                pblock->nNonce += i;
+                nHashesDone += i;
+                if (i < nBatch) {
                     // Found a solution
+                    const uint256& hash = vHash[i];
                     SetThreadPriority(THREAD_PRIORITY_NORMAL);
                     LogPrintf("BitcoinMiner:\n");
                     LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
@@ -699,8 +875,6 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 
                     break;
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
                 if ((pblock->nNonce & 0xFF) == 0)
                     break;
             }
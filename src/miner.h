@@ -29,6 +29,8 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
 
 void BitcoinMiner(CWallet* pwallet, bool fProofOfStake);
+/** Time from the arrival of a tip to the broadcast of a block staked on it, in microseconds */
+void GetStakingLatency(int64_t& nLast, int64_t& nAverage, int& nSamples);
 
 extern double dHashesPerSec;
 extern int64_t nHPSTimerStart;
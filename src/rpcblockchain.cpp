@@ -14,6 +14,7 @@
 #include "txdb.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "zerocoinspendcache.h"
 #include "accumulatormap.h"
 #include "accumulators.h"
 
@@ -178,9 +179,8 @@ UniValue mempoolToJSON(bool fVerbose = false)
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -781,7 +781,10 @@ UniValue mempoolInfoToJSON()
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-    //ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
     return ret;
 }
@@ -797,6 +800,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Approximate memory usage of the mempool in bytes\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool (-maxmempool)\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee per kB for a transaction to be accepted\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -946,3 +952,29 @@ UniValue getaccumulatorvalues(const UniValue& params, bool fHelp)
 
     return ret;
 }
+
+UniValue getzerocoinspendcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getzerocoinspendcacheinfo\n"
+            "\nReturns statistics about the cache of already verified zerocoin spends.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Number of verified spends currently cached\n"
+            "  \"hits\": xxxxx                (numeric) Verifications skipped because the spend was cached\n"
+            "  \"misses\": xxxxx              (numeric) Lookups that required a full proof verification\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getzerocoinspendcacheinfo", "") + HelpExampleRpc("getzerocoinspendcacheinfo", ""));
+
+    CZerocoinSpendCacheStats stats = GetZerocoinSpendCacheStats();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", stats.nEntries));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    return ret;
+}
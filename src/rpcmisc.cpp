@@ -10,6 +10,7 @@
 #include "init.h"
 #include "main.h"
 #include "masternode-sync.h"
+#include "miner.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpcserver.h"
@@ -562,6 +563,9 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"lastlatency\": n,                 (numeric) milliseconds from the arrival of a tip to the broadcast of the last block staked on it\n"
+            "  \"averagelatency\": n,              (numeric) average of lastlatency over the blocks staked since startup\n"
+            "  \"latencysamples\": n,              (numeric) number of staked blocks averagelatency is taken over\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -590,6 +594,13 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
 
+    int64_t nLastLatency, nAverageLatency;
+    int nLatencySamples;
+    GetStakingLatency(nLastLatency, nAverageLatency, nLatencySamples);
+    obj.push_back(Pair("lastlatency", nLastLatency / 1000));
+    obj.push_back(Pair("averagelatency", nAverageLatency / 1000));
+    obj.push_back(Pair("latencysamples", nLatencySamples));
+
     return obj;
 }
 #endif // ENABLE_WALLET
@@ -3401,6 +3401,15 @@ UniValue dzmasterstate(const UniValue& params, bool fHelp) {
                         "\nThe current state of the mintpool of the deterministic zMASTERwallet.\n" +
                 HelpRequiringPassphrase() + "\n"
 
+                        "\nResult:\n"
+                        "{\n"
+                        "  \"dzmaster_count\": n,       (numeric) The count of the next deterministic zMASTER to mint\n"
+                        "  \"mintpool_count\": n,       (numeric) The highest count generated into the mint pool\n"
+                        "  \"mintpool_derived\": n,     (numeric) Mints derived for the mint pool since startup\n"
+                        "  \"mintpool_threads\": n,     (numeric) Threads used by the last mint pool derivation\n"
+                        "  \"mintpool_rate\": x.xx      (numeric) Mints derived per second\n"
+                        "}\n"
+
                         "\nExamples\n" +
                 HelpExampleCli("mintpoolstatus", "") + HelpExampleRpc("mintpoolstatus", ""));
 
@@ -3411,40 +3420,18 @@ UniValue dzmasterstate(const UniValue& params, bool fHelp) {
     obj.push_back(Pair("dzmaster_count", nCount));
     obj.push_back(Pair("mintpool_count", nCountLastUsed));
 
+    uint64_t nDerived;
+    int64_t nDeriveTime;
+    int nThreads;
+    zwallet->GetGenerationStats(nDerived, nDeriveTime, nThreads);
+    obj.push_back(Pair("mintpool_derived", nDerived));
+    obj.push_back(Pair("mintpool_threads", nThreads));
+    obj.push_back(Pair("mintpool_rate", nDeriveTime > 0 ? nDerived * 1000000.0 / nDeriveTime : 0.0));
+
     return obj;
 }
 
 
-void static SearchThread(CzMASTERWallet* zwallet, int nCountStart, int nCountEnd)
-{
-    LogPrintf("%s: start=%d end=%d\n", __func__, nCountStart, nCountEnd);
-    CWalletDB walletDB(pwalletMain->strWalletFile);
-    try {
-        uint256 seedMaster = zwallet->GetMasterSeed();
-        uint256 hashSeed = Hash(seedMaster.begin(), seedMaster.end());
-        for(int i = nCountStart; i < nCountEnd; i++) {
-            boost::this_thread::interruption_point();
-            CDataStream ss(SER_GETHASH, 0);
-            ss << seedMaster << i;
-            uint512 zerocoinSeed = Hash512(ss.begin(), ss.end());
-
-            CBigNum bnValue;
-            CBigNum bnSerial;
-            CBigNum bnRandomness;
-            CKey key;
-            zwallet->SeedToZMASTER(zerocoinSeed, bnValue, bnSerial, bnRandomness, key);
-
-            uint256 hashPubcoin = GetPubCoinHash(bnValue);
-            zwallet->AddToMintPool(make_pair(hashPubcoin, i), true);
-            walletDB.WriteMintPoolPair(hashSeed, hashPubcoin, i);
-        }
-    } catch (std::exception& e) {
-        LogPrintf("SearchThread() exception");
-    } catch (...) {
-        LogPrintf("SearchThread() exception");
-    }
-}
-
 UniValue searchdzmaster(const UniValue& params, bool fHelp)
 {
     if(fHelp || params.size() != 3)
@@ -3454,7 +3441,7 @@ UniValue searchdzmaster(const UniValue& params, bool fHelp)
             HelpRequiringPassphrase() + "\n"
 
             "\nArguments\n"
-            "1. \"count\"       (numeric) Which sequential zMASTERto start with.\n"
+            "1. \"count\"       (numeric) Which sequential zMASTERto start with, 0 to start after the last used count.\n"
             "2. \"range\"       (numeric) How many zMASTERto generate.\n"
             "3. \"threads\"     (numeric) How many threads should this operation consume.\n"
 
@@ -3472,21 +3459,11 @@ UniValue searchdzmaster(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Range has to be at least 1");
 
     int nThreads = params[2].get_int();
+    if (nThreads < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Threads has to be at least 1");
 
     CzMASTERWallet* zwallet = pwalletMain->zwalletMain;
-
-    boost::thread_group* dzmasterThreads = new boost::thread_group();
-    int nRangePerThread = nRange / nThreads;
-
-    int nPrevThreadEnd = nCount - 1;
-    for (int i = 0; i < nThreads; i++) {
-        int nStart = nPrevThreadEnd + 1;;
-        int nEnd = nStart + nRangePerThread;
-        nPrevThreadEnd = nEnd;
-        dzmasterThreads->create_thread(boost::bind(&SearchThread, zwallet, nStart, nEnd));
-    }
-
-    dzmasterThreads->join_all();
+    zwallet->GenerateMintPool(nCount, nRange, nThreads);
 
     zwallet->RemoveMintsFromPool(pwalletMain->zmasterTracker->GetSerialHashes());
     zwallet->SyncWithChain(false);
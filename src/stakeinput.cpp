@@ -165,7 +165,7 @@ bool CZMasterStake::MarkSpent(CWallet *pwallet, const uint256& txid)
 }
 
 //!MASTERStake
-bool CMasterStake::SetInput(CTransaction txPrev, unsigned int n)
+bool CMasterStake::SetInput(const CTransaction& txPrev, unsigned int n)
 {
     this->txFrom = txPrev;
     this->nPosition = n;
@@ -224,8 +224,19 @@ bool CMasterStake::CreateTxOuts(CWallet* pwallet, vector<CTxOut>& vout, CAmount
     return true;
 }
 
+void CMasterStake::SetModifier(uint64_t nStakeModifier)
+{
+    nModifier = nStakeModifier;
+    fModifierSet = true;
+}
+
 bool CMasterStake::GetModifier(uint64_t& nStakeModifier)
 {
+    if (fModifierSet) {
+        nStakeModifier = nModifier;
+        return true;
+    }
+
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
     GetIndexFrom();
@@ -249,6 +260,9 @@ CDataStream CMasterStake::GetUniqueness()
 //The block that the UTXO was added to the chain
 CBlockIndex* CMasterStake::GetIndexFrom()
 {
+    if (pindexFrom)
+        return pindexFrom;
+
     uint256 hashBlock = 0;
     CTransaction tx;
     if (GetTransaction(txFrom.GetHash(), tx, hashBlock, true)) {
@@ -68,13 +68,20 @@ class CMasterStake : public CStakeInput
 private:
     CTransaction txFrom;
     unsigned int nPosition;
+    bool fModifierSet;
+    uint64_t nModifier;
 public:
     CMasterStake()
     {
         this->pindexFrom = nullptr;
+        fModifierSet = false;
+        nModifier = 0;
     }
 
-    bool SetInput(CTransaction txPrev, unsigned int n);
+    bool SetInput(const CTransaction& txPrev, unsigned int n);
+    // Known block and stake modifier of the input, saves looking them up again
+    void SetIndexFrom(CBlockIndex* pindex) { pindexFrom = pindex; }
+    void SetModifier(uint64_t nStakeModifier);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) override;
@@ -16,6 +16,7 @@
 #include "serialize.h"
 #include "util.h"
 
+#include <limits>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
@@ -26,13 +27,23 @@
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxBytes);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nTxSize;
+    uint64_t nSequence;
+};
+struct COrphanTxPeer {
+    size_t nBytes;
+    std::map<uint64_t, uint256> mapBySequence;
+    COrphanTxPeer() : nBytes(0) {}
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::map<COutPoint, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::map<NodeId, COrphanTxPeer> mapOrphanTransactionsByPeer;
+extern size_t nOrphanTransactionsBytes;
 
 CService ip(uint32_t i)
 {
@@ -187,13 +198,73 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+    BOOST_CHECK(nOrphanTransactionsBytes == 0);
+}
+
+CTransaction OrphanSpending(const uint256& hashPrev, int nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].prevout.hash = hashPrev;
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphans_limits)
+{
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+
+    // Peer 1 floods the pool, peer 2 relays a short chain
+    for (int i = 0; i < 20; i++)
+        BOOST_CHECK(AddOrphanTx(OrphanSpending(GetRandHash(), i + 1), 1));
+    CTransaction txChain = OrphanSpending(GetRandHash(), 1);
+    BOOST_CHECK(AddOrphanTx(txChain, 2));
+    BOOST_CHECK(AddOrphanTx(OrphanSpending(txChain.GetHash(), 1), 2));
+    BOOST_CHECK(!AddOrphanTx(txChain, 2));
+
+    // Orphans are indexed by the exact outpoint they spend
+    BOOST_CHECK(mapOrphanTransactionsByPrev.count(COutPoint(txChain.GetHash(), 0)));
+    BOOST_CHECK(!mapOrphanTransactionsByPrev.count(COutPoint(txChain.GetHash(), 1)));
+
+    // Per-peer accounting adds up to the pool total
+    size_t nBytes = 0;
+    for (std::map<uint256, COrphanTx>::const_iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        nBytes += it->second.nTxSize;
+    BOOST_CHECK_EQUAL(nOrphanTransactionsBytes, nBytes);
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[1].nBytes + mapOrphanTransactionsByPeer[2].nBytes, nBytes);
+
+    // Over the byte limit, the heaviest peer is evicted from, oldest orphan first
+    uint256 hashOldest = mapOrphanTransactionsByPeer[1].mapBySequence.begin()->second;
+    LimitOrphanTxSize(1000, nBytes - 1);
+    BOOST_CHECK(nOrphanTransactionsBytes <= nBytes - 1);
+    BOOST_CHECK(!mapOrphanTransactions.count(hashOldest));
+    BOOST_CHECK(mapOrphanTransactions.count(txChain.GetHash()));
+    LimitOrphanTxSize(1000, mapOrphanTransactionsByPeer[2].nBytes * 2);
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[2].mapBySequence.size(), 2U);
+    BOOST_CHECK(mapOrphanTransactionsByPeer[1].nBytes <= mapOrphanTransactionsByPeer[2].nBytes);
+
+    // Orphans expire
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL + 1);
+    LimitOrphanTxSize(1000, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+    BOOST_CHECK(nOrphanTransactionsBytes == 0);
+
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -137,4 +137,37 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+BOOST_AUTO_TEST_CASE(acc_batch)
+{
+    const std::string& strFile = pwalletMain->strWalletFile;
+    CKey key;
+    key.MakeNewKey(true);
+    CAccount acc, accRead;
+    acc.vchPubKey = key.GetPubKey();
+
+    {
+        CWalletBatch walletBatch(pwalletMain);
+        BOOST_CHECK(CWalletDB(strFile).WriteAccount("batched", acc));
+        // This thread's other handles see the write before the commit
+        BOOST_CHECK(CWalletDB(strFile).ReadAccount("batched", accRead));
+        {
+            CWalletBatch walletBatchNested(pwalletMain);
+            BOOST_CHECK(CWalletDB(strFile).WriteAccount("nested", acc));
+        }
+    }
+    accRead.SetNull();
+    BOOST_CHECK(CWalletDB(strFile).ReadAccount("batched", accRead));
+    BOOST_CHECK(accRead.vchPubKey == acc.vchPubKey);
+    BOOST_CHECK(CWalletDB(strFile).ReadAccount("nested", accRead));
+
+    // A batch that is never ended is rolled back
+    {
+        CWalletDB walletdb(strFile);
+        BOOST_CHECK(walletdb.BeginBatch());
+        BOOST_CHECK(!walletdb.BeginBatch());
+        BOOST_CHECK(CWalletDB(strFile).WriteAccount("aborted", acc));
+    }
+    BOOST_CHECK(!CWalletDB(strFile).ReadAccount("aborted", accRead));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
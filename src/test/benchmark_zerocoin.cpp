@@ -369,6 +369,62 @@ Testb_MintAndSpend()
 	return false;
 }
 
+#define TESTS_MODEXP_ITERATIONS     100
+
+bool
+Testb_ModExp()
+{
+	try {
+		struct {
+			string name;
+			CBigNum modulus;
+		} moduli[] = {
+			{"accumulator modulus", gg_Params->accumulatorParams.accumulatorModulus},
+			{"coin commitment modulus", gg_Params->coinCommitmentGroup.modulus},
+		};
+
+		for (const auto& m : moduli) {
+			CAutoBN_MONT_CTX mont(m.modulus);
+			CBigNum base = CBigNum::randBignum(m.modulus);
+			CBigNum exp = CBigNum::randBignum(m.modulus);
+			CBigNum expected = base.pow_mod_openssl(exp, m.modulus, NULL);
+
+			cout << "	MODEXP (" << m.modulus.bitSize() << " bit " << m.name << ") PER OPERATION:" << endl;
+
+			timer.start();
+			for (uint32_t i = 0; i < TESTS_MODEXP_ITERATIONS; i++) {
+				if (base.pow_mod_openssl(exp, m.modulus, NULL) != expected)
+					return false;
+			}
+			timer.stop();
+			cout << "		OpenSSL: " << timer.duration() * 1000 / TESTS_MODEXP_ITERATIONS << " us" << endl;
+
+			timer.start();
+			for (uint32_t i = 0; i < TESTS_MODEXP_ITERATIONS; i++) {
+				if (base.pow_mod_openssl(exp, m.modulus, &mont) != expected)
+					return false;
+			}
+			timer.stop();
+			cout << "		OpenSSL, cached Montgomery context: " << timer.duration() * 1000 / TESTS_MODEXP_ITERATIONS << " us" << endl;
+
+#if defined(USE_ZEROCOIN_GMP)
+			timer.start();
+			for (uint32_t i = 0; i < TESTS_MODEXP_ITERATIONS; i++) {
+				if (base.pow_mod_gmp(exp, m.modulus) != expected)
+					return false;
+			}
+			timer.stop();
+			cout << "		GMP: " << timer.duration() * 1000 / TESTS_MODEXP_ITERATIONS << " us" << endl;
+#endif
+		}
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return true;
+}
+
 void
 Testb_RunAllTests()
 {
@@ -388,6 +444,7 @@ Testb_RunAllTests()
 	gLogTestResult("coins can be minted", Testb_MintCoin);
 	gLogTestResult("the accumulator works", Testb_Accumulator);
 	gLogTestResult("a minted coin can be spent", Testb_MintAndSpend);
+	gLogTestResult("the modular exponentiation backends agree", Testb_ModExp);
 
 	// Summarize test results
 	if (ggSuccessfulTests < ggNumTests) {
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+static std::string SerializeIndexEntry(CBlockIndex* pindex)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(pindex);
+    return ss.str();
+}
+
+static std::map<uint256, std::string> SerializeIndex()
+{
+    std::map<uint256, std::string> mapEntries;
+    for (BlockMap::const_iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it)
+        mapEntries[it->first] = SerializeIndexEntry(it->second);
+    return mapEntries;
+}
+
+static CBlockIndex* AddFakeBlockIndex(CBlockIndex* pprev, unsigned int nNonce)
+{
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.hashPrevBlock = pprev->GetBlockHash();
+    header.nTime = pprev->nTime + 60;
+    header.nBits = pprev->nBits;
+    header.nNonce = nNonce;
+
+    CBlockIndex* pindex = InsertBlockIndex(header.GetHash());
+    pindex->pprev = pprev;
+    pindex->nHeight = pprev->nHeight + 1;
+    pindex->nVersion = header.nVersion;
+    pindex->nTime = header.nTime;
+    pindex->nBits = header.nBits;
+    pindex->nNonce = header.nNonce;
+    pindex->nStatus = BLOCK_VALID_TREE;
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot)
+{
+    LOCK(cs_main);
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+
+    // Four blocks on top of genesis and a fork at height 2. Only the tip is
+    // written to LevelDB, so the LevelDB scan cannot rebuild the rest.
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pindexGenesis);
+    CBlockIndex* pindexTip = pindexGenesis;
+    for (int i = 0; i < 4; i++)
+        pindexTip = AddFakeBlockIndex(pindexTip, 0);
+    CBlockIndex* pindexFork = AddFakeBlockIndex(pindexTip->GetAncestor(1), 1);
+    uint256 hashTip = pindexTip->GetBlockHash();
+    uint256 hashFork = pindexFork->GetBlockHash();
+    BOOST_CHECK(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindexTip)));
+
+    // Lets the block tree write a snapshot of what is now in mapBlockIndex
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts());
+    std::map<uint256, std::string> mapExpected = SerializeIndex();
+    BOOST_CHECK_EQUAL(mapExpected.size(), 6U);
+
+    // Write, reload and compare every entry
+    BOOST_CHECK(pblocktree->WriteBlockIndexSnapshot());
+    UnloadBlockIndex();
+    setStakeSeen.clear();
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts());
+    BOOST_CHECK(SerializeIndex() == mapExpected);
+    for (BlockMap::const_iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        BOOST_CHECK(it->second->GetBlockHash() == it->first);
+        if (it->second->pprev)
+            BOOST_CHECK_EQUAL(it->second->pprev->nHeight + 1, it->second->nHeight);
+    }
+    BOOST_CHECK(mapBlockIndex[hashTip]->GetAncestor(0)->GetBlockHash() == Params().HashGenesisBlock());
+
+    // A middle entry whose height does not follow its parent is rejected,
+    // and the block tree falls back to LevelDB: genesis, the tip and its parent
+    mapBlockIndex[hashFork]->nHeight = 3;
+    BOOST_CHECK(pblocktree->WriteBlockIndexSnapshot());
+    UnloadBlockIndex();
+    setStakeSeen.clear();
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts());
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 3U);
+    BOOST_CHECK(!mapBlockIndex.count(hashFork));
+
+    // Restore the genesis only block index for the other tests
+    BOOST_CHECK(pblocktree->Erase(std::make_pair('b', hashTip)));
+    UnloadBlockIndex();
+    setStakeSeen.clear();
+    pindexBestHeader = NULL;
+    std::string strError;
+    BOOST_CHECK(LoadBlockIndex(strError));
+    BOOST_CHECK(chainActive.Tip() && chainActive.Tip()->GetBlockHash() == Params().HashGenesisBlock());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
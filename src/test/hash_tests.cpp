@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "random.h"
 #include "utilstrencodings.h"
 
 #include <vector>
@@ -46,4 +47,22 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(quark_batch)
+{
+    // Enough random headers that every lane takes both sides of each branch
+    std::vector<unsigned char> vHeaders(67 * QUARK_HEADER_SIZE);
+    for (size_t i = 0; i < vHeaders.size(); i++)
+        vHeaders[i] = insecure_rand();
+
+    for (size_t n = 0; n * QUARK_HEADER_SIZE <= vHeaders.size(); n += (n < 9 ? 1 : 29)) {
+        std::vector<uint256> vHashes(n + 1);
+        HashQuarkN(&vHeaders[0], n, &vHashes[0]);
+        for (size_t i = 0; i < n; i++) {
+            const unsigned char* pheader = &vHeaders[i * QUARK_HEADER_SIZE];
+            BOOST_CHECK(vHashes[i] == HashQuark(pheader, pheader + QUARK_HEADER_SIZE));
+        }
+        BOOST_CHECK(vHashes[n] == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -444,6 +444,88 @@ Test_MintAndSpend()
 	return false;
 }
 
+bool
+Test_BatchVerify()
+{
+	try {
+		if (gCoins[0] == NULL)
+		{
+			Test_MintCoin();
+			if (gCoins[0] == NULL) {
+				return false;
+			}
+		}
+
+		Accumulator acc(&g_Params->accumulatorParams, CoinDenomination::ZQ_ONE);
+		AccumulatorWitness wZero(g_Params, acc, gCoins[0]->getPublicCoin());
+		AccumulatorWitness wOne(g_Params, acc, gCoins[1]->getPublicCoin());
+		for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+			acc += gCoins[i]->getPublicCoin();
+			wZero += gCoins[i]->getPublicCoin();
+			wOne += gCoins[i]->getPublicCoin();
+		}
+
+		CoinSpend spendZero(g_Params, g_Params, *gCoins[0], acc, 0, wZero, 0, SpendType::SPEND);
+		CoinSpend spendOne(g_Params, g_Params, *gCoins[1], acc, 0, wOne, 0, SpendType::SPEND);
+
+		// Tamper with a serialized copy of the first spend
+		CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+		ss << spendZero;
+		ss[ss.size() / 2] ^= 0x01;
+		CoinSpend spendBad(g_Params, g_Params, ss);
+
+		std::vector<const CoinSpend*> vSpends = {&spendZero, &spendOne, &spendBad};
+		std::vector<bool> vResults;
+		if (CoinSpend::BatchVerify(acc, vSpends, vResults)) {
+			// The batch contains a tampered spend and must not pass as a whole
+			return false;
+		}
+
+		// Every per-spend result must match individual verification
+		for (unsigned int i = 0; i < vSpends.size(); i++) {
+			if (vResults[i] != vSpends[i]->Verify(acc)) {
+				return false;
+			}
+		}
+
+		return vResults[0] && vResults[1] && !vResults[2];
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+}
+
+bool
+Test_FixedBaseExp()
+{
+	try {
+		const IntegerGroupParams* groups[] = {&g_Params->coinCommitmentGroup,
+		                                      &g_Params->serialNumberSoKCommitmentGroup,
+		                                      &g_Params->accumulatorParams.accumulatorPoKCommitmentGroup};
+
+		for (const IntegerGroupParams* group : groups) {
+			for (int i = 0; i < 20; i++) {
+				// Exponents below the order, above it and negative must all
+				// agree with plain modular exponentiation
+				CBigNum a = CBigNum::randBignum(group->groupOrder * group->modulus);
+				CBigNum b = CBigNum::randBignum(group->groupOrder);
+				if (i % 2)
+					a = -a;
+
+				if (group->powG(a) != group->g.pow_mod(a, group->modulus) ||
+				        group->powH(b) != group->h.pow_mod(b, group->modulus) ||
+				        group->powGH(a, b) != group->g.pow_mod(a, group->modulus).mul_mod(group->h.pow_mod(b, group->modulus), group->modulus)) {
+					return false;
+				}
+			}
+		}
+		return g_Params->coinCommitmentGroup.powGH(CBigNum(0), CBigNum(0)) == CBigNum(1);
+	} catch (runtime_error &e) {
+		cout << e.what() << endl;
+		return false;
+	}
+}
+
 void
 Test_RunAllTests()
 {
@@ -465,6 +547,8 @@ Test_RunAllTests()
 	LogTestResult("the accumulator works", Test_Accumulator);
 	LogTestResult("the commitment equality PoK works", Test_EqualityPoK);
 	LogTestResult("a minted coin can be spent", Test_MintAndSpend);
+	LogTestResult("spends can be batch verified", Test_BatchVerify);
+	LogTestResult("fixed-base exponentiation matches pow_mod", Test_FixedBaseExp);
 
 	cout << endl << "Average coin size is " << gCoinSize << " bytes." << endl;
 	cout << "Serial number size is " << gSerialNumberSize << " bytes." << endl;
@@ -99,4 +99,137 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    // Parent with a high-fee child, and an unrelated transaction in between
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 33000LL;
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_12;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    txOther.vout[0].nValue = 22000LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::list<CTransaction> removed;
+
+    CTxMemPoolEntry entryParent(txParent, 1000, 0, 0.0, 1);
+    CTxMemPoolEntry entryChild(txChild, 10000, 0, 0.0, 1);
+    CTxMemPoolEntry entryOther(txOther, 2000, 0, 0.0, 1);
+    testPool.addUnchecked(txParent.GetHash(), entryParent);
+    testPool.addUnchecked(txChild.GetHash(), entryChild);
+    testPool.addUnchecked(txOther.GetHash(), entryOther);
+
+    const CTxMemPoolEntry& child = *testPool.mapTx.find(txChild.GetHash());
+    const CTxMemPoolEntry& parent = *testPool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(child.GetSizeWithAncestors(), entryParent.GetTxSize() + entryChild.GetTxSize());
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 11000);
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(parent.GetSizeWithDescendants(), entryParent.GetTxSize() + entryChild.GetTxSize());
+    BOOST_CHECK_EQUAL(parent.GetModFeesWithDescendants(), 11000);
+
+    // The child pays for its parent and sorts first; the parent alone sorts last
+    std::vector<uint256> vOrder;
+    BOOST_FOREACH (const CTxMemPoolEntry& entry, testPool.mapTx.get<ancestor_score>())
+        vOrder.push_back(entry.GetTx().GetHash());
+    BOOST_CHECK_EQUAL(vOrder.size(), 3);
+    BOOST_CHECK(vOrder[0] == txChild.GetHash());
+    BOOST_CHECK(vOrder[1] == txOther.GetHash());
+    BOOST_CHECK(vOrder[2] == txParent.GetHash());
+
+    // Fee deltas count towards the descendants' packages
+    testPool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0, 5000);
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 16000);
+    BOOST_CHECK_EQUAL(parent.GetModFeesWithDescendants(), 16000);
+    testPool.ClearPrioritisation(txParent.GetHash());
+
+    // Parent confirmed in a block: the child is a package of its own
+    testPool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(child.GetSizeWithAncestors(), entryChild.GetTxSize());
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 10000);
+    BOOST_CHECK_EQUAL(testPool.mapLinks.size(), 2);
+
+    // Parent returned to the pool by a reorg: the child is linked to it again
+    testPool.addUnchecked(txParent.GetHash(), entryParent);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 11000);
+    BOOST_CHECK_EQUAL(testPool.mapTx.find(txParent.GetHash())->GetCountWithDescendants(), 2);
+    BOOST_CHECK(testPool.mapLinks[txParent.GetHash()].children.count(txChild.GetHash()));
+
+    testPool.remove(txParent, removed, true);
+    BOOST_CHECK_EQUAL(testPool.size(), 1);
+    BOOST_CHECK_EQUAL(testPool.mapLinks.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Three unrelated transactions paying 1, 2 and 3 times the base fee,
+    // and a high-fee child of the cheapest one
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11 << i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 10000 * (i + 1), 100 + i, 0.0, 1));
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(tx[0].GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 100000, 103, 0.0, 1));
+
+    // The child makes tx[0] the most valuable package, so tx[1] goes first
+    BOOST_CHECK(pool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == tx[1].GetHash());
+    size_t nUsage = pool.DynamicMemoryUsage();
+    pool.TrimToSize(nUsage - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(!pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+
+    // Evictions raise the minimum fee above the evicted fee rate
+    BOOST_CHECK(pool.GetMinFee(nUsage) > CFeeRate(20000, ::GetSerializeSize(tx[1], SER_NETWORK, PROTOCOL_VERSION)));
+
+    // Trimming further takes tx[2], then tx[0] together with its child
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(!pool.exists(tx[2].GetHash()));
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    // Expiry removes old transactions together with their descendants
+    for (int i = 0; i < 3; i++)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 10000, 100 + i, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 10000, 103, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.Expire(101), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.exists(tx[2].GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 
 #define BOOST_TEST_MODULE MasterStake Test Suite
 
+#include "crypto/quark.h"
 #include "main.h"
 #include "random.h"
 #include "txdb.h"
@@ -33,6 +34,7 @@ struct TestingSetup {
 
     TestingSetup() {
         ECC_Start();
+        QuarkAutoDetect();
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
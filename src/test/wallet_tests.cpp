@@ -3,6 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "wallet.h"
+#include "walletdb.h"
+#include "zmasterwitness.h"
+
+#include "utilmoneystr.h"
+#include "utiltime.h"
 
 #include <set>
 #include <stdint.h>
@@ -21,6 +26,8 @@
 
 using namespace std;
 
+extern CWallet* pwalletMain;
+
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
 BOOST_AUTO_TEST_SUITE(wallet_tests)
@@ -305,4 +312,348 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_exact_match)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+    empty_wallet();
+
+    // 4 + 9 and 3 + 4 + 6 pay 13 cents without change, the 50 cent coin would need change
+    add_coin(2 * CENT);
+    add_coin(3 * CENT);
+    add_coin(4 * CENT);
+    add_coin(6 * CENT);
+    add_coin(9 * CENT);
+    add_coin(50 * CENT);
+    for (int i = 0; i < RUN_TESTS; i++) {
+        BOOST_CHECK(wallet.SelectCoinsMinConf(13 * CENT, 1, 6, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, 13 * CENT);
+    }
+    empty_wallet();
+}
+
+static CAmount select_exact(const vector<CAmount>& vAmounts, const CAmount& nTargetValue, int nMaxTries = COINSELECT_EXACT_MAX_TRIES)
+{
+    vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue;
+    for (unsigned int i = 0; i < vAmounts.size(); i++)
+        vValue.push_back(make_pair(vAmounts[i], make_pair((const CWalletTx*)NULL, i)));
+    vector<char> vfBest;
+    if (!CWallet::SelectCoinsExact(vValue, nTargetValue, vfBest, nMaxTries))
+        return -1;
+    CAmount nTotal = 0;
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        if (vfBest[i])
+            nTotal += vValue[i].first;
+    return nTotal;
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_exact_search)
+{
+    // descending, as SelectCoinsMinConf passes them
+    vector<CAmount> vAmounts;
+    vAmounts.push_back(9 * CENT);
+    vAmounts.push_back(6 * CENT);
+    vAmounts.push_back(4 * CENT);
+    vAmounts.push_back(3 * CENT);
+    vAmounts.push_back(2 * CENT);
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 13 * CENT), 13 * CENT);
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 24 * CENT), 24 * CENT);
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 1 * CENT), -1);
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 25 * CENT), -1);
+
+    // Only the two 2 cent coins pay 4 cents. Trying each 3 cent coin in turn
+    // would take about a thousand steps, skipping the repeats takes a few.
+    vAmounts.assign(30, 3 * CENT);
+    vAmounts.push_back(2 * CENT);
+    vAmounts.push_back(2 * CENT);
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 4 * CENT, 100), 4 * CENT);
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 94 * CENT, 100), 94 * CENT);
+
+    // gives up once the search takes too many steps
+    BOOST_CHECK_EQUAL(select_exact(vAmounts, 4 * CENT, 5), -1);
+}
+
+// Not a correctness test: times coin selection on a synthetic payout wallet. make check uses 5000 coins,
+// the payout service case is measured with
+//   COINSELECT_BENCHMARK_COINS=100000 test_masterstake --run_test=wallet_tests/coin_selection_benchmark --log_level=message
+BOOST_AUTO_TEST_CASE(coin_selection_benchmark)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    int nCoins = 5000;
+    const char* pszCoins = getenv("COINSELECT_BENCHMARK_COINS");
+    if (pszCoins && atoi(pszCoins) > 0)
+        nCoins = atoi(pszCoins);
+
+    LOCK(wallet.cs_wallet);
+    empty_wallet();
+
+    // coins between 0.01 and 100 MASTER, and one that matches a target exactly
+    CAmount nTotal = 777 * COIN;
+    for (int i = 0; i < nCoins; i++) {
+        CAmount nValue = CENT + GetRand(100 * COIN);
+        add_coin(nValue);
+        nTotal += nValue;
+    }
+    add_coin(777 * COIN);
+
+    const CAmount vTargets[] = {COIN / 2, 250 * COIN, 777 * COIN, 100000 * COIN};
+    for (const CAmount& nTarget : vTargets) {
+        if (nTarget > nTotal)
+            continue;
+        int64_t nStart = GetTimeMicros();
+        BOOST_CHECK(wallet.SelectCoinsMinConf(nTarget, 1, 6, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK(nValueRet >= nTarget);
+        BOOST_TEST_MESSAGE(strprintf("selected %u of %u coins for %s in %.2f ms", setCoinsRet.size(), vCoins.size(),
+            FormatMoney(nTarget), (GetTimeMicros() - nStart) * 0.001));
+    }
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(scan_filter_tests)
+{
+    CWallet keystore;
+    LOCK(keystore.cs_wallet);
+    CKey key, keyOther, keyScript;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    keyScript.MakeNewKey(true);
+    keystore.AddKey(key);
+    CScript redeemScript = GetScriptForDestination(keyScript.GetPubKey().GetID());
+    keystore.AddCScript(redeemScript);
+    CScript watchScript = CScript() << ToByteVector(keyOther.GetPubKey()) << OP_CHECKSIG;
+    keystore.AddWatchOnly(watchScript);
+
+    CWalletScanFilter filter;
+    keystore.GetScanFilter(filter);
+
+    vector<CScript> vScripts;
+    vScripts.push_back(CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG);
+    vScripts.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+    vScripts.push_back(GetScriptForDestination(CScriptID(redeemScript)));
+    vScripts.push_back(watchScript);
+    vScripts.push_back(GetScriptForDestination(keyOther.GetPubKey().GetID()));
+    vScripts.push_back(CScript() << OP_RETURN);
+    vector<CPubKey> vKeys;
+    vKeys.push_back(key.GetPubKey());
+    vKeys.push_back(key.GetPubKey());
+    vScripts.push_back(GetScriptForMultisig(1, vKeys));
+
+    // Everything the wallet considers its own passes the filter
+    BOOST_FOREACH(const CScript& script, vScripts)
+        BOOST_CHECK_EQUAL(filter.IsRelevant(script), IsMine(keystore, script) != ISMINE_NO);
+
+    // Multisig with only some of our keys passes, to be rejected by IsMine later
+    vKeys[1] = keyOther.GetPubKey();
+    BOOST_CHECK(filter.IsRelevant(GetScriptForMultisig(1, vKeys)));
+    BOOST_CHECK(IsMine(keystore, GetScriptForMultisig(1, vKeys)) == ISMINE_NO);
+}
+
+BOOST_AUTO_TEST_CASE(scan_block_matches)
+{
+    // An output to us, then a chain of spends from it within the same block
+    CMutableTransaction txReceive, txSweep, txSweepAgain, txOther, txSpendKnown;
+    txReceive.vin.resize(1);
+    txReceive.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txReceive.vout.resize(1);
+    txSweep.vin.push_back(CTxIn(COutPoint(CTransaction(txReceive).GetHash(), 0)));
+    txSweep.vout.resize(1);
+    txSweepAgain.vin.push_back(CTxIn(COutPoint(CTransaction(txSweep).GetHash(), 0)));
+    txSweepAgain.vout.resize(1);
+    txOther.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txOther.vout.resize(1);
+    uint256 hashKnown = GetRandHash();
+    txSpendKnown.vin.push_back(CTxIn(COutPoint(hashKnown, 1)));
+    txSpendKnown.vout.resize(1);
+
+    CBlock block;
+    block.vtx.push_back(txOther);
+    block.vtx.push_back(txReceive);
+    block.vtx.push_back(txSweep);
+    block.vtx.push_back(txSweepAgain);
+    block.vtx.push_back(txSpendKnown);
+    vector<bool> vOutputMatch(block.vtx.size(), false);
+    vOutputMatch[1] = true;
+
+    set<uint256> setWalletTxes;
+    setWalletTxes.insert(hashKnown);
+    vector<unsigned int> vMatches = CWalletScanFilter::MatchBlock(block, vOutputMatch, setWalletTxes);
+
+    BOOST_CHECK_EQUAL(vMatches.size(), 4U);
+    BOOST_CHECK(std::find(vMatches.begin(), vMatches.end(), 0U) == vMatches.end());
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        BOOST_CHECK(setWalletTxes.count(block.vtx[i].GetHash()));
+    BOOST_CHECK(!setWalletTxes.count(block.vtx[0].GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(witness_cache_first_spend)
+{
+    // A mint as UpdatedBlockTip starts its witness, before any block is accumulated
+    CAccumulatorWitnessState state;
+    state.bnPubcoin = CBigNum(1234567);
+    state.denom = libzerocoin::ZQ_ONE;
+    state.nHeightMintAdded = 123;
+    state.nHeightAccStart = 120;
+    state.nHeightEnd = 120;
+    state.hashBlockLast = GetRandHash();
+    state.bnWitness = CBigNum(7654321);
+    uint256 hashPubcoin = state.GetPubcoinHash();
+    uint256 hashOther = GetPubCoinHash(CBigNum(42));
+
+    set<uint256> setPubcoinsUnspent;
+    setPubcoinsUnspent.insert(hashPubcoin);
+    setPubcoinsUnspent.insert(hashOther);
+    {
+        CzMASTERWitnessCache cache("wallet.dat");
+        BOOST_CHECK_EQUAL(cache.GetMissing(setPubcoinsUnspent).size(), 2U);
+        cache.Update(state);
+        vector<uint256> vMissing = cache.GetMissing(setPubcoinsUnspent);
+        BOOST_REQUIRE_EQUAL(vMissing.size(), 1U);
+        BOOST_CHECK(vMissing[0] == hashOther);
+    }
+
+    // The first spend of the mint, after a restart, finds the started witness to resume from
+    CzMASTERWitnessCache cache("wallet.dat");
+    CAccumulatorWitnessState stateSpend;
+    BOOST_CHECK(cache.Get(hashPubcoin, stateSpend));
+    BOOST_CHECK(stateSpend.bnWitness == state.bnWitness);
+    BOOST_CHECK_EQUAL(stateSpend.nHeightEnd, state.nHeightEnd);
+    BOOST_CHECK(stateSpend.hashBlockLast == state.hashBlockLast);
+    BOOST_CHECK(!cache.Get(hashOther, stateSpend));
+
+    BOOST_CHECK(CWalletDB("wallet.dat").EraseWitnessState(hashPubcoin));
+}
+
+// Compares what the wallet coin index yields with a scan of all of mapWallet
+static void check_wallet_coins(const CWallet& wallet)
+{
+    CAmount nBalance = 0, nWatchOnlyBalance = 0;
+    set<COutPoint> setExpected;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it) {
+        const CWalletTx& wtx = it->second;
+        if (!wtx.IsTrusted())
+            continue;
+        nBalance += wtx.GetAvailableCredit();
+        nWatchOnlyBalance += wtx.GetAvailableWatchOnlyCredit();
+        if (!CheckFinalTx(wtx) || ((wtx.IsCoinBase() || wtx.IsCoinStake()) && wtx.GetBlocksToMaturity() > 0) ||
+            (wtx.GetDepthInMainChain(false) == 0 && !wtx.InMempool()))
+            continue;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            if (wallet.IsMine(wtx.vout[i]) != ISMINE_NO && !wallet.IsSpent(it->first, i) &&
+                !wallet.IsLockedCoin(it->first, i) && wtx.vout[i].nValue > 0)
+                setExpected.insert(COutPoint(it->first, i));
+        }
+    }
+
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), nWatchOnlyBalance);
+    vector<COutput> vAvailable;
+    wallet.AvailableCoins(vAvailable, true, NULL, false, ALL_COINS, false, 0);
+    set<COutPoint> setAvailable;
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        setAvailable.insert(COutPoint(out.tx->GetHash(), out.i));
+    BOOST_CHECK(setAvailable == setExpected);
+}
+
+// A block on top of the active chain holding vtx, made the tip
+static CBlockIndex* connect_block(CBlock& block, const vector<CMutableTransaction>& vtx)
+{
+    block.nVersion = 1;
+    block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+    block.nTime = chainActive.Tip()->nTime + 60;
+    block.nBits = chainActive.Tip()->nBits;
+    BOOST_FOREACH(const CMutableTransaction& tx, vtx)
+        block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CBlockIndex* pindex = InsertBlockIndex(block.GetHash());
+    pindex->pprev = chainActive.Tip();
+    pindex->nHeight = chainActive.Height() + 1;
+    pindex->nVersion = block.nVersion;
+    pindex->hashMerkleRoot = block.hashMerkleRoot;
+    pindex->nTime = block.nTime;
+    pindex->nBits = block.nBits;
+    chainActive.SetTip(pindex);
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(wallet_coin_index)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexGenesis = chainActive.Tip();
+
+    CKey key, keyImported, keyWatched, keyOther;
+    key.MakeNewKey(true);
+    keyImported.MakeNewKey(true);
+    keyWatched.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKey(key));
+    CScript scriptWatched = GetScriptForDestination(keyWatched.GetPubKey().GetID());
+    check_wallet_coins(*pwalletMain);
+    CAmount nBalanceStart = pwalletMain->GetBalance();
+    CAmount nWatchOnlyBalanceStart = pwalletMain->GetWatchOnlyBalance();
+
+    // A receive, with outputs to keys that the wallet only learns about later
+    CMutableTransaction txReceive;
+    txReceive.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    txReceive.vout.push_back(CTxOut(10 * COIN, GetScriptForDestination(key.GetPubKey().GetID())));
+    txReceive.vout.push_back(CTxOut(5 * COIN, GetScriptForDestination(key.GetPubKey().GetID())));
+    txReceive.vout.push_back(CTxOut(3 * COIN, scriptWatched));
+    txReceive.vout.push_back(CTxOut(2 * COIN, GetScriptForDestination(keyImported.GetPubKey().GetID())));
+    uint256 hashReceive = CTransaction(txReceive).GetHash();
+    CBlock blockReceive;
+    CBlockIndex* pindexReceive = connect_block(blockReceive, vector<CMutableTransaction>(1, txReceive));
+    pwalletMain->SyncTransaction(txReceive, &blockReceive);
+    BOOST_CHECK(pwalletMain->mapWallet.count(hashReceive));
+    check_wallet_coins(*pwalletMain);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), nBalanceStart + 15 * COIN);
+
+    // A confirmed spend of the first output
+    CMutableTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(hashReceive, 0)));
+    txSpend.vout.push_back(CTxOut(10 * COIN, GetScriptForDestination(keyOther.GetPubKey().GetID())));
+    uint256 hashSpend = CTransaction(txSpend).GetHash();
+    CBlock blockSpend;
+    CBlockIndex* pindexSpend = connect_block(blockSpend, vector<CMutableTransaction>(1, txSpend));
+    pwalletMain->SyncTransaction(txSpend, &blockSpend);
+    check_wallet_coins(*pwalletMain);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), nBalanceStart + 5 * COIN);
+
+    // The spend is disconnected, its output is ours again
+    chainActive.SetTip(pindexReceive);
+    pwalletMain->SyncTransaction(txSpend, NULL);
+    check_wallet_coins(*pwalletMain);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), nBalanceStart + 15 * COIN);
+
+    // Locked coins are not available, unlocked ones are again
+    COutPoint outpoint(hashReceive, 1);
+    pwalletMain->LockCoin(outpoint);
+    check_wallet_coins(*pwalletMain);
+    pwalletMain->UnlockCoin(outpoint);
+    check_wallet_coins(*pwalletMain);
+
+    // Imported keys and watch-only scripts pick up outputs already in the wallet. The
+    // credit caches of the transaction are reset by hand, as the rescan of an import does.
+    BOOST_CHECK(pwalletMain->AddKey(keyImported));
+    pwalletMain->mapWallet[hashReceive].MarkDirty();
+    check_wallet_coins(*pwalletMain);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), nBalanceStart + 17 * COIN);
+    BOOST_CHECK(pwalletMain->AddWatchOnly(scriptWatched));
+    pwalletMain->mapWallet[hashReceive].MarkDirty();
+    check_wallet_coins(*pwalletMain);
+    BOOST_CHECK_EQUAL(pwalletMain->GetWatchOnlyBalance(), nWatchOnlyBalanceStart + 3 * COIN);
+
+    // Leave the wallet and the chain as the other tests expect them
+    BOOST_CHECK(pwalletMain->RemoveWatchOnly(scriptWatched));
+    pwalletMain->EraseFromWallet(hashSpend);
+    pwalletMain->EraseFromWallet(hashReceive);
+    chainActive.SetTip(pindexGenesis);
+    mapBlockIndex.erase(pindexSpend->GetBlockHash());
+    mapBlockIndex.erase(pindexReceive->GetBlockHash());
+    check_wallet_coins(*pwalletMain);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
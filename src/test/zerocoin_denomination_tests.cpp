@@ -69,6 +69,40 @@ BOOST_AUTO_TEST_CASE(denomination_to_value_test)
     BOOST_CHECK_MESSAGE(ZerocoinDenominationToAmount(denomination) == Value, "Wrong Value - should be 0");
 }
 
+BOOST_AUTO_TEST_CASE(denomination_counts_test)
+{
+    cout << "Running denomination_counts_test...\n";
+
+    for (unsigned int i = 0; i < zerocoinDenomList.size(); i++)
+        BOOST_CHECK_MESSAGE(ZerocoinDenominationToIndex(zerocoinDenomList[i]) == (int)i, "Wrong index for denomination");
+    BOOST_CHECK_MESSAGE(ZerocoinDenominationToIndex(ZQ_ERROR) == -1, "ZQ_ERROR should not have an index");
+
+    //the block index counters must read and write the map and vector formats they replaced
+    std::map<CoinDenomination, int64_t> mapSupply;
+    for (auto& denom : zerocoinDenomList)
+        mapSupply[denom] = ZerocoinDenominationToInt(denom) * 3;
+    std::vector<CoinDenomination> vMints = {ZQ_FIVE, ZQ_ONE, ZQ_FIVE, ZQ_FIVE_THOUSAND};
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << mapSupply << vMints;
+    CZerocoinSupply supply;
+    CZerocoinMintCounts mints;
+    ss >> supply >> mints;
+    BOOST_CHECK(supply.at(ZQ_FIFTY) == 150);
+    BOOST_CHECK(mints.count(ZQ_FIVE) == 2 && mints.count(ZQ_ONE) == 1 && mints.count(ZQ_TEN) == 0 && mints.size() == 4);
+
+    CDataStream ssSupply(SER_DISK, CLIENT_VERSION), ssMap(SER_DISK, CLIENT_VERSION);
+    ssSupply << supply;
+    ssMap << mapSupply;
+    BOOST_CHECK(ssSupply.str() == ssMap.str());
+
+    CDataStream ssMints(SER_DISK, CLIENT_VERSION);
+    ssMints << mints;
+    std::vector<CoinDenomination> vMintsRead;
+    ssMints >> vMintsRead;
+    BOOST_CHECK(vMintsRead.size() == vMints.size() && count(vMintsRead.begin(), vMintsRead.end(), ZQ_FIVE) == 2);
+}
+
 BOOST_AUTO_TEST_CASE(zerocoin_spend_test241)
 {
     const int nMaxNumberOfSpends = 4;
@@ -516,4 +516,49 @@ BOOST_AUTO_TEST_CASE(deterministic_tests)
 }
 
 
+BOOST_AUTO_TEST_CASE(deterministic_mintpool_tests)
+{
+    SelectParams(CBaseChainParams::UNITTEST);
+    uint256 seedMaster("3a1947364362e2e7c073b386869c89c905c0cf462448ffd6c2021bd03ce689f6");
+
+    string strWalletFile = "unittestwallet.dat";
+    CWalletDB walletdb(strWalletFile, "cr+");
+
+    CWallet wallet(strWalletFile);
+    CzMASTERWallet zWallet(wallet.strWalletFile);
+    zWallet.SetMasterSeed(seedMaster, true);
+
+    // Derived on several threads, the pool holds what one by one derivation gives
+    const int nMints = 24;
+    zWallet.GenerateMintPool(1, nMints, 4);
+
+    int nCount, nLastGenerated;
+    zWallet.GetState(nCount, nLastGenerated);
+    BOOST_CHECK_EQUAL(nLastGenerated, nMints);
+    uint64_t nDerived;
+    int64_t nTime;
+    int nThreads;
+    zWallet.GetGenerationStats(nDerived, nTime, nThreads);
+    BOOST_CHECK_EQUAL(nDerived, (uint64_t)nMints);
+    BOOST_CHECK_EQUAL(nThreads, 4);
+
+    for (uint32_t i = 1; i <= (uint32_t)nMints; i++) {
+        CDataStream ss(SER_GETHASH, 0);
+        ss << seedMaster << i;
+        uint512 seedZerocoin = Hash512(ss.begin(), ss.end());
+        CBigNum bnValue;
+        CBigNum bnSerial;
+        CBigNum bnRandomness;
+        CKey key;
+        zWallet.SeedToZMASTER(seedZerocoin, bnValue, bnSerial, bnRandomness, key);
+        BOOST_CHECK_MESSAGE(zWallet.IsInMintPool(bnValue), strprintf("mint %d missing from the pool", i));
+    }
+
+    // Counts already in the pool are not derived again
+    zWallet.GenerateMintPool(1, nMints, 4);
+    zWallet.GetGenerationStats(nDerived, nTime, nThreads);
+    BOOST_CHECK_EQUAL(nDerived, (uint64_t)nMints);
+}
+
+
 BOOST_AUTO_TEST_SUITE_END()
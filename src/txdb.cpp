@@ -7,12 +7,20 @@
 #include "txdb.h"
 
 #include "main.h"
+#include "hash.h"
 #include "pow.h"
+#include "random.h"
 #include "uint256.h"
 #include "accumulators.h"
+#include "crypto/common.h"
 
+#include <algorithm>
+#include <limits>
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -74,7 +82,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe), fBlockIndexLoaded(false)
 {
 }
 
@@ -208,7 +216,83 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
+/** Create the in-memory entry for one block index record */
+static bool AddDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex, bool fCheckPoW, uint256& nPreviousCheckpoint)
+{
+    // Construct block index object
+    CBlockIndex* pindexNew = InsertBlockIndex(hash);
+    pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
+    pindexNew->nHeight = diskindex.nHeight;
+    pindexNew->nFile = diskindex.nFile;
+    pindexNew->nDataPos = diskindex.nDataPos;
+    pindexNew->nUndoPos = diskindex.nUndoPos;
+    pindexNew->nVersion = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime = diskindex.nTime;
+    pindexNew->nBits = diskindex.nBits;
+    pindexNew->nNonce = diskindex.nNonce;
+    pindexNew->nStatus = diskindex.nStatus;
+    pindexNew->nTx = diskindex.nTx;
+
+    //zerocoin
+    pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
+    pindexNew->zerocoinSupply = diskindex.zerocoinSupply;
+    pindexNew->zerocoinMintsInBlock = diskindex.zerocoinMintsInBlock;
+
+    //Proof Of Stake
+    pindexNew->nMint = diskindex.nMint;
+    pindexNew->nMoneySupply = diskindex.nMoneySupply;
+    pindexNew->nFlags = diskindex.nFlags;
+    pindexNew->nStakeModifier = diskindex.nStakeModifier;
+    pindexNew->prevoutStake = diskindex.prevoutStake;
+    pindexNew->nStakeTime = diskindex.nStakeTime;
+    pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+
+    if (fCheckPoW && pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
+        if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
+            return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+    }
+    // ppcoin: build setStakeSeen
+    if (pindexNew->IsProofOfStake())
+        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+    //populate accumulator checksum map in memory
+    if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
+        //Don't load any checkpoints that exist before v2 zmaster. The accumulator is invalid for v1 and not used.
+        if (pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
+            LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
+
+        nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
+    }
+
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    bool fLoaded = false;
+    if (GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT)) {
+        fLoaded = LoadBlockIndexSnapshot();
+        if (!fLoaded && !mapBlockIndex.empty()) {
+            // Start over from LevelDB with a clean slate
+            UnloadBlockIndex();
+            setStakeSeen.clear();
+        }
+    }
+
+    if (!fLoaded && !LoadBlockIndexRecords())
+        return false;
+
+    // Any block index write from here on makes the snapshot stale, so it is
+    // invalidated until it is rewritten at shutdown.
+    if (!WriteInt("blockindexsnapshot", 0))
+        return false;
+    fBlockIndexLoaded = true;
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexRecords()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
@@ -222,61 +306,17 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            CBufferReader ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
             if (chType == 'b') {
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                CBufferReader ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
 
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //zerocoin
-                pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                // ppcoin: build setStakeSeen
-                if (pindexNew->IsProofOfStake())
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
-                //populate accumulator checksum map in memory
-                if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
-                    //Don't load any checkpoints that exist before v2 zmaster. The accumulator is invalid for v1 and not used.
-                    if (pindexNew->nHeight >= Params().Zerocoin_Block_V2_Start())
-                        LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
-
-                    nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
-                }
+                if (!AddDiskBlockIndex(diskindex.GetBlockHash(), diskindex, true, nPreviousCheckpoint))
+                    return false;
 
                 pcursor->Next();
             } else {
@@ -290,6 +330,169 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     return true;
 }
 
+/** Format version of the block index snapshot file */
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "blockindex.dat";
+}
+
+static bool CompareBlockIndexHeight(const CBlockIndex* a, const CBlockIndex* b)
+{
+    return a->nHeight < b->nHeight;
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+    if (!fBlockIndexLoaded)
+        return false;
+
+    // Written in height order, so that loading allocates parents first and
+    // consecutive blocks share their accumulator checkpoint lookups
+    std::vector<CBlockIndex*> vSorted;
+    vSorted.reserve(mapBlockIndex.size());
+    for (BlockMap::const_iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it)
+        vSorted.push_back(it->second);
+    std::sort(vSorted.begin(), vSorted.end(), CompareBlockIndexHeight);
+
+    int nToken = 1 + (int)GetRand(std::numeric_limits<int>::max() - 1);
+
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = pathSnapshot.string() + ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
+
+    // header and records are checksummed as they are written, the checksum is appended
+    try {
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << FLATDATA(Params().MessageStart());
+        ss << BLOCK_INDEX_SNAPSHOT_VERSION << nToken << (uint64_t)vSorted.size();
+        for (unsigned int i = 0; i <= vSorted.size(); i++) {
+            if (i == vSorted.size() || ss.size() >= (1 << 20)) {
+                hasher.write(&ss[0], ss.size());
+                fileout.write(&ss[0], ss.size());
+                ss.clear();
+            }
+            if (i < vSorted.size())
+                ss << vSorted[i]->GetBlockHash() << CDiskBlockIndex(vSorted[i]);
+        }
+        fileout << hasher.GetHash();
+    } catch (std::exception& e) {
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, pathSnapshot))
+        return error("%s : Rename-into-place failed", __func__);
+
+    // Only now does the block tree vouch for the file
+    if (!Write(std::make_pair('I', std::string("blockindexsnapshot")), nToken, true))
+        return error("%s : Failed to record snapshot token", __func__);
+
+    LogPrintf("%s : wrote %u block index entries\n", __func__, vSorted.size());
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot()
+{
+    // The token ties the file to the state of this database at shutdown
+    int nToken = 0;
+    if (!ReadInt("blockindexsnapshot", nToken) || nToken == 0)
+        return false;
+
+    boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    try {
+        if (!boost::filesystem::exists(pathSnapshot))
+            return false;
+
+        boost::interprocess::file_mapping mapping(pathSnapshot.string().c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+        const char* pbegin = static_cast<const char*>(region.get_address());
+        size_t nSize = region.get_size();
+        if (nSize < sizeof(uint256))
+            return error("%s : %s is truncated", __func__, pathSnapshot.string());
+        const char* pend = pbegin + nSize - sizeof(uint256);
+
+        uint256 hashChecksum;
+        CBufferReader(pend, pend + sizeof(uint256), SER_DISK, CLIENT_VERSION) >> hashChecksum;
+        if (Hash(pbegin, pend) != hashChecksum)
+            return error("%s : checksum mismatch in %s", __func__, pathSnapshot.string());
+
+        CBufferReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+        unsigned char pchMsgTmp[4];
+        int nVersion;
+        int nFileToken;
+        uint64_t nCount;
+        reader >> FLATDATA(pchMsgTmp) >> nVersion >> nFileToken >> nCount;
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("%s : invalid network magic number", __func__);
+        if (nVersion != BLOCK_INDEX_SNAPSHOT_VERSION || nFileToken != nToken) {
+            LogPrintf("%s : snapshot does not match the block index database, ignoring it\n", __func__);
+            return false;
+        }
+
+        ReserveBlockIndex(nCount);
+
+        // The records were validated before the snapshot was written, so
+        // neither the block hash nor proof of work is recomputed here. Every
+        // entry must still be the genesis block or sit one block above an
+        // already loaded parent, in height order.
+        uint256 nPreviousCheckpoint;
+        const CBlockIndex* pindexLast = NULL;
+        for (uint64_t i = 0; i < nCount; i++) {
+            if (i % 10000 == 0)
+                boost::this_thread::interruption_point();
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            reader >> hash >> diskindex;
+
+            int nPrevHeight = -1;
+            if (diskindex.hashPrev == 0) {
+                if (hash != Params().HashGenesisBlock())
+                    return error("%s : entry %u (%s) has no parent", __func__, i, hash.GetHex());
+            } else {
+                BlockMap::const_iterator mi = mapBlockIndex.find(diskindex.hashPrev);
+                if (mi == mapBlockIndex.end())
+                    return error("%s : entry %u (%s) precedes its parent", __func__, i, hash.GetHex());
+                nPrevHeight = mi->second->nHeight;
+            }
+            if (diskindex.nHeight != nPrevHeight + 1 || (pindexLast && diskindex.nHeight < pindexLast->nHeight))
+                return error("%s : entry %u (%s) has height %d, expected %d", __func__, i, hash.GetHex(), diskindex.nHeight, nPrevHeight + 1);
+
+            if (!AddDiskBlockIndex(hash, diskindex, false, nPreviousCheckpoint))
+                return false;
+            pindexLast = mapBlockIndex[hash];
+        }
+        if (!reader.empty())
+            return error("%s : trailing data in %s", __func__, pathSnapshot.string());
+        // A repeated hash, or a next block pointer outside the snapshot, shows up as a count mismatch
+        if (mapBlockIndex.size() != nCount)
+            return error("%s : %u entries in %s built %u block index entries", __func__, nCount, pathSnapshot.string(), mapBlockIndex.size());
+
+        // Spot check the highest entry against its LevelDB record
+        if (pindexLast) {
+            CDiskBlockIndex diskindex;
+            if (!Read(std::make_pair('b', pindexLast->GetBlockHash()), diskindex) ||
+                diskindex.GetBlockHash() != pindexLast->GetBlockHash() ||
+                diskindex.nStatus != pindexLast->nStatus || diskindex.nHeight != pindexLast->nHeight)
+                return error("%s : snapshot disagrees with the block index database", __func__);
+        }
+
+        LogPrintf("%s : loaded %u block index entries from %s\n", __func__, nCount, pathSnapshot.string());
+        return true;
+    } catch (const boost::thread_interrupted&) {
+        throw;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+}
+
 CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
 {
 }
@@ -424,3 +627,110 @@ bool CZerocoinDB::EraseAccumulatorValue(const uint32_t& nChecksum)
     LogPrint("zero", "%s : checksum:%d\n", __func__, nChecksum);
     return Erase(make_pair('2', nChecksum));
 }
+
+//Heights in the mint index are stored big endian, so that the records of a block are adjacent and ordered by height
+static uint32_t MintIndexHeight(int nHeight)
+{
+    unsigned char buf[4];
+    WriteBE32(buf, nHeight);
+    return ReadLE32(buf);
+}
+
+void CZerocoinDB::EraseBlockMints(int nHeight, CLevelDBBatch& batch)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('h', make_pair(MintIndexHeight(nHeight), libzerocoin::ZQ_ERROR));
+    pcursor->Seek(ssKeySet.str());
+    while (pcursor->Valid()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        std::pair<uint32_t, libzerocoin::CoinDenomination> key;
+        ssKey >> chType;
+        if (chType != 'h')
+            break;
+        ssKey >> key;
+        if (key.first != MintIndexHeight(nHeight))
+            break;
+        batch.Erase(make_pair(chType, key));
+        pcursor->Next();
+    }
+}
+
+bool CZerocoinDB::WriteBlockMints(int nHeight, const uint256& hashBlock, const std::map<libzerocoin::CoinDenomination, std::vector<CBigNum> >& mapMints)
+{
+    // The entry for ZQ_ERROR records which block is indexed at this height
+    CLevelDBBatch batch;
+    EraseBlockMints(nHeight, batch);
+    batch.Write(make_pair('h', make_pair(MintIndexHeight(nHeight), libzerocoin::ZQ_ERROR)), hashBlock);
+    for (const auto& denomMints : mapMints)
+        batch.Write(make_pair('h', make_pair(MintIndexHeight(nHeight), denomMints.first)), denomMints.second);
+
+    return WriteBatch(batch);
+}
+
+bool CZerocoinDB::ReadBlockMints(int nHeight, uint256& hashBlock, std::map<libzerocoin::CoinDenomination, std::vector<CBigNum> >& mapMints)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('h', make_pair(MintIndexHeight(nHeight), libzerocoin::ZQ_ERROR));
+    pcursor->Seek(ssKeySet.str());
+    bool fIndexed = false;
+    while (pcursor->Valid()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            std::pair<uint32_t, libzerocoin::CoinDenomination> key;
+            ssKey >> chType;
+            if (chType != 'h')
+                break;
+            ssKey >> key;
+            if (key.first != MintIndexHeight(nHeight))
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            if (key.second == libzerocoin::ZQ_ERROR) {
+                ssValue >> hashBlock;
+                fIndexed = true;
+            } else {
+                ssValue >> mapMints[key.second];
+            }
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    return fIndexed;
+}
+
+bool CZerocoinDB::EraseBlockMints(int nHeight)
+{
+    CLevelDBBatch batch;
+    EraseBlockMints(nHeight, batch);
+    return WriteBatch(batch);
+}
+
+bool CZerocoinDB::WriteReindexProgress(const std::string& strName, int nHeight, const uint256& hashBlock)
+{
+    return Write(make_pair('r', strName), make_pair(nHeight, hashBlock), true);
+}
+
+bool CZerocoinDB::ReadReindexProgress(const std::string& strName, int& nHeight, uint256& hashBlock)
+{
+    std::pair<int, uint256> progress;
+    if (!Read(make_pair('r', strName), progress))
+        return false;
+
+    nHeight = progress.first;
+    hashBlock = progress.second;
+    return true;
+}
+
+bool CZerocoinDB::EraseReindexProgress(const std::string& strName)
+{
+    return Erase(make_pair('r', strName), true);
+}
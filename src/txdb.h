@@ -25,6 +25,8 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -blockindexsnapshot default
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -52,6 +54,9 @@ private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 
+    //! whether mapBlockIndex holds the complete contents of this database
+    bool fBlockIndexLoaded;
+
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
@@ -67,6 +72,12 @@ public:
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
     bool LoadBlockIndexGuts();
+    /** Write mapBlockIndex to blocks/blockindex.dat, for a faster LoadBlockIndexGuts on the next start */
+    bool WriteBlockIndexSnapshot();
+
+private:
+    bool LoadBlockIndexRecords();
+    bool LoadBlockIndexSnapshot();
 };
 
 /** Zerocoin database (zerocoin/) */
@@ -94,6 +105,18 @@ public:
     bool WriteAccumulatorValue(const uint32_t& nChecksum, const CBigNum& bnValue);
     bool ReadAccumulatorValue(const uint32_t& nChecksum, CBigNum& bnValue);
     bool EraseAccumulatorValue(const uint32_t& nChecksum);
+    /** Index the mints of a block by height and denomination, replacing what was indexed at that height */
+    bool WriteBlockMints(int nHeight, const uint256& hashBlock, const std::map<libzerocoin::CoinDenomination, std::vector<CBigNum> >& mapMints);
+    /** Read the indexed mints of the block at nHeight. Returns false if no block is indexed at that height */
+    bool ReadBlockMints(int nHeight, uint256& hashBlock, std::map<libzerocoin::CoinDenomination, std::vector<CBigNum> >& mapMints);
+    bool EraseBlockMints(int nHeight);
+    /** Progress of an interrupted reindex, so that it can resume after the last block it wrote */
+    bool WriteReindexProgress(const std::string& strName, int nHeight, const uint256& hashBlock);
+    bool ReadReindexProgress(const std::string& strName, int& nHeight, uint256& hashBlock);
+    bool EraseReindexProgress(const std::string& strName);
+
+private:
+    void EraseBlockMints(int nHeight, CLevelDBBatch& batch);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -17,16 +17,38 @@
 
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), nFeeDelta(0),
+                                     nCountWithAncestors(0), nSizeWithAncestors(0), nModFeesWithAncestors(0),
+                                     nCountWithDescendants(0), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), nFeeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
+
+    // Heap memory held for this transaction: the entry and its node in every
+    // mapTx index, the transaction's vectors and scripts, one mapNextTx node
+    // per input and its mapLinks node. Allocator overhead is not counted.
+    static const size_t nNodeOverhead = 4 * sizeof(void*);
+    nUsageSize = sizeof(CTxMemPoolEntry) + 4 * nNodeOverhead;
+    nUsageSize += tx.vin.capacity() * sizeof(CTxIn) + tx.vout.capacity() * sizeof(CTxOut);
+    BOOST_FOREACH (const CTxIn& txin, tx.vin)
+        nUsageSize += txin.scriptSig.capacity() + sizeof(std::pair<const COutPoint, CInPoint>) + nNodeOverhead;
+    BOOST_FOREACH (const CTxOut& txout, tx.vout)
+        nUsageSize += txout.scriptPubKey.capacity();
+    nUsageSize += sizeof(uint256) + 2 * sizeof(std::set<uint256>) + nNodeOverhead;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -43,6 +65,20 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::SetAncestorState(uint64_t nCount, uint64_t nSize, const CAmount& nModFees)
+{
+    nCountWithAncestors = nCount;
+    nSizeWithAncestors = nSize;
+    nModFeesWithAncestors = nModFees;
+}
+
+void CTxMemPoolEntry::SetDescendantState(uint64_t nCount, uint64_t nSize, const CAmount& nModFees)
+{
+    nCountWithDescendants = nCount;
+    nSizeWithDescendants = nSize;
+    nModFeesWithDescendants = nModFees;
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -356,7 +392,11 @@ public:
 
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) : nTransactionsUpdated(0),
-                                                       minRelayFee(_minRelayFee)
+                                                       minRelayFee(_minRelayFee),
+                                                       totalTxSize(0),
+                                                       cachedInnerUsage(0),
+                                                       lastRollingFeeUpdate(0),
+                                                       rollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -402,6 +442,70 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+void CTxMemPool::CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const
+{
+    std::vector<uint256> vStack(1, hash);
+    while (!vStack.empty()) {
+        std::map<uint256, TxLinks>::const_iterator it = mapLinks.find(vStack.back());
+        vStack.pop_back();
+        if (it == mapLinks.end())
+            continue;
+        BOOST_FOREACH (const uint256& parent, it->second.parents) {
+            if (setAncestors.insert(parent).second)
+                vStack.push_back(parent);
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const
+{
+    std::vector<uint256> vStack(1, hash);
+    while (!vStack.empty()) {
+        std::map<uint256, TxLinks>::const_iterator it = mapLinks.find(vStack.back());
+        vStack.pop_back();
+        if (it == mapLinks.end())
+            continue;
+        BOOST_FOREACH (const uint256& child, it->second.children) {
+            if (setDescendants.insert(child).second)
+                vStack.push_back(child);
+        }
+    }
+}
+
+void CTxMemPool::UpdateAncestorState(txiter it)
+{
+    std::set<uint256> setAncestors;
+    CalculateAncestors(it->GetTx().GetHash(), setAncestors);
+
+    uint64_t nCount = 1;
+    uint64_t nSize = it->GetTxSize();
+    CAmount nModFees = it->GetModifiedFee();
+    BOOST_FOREACH (const uint256& ancestor, setAncestors) {
+        txiter itAncestor = mapTx.find(ancestor);
+        nCount++;
+        nSize += itAncestor->GetTxSize();
+        nModFees += itAncestor->GetModifiedFee();
+    }
+    mapTx.modify(it, update_ancestor_state(nCount, nSize, nModFees));
+}
+
+void CTxMemPool::UpdateDescendantState(txiter it)
+{
+    std::set<uint256> setDescendants;
+    CalculateDescendants(it->GetTx().GetHash(), setDescendants);
+
+    uint64_t nCount = 1;
+    uint64_t nSize = it->GetTxSize();
+    CAmount nModFees = it->GetModifiedFee();
+    BOOST_FOREACH (const uint256& descendant, setDescendants) {
+        txiter itDescendant = mapTx.find(descendant);
+        nCount++;
+        nSize += itDescendant->GetTxSize();
+        nModFees += itDescendant->GetModifiedFee();
+    }
+    mapTx.modify(it, update_descendant_state(nCount, nSize, nModFees));
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
 {
     // Add to memory pool without checking anything.
@@ -409,27 +513,169 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        if (mapTx.count(hash)) {
+            std::list<CTransaction> dummy;
+            remove(entry.GetTx(), dummy, false);
+        }
+        txiter it = mapTx.insert(entry).first;
+        const CTransaction& tx = it->GetTx();
+        TxLinks& links = mapLinks[hash];
         if(!tx.IsZerocoinSpend()) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++)
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
+                if (mapTx.count(tx.vin[i].prevout.hash)) {
+                    links.parents.insert(tx.vin[i].prevout.hash);
+                    mapLinks[tx.vin[i].prevout.hash].children.insert(hash);
+                }
+            }
         }
+
+        // Transactions returned to the pool by a reorg may already have children here
+        std::map<COutPoint, CInPoint>::iterator itNext = mapNextTx.lower_bound(COutPoint(hash, 0));
+        while (itNext != mapNextTx.end() && itNext->first.hash == hash) {
+            const uint256 child = itNext->second.ptx->GetHash();
+            links.children.insert(child);
+            mapLinks[child].parents.insert(hash);
+            itNext++;
+        }
+
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator itDelta = mapDeltas.find(hash);
+        if (itDelta != mapDeltas.end())
+            mapTx.modify(it, update_fee_delta(itDelta->second.second));
+
+        std::set<uint256> setAncestors;
+        CalculateAncestors(hash, setAncestors);
+        UpdateAncestorState(it);
+        UpdateDescendantState(it);
+        if (links.children.empty()) {
+            // A new leaf: every ancestor gains exactly this transaction
+            BOOST_FOREACH (const uint256& ancestor, setAncestors) {
+                txiter itAncestor = mapTx.find(ancestor);
+                mapTx.modify(itAncestor, update_descendant_state(itAncestor->GetCountWithDescendants() + 1,
+                                                                 itAncestor->GetSizeWithDescendants() + it->GetTxSize(),
+                                                                 itAncestor->GetModFeesWithDescendants() + it->GetModifiedFee()));
+            }
+        } else {
+            // Joining existing packages: recount both sides of the new links
+            std::set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            BOOST_FOREACH (const uint256& ancestor, setAncestors)
+                UpdateDescendantState(mapTx.find(ancestor));
+            BOOST_FOREACH (const uint256& descendant, setDescendants)
+                UpdateAncestorState(mapTx.find(descendant));
+        }
+
         nTransactionsUpdated++;
-        totalTxSize += entry.GetTxSize();
+        totalTxSize += it->GetTxSize();
+        cachedInnerUsage += it->DynamicMemoryUsage();
     }
     return true;
 }
 
+class CompareRemoveOrder
+{
+public:
+    bool operator()(const std::pair<uint64_t, CTxMemPool::txiter>& a, const std::pair<uint64_t, CTxMemPool::txiter>& b) const
+    {
+        if (a.first == b.first)
+            return a.second->GetTx().GetHash() < b.second->GetTx().GetHash();
+        return a.first < b.first;
+    }
+};
+
+void CTxMemPool::RemoveStaged(const std::set<uint256>& setRemove, std::list<CTransaction>& removed)
+{
+    // Entries left in the pool that lose ancestors or descendants
+    std::set<uint256> setUpdateAncestors;
+    std::set<uint256> setUpdateDescendants;
+    bool fOutsideAncestors = false;
+    BOOST_FOREACH (const uint256& hash, setRemove) {
+        std::set<uint256> setAncestors;
+        CalculateAncestors(hash, setAncestors);
+        BOOST_FOREACH (const uint256& ancestor, setAncestors) {
+            if (!setRemove.count(ancestor)) {
+                setUpdateDescendants.insert(ancestor);
+                fOutsideAncestors = true;
+            }
+        }
+    }
+    BOOST_FOREACH (const uint256& hash, setRemove) {
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        txiter it = mapTx.find(hash);
+        BOOST_FOREACH (const uint256& descendant, setDescendants) {
+            if (setRemove.count(descendant))
+                continue;
+            if (fOutsideAncestors) {
+                setUpdateAncestors.insert(descendant);
+            } else {
+                // Common case of a transaction confirmed in a block: the remaining
+                // descendants lose exactly the removed transactions as ancestors
+                txiter itDesc = mapTx.find(descendant);
+                mapTx.modify(itDesc, update_ancestor_state(itDesc->GetCountWithAncestors() - 1,
+                                                           itDesc->GetSizeWithAncestors() - it->GetTxSize(),
+                                                           itDesc->GetModFeesWithAncestors() - it->GetModifiedFee()));
+            }
+        }
+    }
+
+    // Report parents before their children
+    std::vector<std::pair<uint64_t, txiter> > vRemove;
+    BOOST_FOREACH (const uint256& hash, setRemove) {
+        txiter it = mapTx.find(hash);
+        vRemove.push_back(std::make_pair(it->GetCountWithAncestors(), it));
+    }
+    std::sort(vRemove.begin(), vRemove.end(), CompareRemoveOrder());
+
+    for (unsigned int i = 0; i < vRemove.size(); i++) {
+        txiter it = vRemove[i].second;
+        const uint256 hash = it->GetTx().GetHash();
+        const CTransaction& tx = it->GetTx();
+
+        const TxLinks& links = mapLinks[hash];
+        BOOST_FOREACH (const uint256& parent, links.parents)
+            mapLinks[parent].children.erase(hash);
+        BOOST_FOREACH (const uint256& child, links.children)
+            mapLinks[child].parents.erase(hash);
+        mapLinks.erase(hash);
+
+        BOOST_FOREACH (const CTxIn& txin, tx.vin)
+            mapNextTx.erase(txin.prevout);
+
+        removed.push_back(tx);
+        totalTxSize -= it->GetTxSize();
+        cachedInnerUsage -= it->DynamicMemoryUsage();
+        mapTx.erase(it);
+        nTransactionsUpdated++;
+    }
+
+    BOOST_FOREACH (const uint256& hash, setUpdateDescendants)
+        UpdateDescendantState(mapTx.find(hash));
+    BOOST_FOREACH (const uint256& hash, setUpdateAncestors)
+        UpdateAncestorState(mapTx.find(hash));
+}
+
+void CTxMemPool::RemoveRecursive(const std::set<uint256>& setRoots, std::list<CTransaction>& removed)
+{
+    std::set<uint256> setRemove;
+    BOOST_FOREACH (const uint256& hash, setRoots) {
+        if (!mapTx.count(hash))
+            continue;
+        setRemove.insert(hash);
+        CalculateDescendants(hash, setRemove);
+    }
+    RemoveStaged(setRemove, removed);
+}
 
 void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        std::deque<uint256> txToRemove;
-        txToRemove.push_back(origTx.GetHash());
-        if (fRecursive && !mapTx.count(origTx.GetHash())) {
+        std::set<uint256> setRemove;
+        if (mapTx.count(origTx.GetHash())) {
+            setRemove.insert(origTx.GetHash());
+        } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
             // happen during chain re-orgs if origTx isn't re-accepted into
@@ -438,31 +684,13 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
                 std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
-                txToRemove.push_back(it->second.ptx->GetHash());
+                setRemove.insert(it->second.ptx->GetHash());
             }
         }
-        while (!txToRemove.empty()) {
-            uint256 hash = txToRemove.front();
-            txToRemove.pop_front();
-            if (!mapTx.count(hash))
-                continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
-            if (fRecursive) {
-                for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
-                    if (it == mapNextTx.end())
-                        continue;
-                    txToRemove.push_back(it->second.ptx->GetHash());
-                }
-            }
-            BOOST_FOREACH (const CTxIn& txin, tx.vin)
-                mapNextTx.erase(txin.prevout);
-
-            removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
-        }
+        if (fRecursive)
+            RemoveRecursive(setRemove, removed);
+        else
+            RemoveStaged(setRemove, removed);
     }
 }
 
@@ -471,10 +699,10 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTransaction& tx = it->GetTx();
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end())
                 continue;
             const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
@@ -515,9 +743,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
     BOOST_FOREACH (const CTransaction& tx, vtx) {
-        uint256 hash = tx.GetHash();
-        if (mapTx.count(hash))
-            entries.push_back(mapTx[hash]);
+        indexed_transaction_set::const_iterator it = mapTx.find(tx.GetHash());
+        if (it != mapTx.end())
+            entries.push_back(*it);
     }
     minerPolicyEstimator->seenBlock(entries, nBlockHeight, minRelayFee);
     BOOST_FOREACH (const CTransaction& tx, vtx) {
@@ -534,7 +762,11 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapLinks.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
+    lastRollingFeeUpdate = 0;
+    rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
 }
 
@@ -551,16 +783,16 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
-        checkTotal += it->second.GetTxSize();
-        const CTransaction& tx = it->second.GetTx();
+        checkTotal += it->GetTxSize();
+        const CTransaction& tx = it->GetTx();
         bool fDependsWait = false;
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
-                const CTransaction& tx2 = it2->second.GetTx();
+                const CTransaction& tx2 = it2->GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
             } else {
@@ -575,7 +807,7 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
             i++;
         }
         if (fDependsWait)
-            waitingOnDependants.push_back(&it->second);
+            waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
             CTxUndo undo;
@@ -601,14 +833,59 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
     }
     for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
-        const CTransaction& tx = it2->second.GetTx();
+        indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         assert(it2 != mapTx.end());
+        const CTransaction& tx = it2->GetTx();
         assert(&tx == it->second.ptx);
         assert(tx.vin.size() > it->second.n);
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
+    // Package links and ancestor / descendant totals must match the transactions' inputs
+    uint64_t checkUsage = 0;
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const uint256& hash = it->GetTx().GetHash();
+        checkUsage += it->DynamicMemoryUsage();
+        std::set<uint256> setParents;
+        if (!it->GetTx().IsZerocoinSpend()) {
+            BOOST_FOREACH (const CTxIn& txin, it->GetTx().vin) {
+                if (mapTx.count(txin.prevout.hash))
+                    setParents.insert(txin.prevout.hash);
+            }
+        }
+        std::map<uint256, TxLinks>::const_iterator itLinks = mapLinks.find(hash);
+        assert(itLinks != mapLinks.end());
+        assert(itLinks->second.parents == setParents);
+        BOOST_FOREACH (const uint256& child, itLinks->second.children)
+            assert(mapLinks.find(child)->second.parents.count(hash));
+
+        std::set<uint256> setAncestors;
+        CalculateAncestors(hash, setAncestors);
+        uint64_t nSize = it->GetTxSize();
+        CAmount nModFees = it->GetModifiedFee();
+        BOOST_FOREACH (const uint256& ancestor, setAncestors) {
+            nSize += mapTx.find(ancestor)->GetTxSize();
+            nModFees += mapTx.find(ancestor)->GetModifiedFee();
+        }
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSize);
+        assert(it->GetModFeesWithAncestors() == nModFees);
+
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        nSize = it->GetTxSize();
+        nModFees = it->GetModifiedFee();
+        BOOST_FOREACH (const uint256& descendant, setDescendants) {
+            nSize += mapTx.find(descendant)->GetTxSize();
+            nModFees += mapTx.find(descendant)->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(it->GetSizeWithDescendants() == nSize);
+        assert(it->GetModFeesWithDescendants() == nModFees);
+    }
+    assert(mapLinks.size() == mapTx.size());
+    assert(cachedInnerUsage == checkUsage);
+
     assert(totalTxSize == checkTotal);
 }
 
@@ -618,8 +895,8 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        vtxid.push_back((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        vtxid.push_back(mi->GetTx().GetHash());
 }
 
 void CTxMemPool::getTransactions(std::set<uint256>& setTxid)
@@ -627,16 +904,16 @@ void CTxMemPool::getTransactions(std::set<uint256>& setTxid)
     setTxid.clear();
 
     LOCK(cs);
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
-        setTxid.insert((*mi).first);
+    for (indexed_transaction_set::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+        setTxid.insert(mi->GetTx().GetHash());
 }
 
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
-    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
-    result = i->second.GetTx();
+    result = i->GetTx();
     return true;
 }
 
@@ -689,6 +966,21 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            mapTx.modify(it, update_fee_delta(deltas.second));
+            UpdateAncestorState(it);
+            UpdateDescendantState(it);
+            std::set<uint256> setRelatives;
+            CalculateAncestors(hash, setRelatives);
+            BOOST_FOREACH (const uint256& ancestor, setRelatives)
+                UpdateDescendantState(mapTx.find(ancestor));
+            setRelatives.clear();
+            CalculateDescendants(hash, setRelatives);
+            BOOST_FOREACH (const uint256& descendant, setRelatives)
+                UpdateAncestorState(mapTx.find(descendant));
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -710,6 +1002,82 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
     mapDeltas.erase(hash);
 }
 
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return cachedInnerUsage;
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (rollingMinimumFeeRate == 0)
+        return CFeeRate(0);
+
+    int64_t nNow = GetTime();
+    if (nNow > lastRollingFeeUpdate + 10) {
+        // Decay faster the further the pool is below its limit
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (cachedInnerUsage < sizelimit / 4)
+            halflife /= 4;
+        else if (cachedInnerUsage < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (nNow - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = nNow;
+
+        if (rollingMinimumFeeRate < (double)minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate((CAmount)rollingMinimumFeeRate), minRelayFee);
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && cachedInnerUsage > sizelimit) {
+        indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
+
+        // Replacements for the evicted package have to pay at least one
+        // relay fee increment more than it did
+        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minRelayFee.GetFeePerK());
+        if (removed.GetFeePerK() > rollingMinimumFeeRate) {
+            rollingMinimumFeeRate = removed.GetFeePerK();
+            lastRollingFeeUpdate = GetTime();
+        }
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+        std::set<uint256> setRoots;
+        setRoots.insert(it->GetTx().GetHash());
+        std::list<CTransaction> removedTxs;
+        RemoveRecursive(setRoots, removedTxs);
+        nTxnRemoved += removedTxs.size();
+    }
+
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    std::set<uint256> setRoots;
+    indexed_transaction_set::index<entry_time>::type::iterator it = mapTx.get<entry_time>().begin();
+    while (it != mapTx.get<entry_time>().end() && it->GetTime() < time) {
+        setRoots.insert(it->GetTx().GetHash());
+        it++;
+    }
+    std::list<CTransaction> removed;
+    RemoveRecursive(setRoots, removed);
+    return removed.size();
+}
+
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) {}
 
@@ -8,12 +8,17 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -42,9 +47,21 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and approximate memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta;    //! Fee delta set by PrioritiseTransaction
+
+    //! Totals over this transaction and all its in-mempool ancestors
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    //! Totals over this transaction and all its in-mempool descendants
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -55,10 +72,134 @@ public:
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    void SetFeeDelta(const CAmount& nDelta) { nFeeDelta = nDelta; }
+    void SetAncestorState(uint64_t nCount, uint64_t nSize, const CAmount& nModFees);
+    void SetDescendantState(uint64_t nCount, uint64_t nSize, const CAmount& nModFees);
+};
+
+/** Modifiers for entries inside mapTx, which may only be changed through modify() */
+struct update_fee_delta {
+    update_fee_delta(const CAmount& _nFeeDelta) : nFeeDelta(_nFeeDelta) {}
+    void operator()(CTxMemPoolEntry& e) { e.SetFeeDelta(nFeeDelta); }
+
+private:
+    CAmount nFeeDelta;
+};
+
+struct update_ancestor_state {
+    update_ancestor_state(uint64_t _nCount, uint64_t _nSize, const CAmount& _nModFees) : nCount(_nCount), nSize(_nSize), nModFees(_nModFees) {}
+    void operator()(CTxMemPoolEntry& e) { e.SetAncestorState(nCount, nSize, nModFees); }
+
+private:
+    uint64_t nCount;
+    uint64_t nSize;
+    CAmount nModFees;
+};
+
+struct update_descendant_state {
+    update_descendant_state(uint64_t _nCount, uint64_t _nSize, const CAmount& _nModFees) : nCount(_nCount), nSize(_nSize), nModFees(_nModFees) {}
+    void operator()(CTxMemPoolEntry& e) { e.SetDescendantState(nCount, nSize, nModFees); }
+
+private:
+    uint64_t nCount;
+    uint64_t nSize;
+    CAmount nModFees;
+};
+
+/** Extracts the txid of a mempool entry, the primary key of mapTx */
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Orders mempool entries by the higher of their own fee rate and the fee rate
+ * of the entry together with its in-mempool descendants, lowest first. The
+ * start of this index is what gets evicted when the mempool is full: a
+ * transaction is only as cheap as the best package it is part of.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        // Strict on ties as well, the older entry first
+        if (f1 == f2)
+            return a.GetTime() < b.GetTime();
+        return f1 < f2;
+    }
+
+    /** Whether the descendant package pays a higher fee rate than the entry alone */
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** Orders mempool entries by the time they entered the pool, oldest first */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+/**
+ * Orders mempool entries by the fee rate of the package formed by the entry and
+ * its in-mempool ancestors, highest first, so the block template can take whole
+ * packages in a single walk.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        // Compare fees / size without dividing: a.fee * b.size vs b.fee * a.size
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
 };
 
+// Multi_index tag names
+struct descendant_score {};
+struct entry_time {};
+struct ancestor_score {};
+
 class CMinerPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -101,13 +242,50 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of the dynamic memory usage of all entries
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable double rollingMinimumFeeRate; //! minimum fee per kB to get into the pool after TrimToSize
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; //! seconds to halve the minimum fee after evictions
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // sorted by fee rate with descendants, cheapest first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore>,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime>,
+            // sorted by fee rate with ancestors, best first
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee> > >
+        indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    /** In-mempool parents and children of a mempool transaction */
+    struct TxLinks {
+        std::set<uint256> parents;
+        std::set<uint256> children;
+    };
+    std::map<uint256, TxLinks> mapLinks;
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -137,6 +315,26 @@ public:
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /** Collect the in-mempool ancestors / descendants of a mempool transaction, excluding itself */
+    void CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const;
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+
+    /**
+     * The minimum fee rate to get into the mempool. It is raised above the fee
+     * rate of packages evicted by TrimToSize and decays back to zero, so that
+     * evicted transactions are not immediately accepted and evicted again.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /** Evict the packages with the lowest descendant score until the mempool uses at most sizelimit bytes */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove transactions that entered the mempool before time, and their descendants. Returns the number removed. */
+    int Expire(int64_t time);
+
+    /** Approximate memory usage of the mempool in bytes */
+    size_t DynamicMemoryUsage() const;
+
     unsigned long size()
     {
         LOCK(cs);
@@ -165,6 +363,15 @@ public:
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
+
+private:
+    /** Recompute the ancestor / descendant totals of an entry from mapLinks */
+    void UpdateAncestorState(txiter it);
+    void UpdateDescendantState(txiter it);
+
+    /** Remove a set of transactions, or the transactions and all their descendants, as one batch */
+    void RemoveRecursive(const std::set<uint256>& setRoots, std::list<CTransaction>& removed);
+    void RemoveStaged(const std::set<uint256>& setRemove, std::list<CTransaction>& removed);
 };
 
 /** 
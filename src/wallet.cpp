@@ -120,6 +120,8 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey& pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    // outputs already in the wallet may pay to the new key
+    fWalletCoinsDirty = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -173,6 +175,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    fStakeCandidatesDirty = true;
+    fWalletCoinsDirty = true;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -198,6 +202,7 @@ bool CWallet::AddWatchOnly(const CScript& dest)
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
+    fWalletCoinsDirty = true;
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
         return true;
@@ -209,6 +214,9 @@ bool CWallet::RemoveWatchOnly(const CScript& dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    // outputs to dest may have become spendable, or no longer ours
+    fStakeCandidatesDirty = true;
+    fWalletCoinsDirty = true;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -638,6 +646,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet)
             item.second.MarkDirty();
+        // keys or scripts may have been imported
+        fWalletCoinsDirty = true;
     }
 }
 
@@ -696,6 +706,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        AddStakeCandidates(wtx);
+        AddWalletCoins(wtx);
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -732,6 +745,31 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
     return false;
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    // The cached witnesses only change when a new accumulator checkpoint is added
+    if (!zmasterWitnessCache || !pindex->pprev || pindex->nAccumulatorCheckpoint == pindex->pprev->nAccumulatorCheckpoint)
+        return;
+
+    set<uint256> setPubcoinsUnspent;
+    map<uint256, uint256> mapMintTx; //pubcoinhash, txid of mint
+    LOCK2(cs_main, cs_wallet);
+    for (const CMintMeta& meta : zmasterTracker->ListMints(true, false, false)) {
+        setPubcoinsUnspent.insert(meta.hashPubcoin);
+        mapMintTx[meta.hashPubcoin] = meta.txid;
+    }
+
+    // Start a witness for every confirmed mint that has none yet, so that the advance below
+    // carries it along and the first spend or stake of an old mint does not walk the whole chain
+    for (const uint256& hashPubcoin : zmasterWitnessCache->GetMissing(setPubcoinsUnspent)) {
+        CAccumulatorWitnessState state;
+        if (InitAccumulatorWitnessState(hashPubcoin, mapMintTx.at(hashPubcoin), state))
+            zmasterWitnessCache->Update(state);
+    }
+
+    zmasterWitnessCache->Advance(pindex, setPubcoinsUnspent);
+}
+
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
@@ -742,8 +780,12 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     // available of the outputs it spends. So force those to be
     // recomputed, also:
     BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-        if (!tx.IsZerocoinSpend() && mapWallet.count(txin.prevout.hash))
-            mapWallet[txin.prevout.hash].MarkDirty();
+        if (!tx.IsZerocoinSpend() && mapWallet.count(txin.prevout.hash)) {
+            CWalletTx& wtxPrev = mapWallet[txin.prevout.hash];
+            wtxPrev.MarkDirty();
+            AddStakeCandidates(wtxPrev);
+            AddWalletCoins(wtxPrev);
+        }
     }
 }
 
@@ -753,6 +795,10 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
+        mapStakeCandidates.erase(mapStakeCandidates.lower_bound(COutPoint(hash, 0)),
+                                 mapStakeCandidates.upper_bound(COutPoint(hash, std::numeric_limits<uint32_t>::max())));
+        mapWalletCoins.erase(mapWalletCoins.lower_bound(COutPoint(hash, 0)),
+                             mapWalletCoins.upper_bound(COutPoint(hash, std::numeric_limits<uint32_t>::max())));
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -1426,6 +1472,63 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+bool CWalletScanFilter::IsRelevant(const CScript& scriptPubKey) const
+{
+    if (setScriptPubKeys.count(scriptPubKey))
+        return true;
+
+    vector<valtype> vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+
+    switch (whichType) {
+    case TX_ZEROCOINMINT:
+    case TX_PUBKEY:
+        return setKeys.count(CPubKey(vSolutions[0]).GetID()) > 0;
+    case TX_PUBKEYHASH:
+        return setKeys.count(CKeyID(uint160(vSolutions[0]))) > 0;
+    case TX_SCRIPTHASH:
+        return setScripts.count(CScriptID(uint160(vSolutions[0]))) > 0;
+    case TX_MULTISIG:
+        for (unsigned int i = 1; i + 1 < vSolutions.size(); i++) {
+            if (setKeys.count(CPubKey(vSolutions[i]).GetID()))
+                return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+std::vector<unsigned int> CWalletScanFilter::MatchBlock(const CBlock& block, const std::vector<bool>& vOutputMatch, std::set<uint256>& setWalletTxes)
+{
+    // A match counts at once, so that a later transaction of the block spending it matches too
+    std::vector<unsigned int> vMatches;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        bool fMatch = vOutputMatch[i] || setWalletTxes.count(tx.GetHash());
+        for (unsigned int j = 0; !fMatch && j < tx.vin.size(); j++)
+            fMatch = setWalletTxes.count(tx.vin[j].prevout.hash) > 0;
+        if (fMatch) {
+            vMatches.push_back(i);
+            setWalletTxes.insert(tx.GetHash());
+        }
+    }
+    return vMatches;
+}
+
+void CWallet::GetScanFilter(CWalletScanFilter& filter) const
+{
+    GetKeys(filter.setKeys);
+
+    LOCK(cs_KeyStore);
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        filter.setScripts.insert(it->first);
+    filter.setScriptPubKeys.insert(setWatchOnly.begin(), setWatchOnly.end());
+    filter.setScriptPubKeys.insert(setMultiSig.begin(), setMultiSig.end());
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1440,83 +1543,243 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         zmasterTracker->Init();
 
     CBlockIndex* pindex = pindexStart;
+    CWalletScanFilter filter;
+    set<uint256> setWalletTxes;
+    double dProgressStart = 0, dProgressTip = 0;
     {
         LOCK2(cs_main, cs_wallet);
+        fStakeCandidatesDirty = true;
+        fWalletCoinsDirty = true;
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)) && pindex->nHeight <= Params().Zerocoin_StartHeight())
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+        // Outputs are matched against a snapshot of the keystore and inputs
+        // against the transactions known to the wallet, so blocks can be read
+        // and matched without holding either lock
+        GetScanFilter(filter);
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            setWalletTxes.insert(it->first);
+
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+
+    // Blocks are queued in chain order into a ring of slots, read from disk
+    // and matched by the reader threads in any order, and added to the wallet
+    // by this thread in chain order again. Only blocks with a possible match
+    // take cs_main and cs_wallet.
+    struct CRescanBlock {
+        CBlockIndex* pindex;
+        CBlock block;
+        vector<uint256> vTxHash;
+        //! per transaction: one of its outputs passed the filter
+        vector<bool> vOutputMatch;
+        bool fHasMints;
+        bool fReady;
+    };
+    int nThreads = GetArg("-rescanthreads", DEFAULT_RESCANTHREADS);
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    nThreads = std::max(1, nThreads);
+    vector<CRescanBlock> vSlots(nThreads * RESCAN_BLOCKS_PER_THREAD);
+    uint64_t nQueued = 0, nRead = 0, nAdded = 0;
+    bool fQuit = false;
+    boost::mutex csSlots;
+    boost::condition_variable condQueued, condReady;
+
+    auto reader = [&]() {
+        while (true) {
+            CRescanBlock* pslot;
+            {
+                boost::unique_lock<boost::mutex> lock(csSlots);
+                while (!fQuit && nRead == nQueued)
+                    condQueued.wait(lock);
+                if (fQuit)
+                    return;
+                pslot = &vSlots[nRead++ % vSlots.size()];
+            }
+
+            CRescanBlock& slot = *pslot;
+            try {
+                slot.block.SetNull();
+                ReadBlockFromDisk(slot.block, slot.pindex);
+                slot.vTxHash.resize(slot.block.vtx.size());
+                slot.vOutputMatch.assign(slot.block.vtx.size(), false);
+                slot.fHasMints = false;
+                for (unsigned int i = 0; i < slot.block.vtx.size(); i++) {
+                    const CTransaction& tx = slot.block.vtx[i];
+                    slot.vTxHash[i] = tx.GetHash();
+                    slot.fHasMints |= tx.IsZerocoinMint();
+                    for (const CTxOut& txout : tx.vout) {
+                        if (filter.IsRelevant(txout.scriptPubKey)) {
+                            slot.vOutputMatch[i] = true;
+                            break;
+                        }
+                    }
+                }
+            } catch (const std::exception& e) {
+                // The block is then scanned as empty, like one that failed to read
+                LogPrintf("%s : reading block %d failed: %s\n", __func__, slot.pindex->nHeight, e.what());
+                slot.block.SetNull();
+                slot.vTxHash.clear();
+                slot.vOutputMatch.clear();
+                slot.fHasMints = false;
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(csSlots);
+                slot.fReady = true;
+            }
+            condReady.notify_one();
+        }
+    };
+
+    boost::thread_group threads;
+    // Stops and joins the readers however the scan below is left
+    auto stopReaders = [&]() {
+        {
+            boost::unique_lock<boost::mutex> lock(csSlots);
+            fQuit = true;
+        }
+        condQueued.notify_all();
+        threads.join_all();
+    };
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(reader);
+
+    try {
+
         set<uint256> setAddedToWallet;
-        while (pindex) {
+        CBlockIndex* pindexLastQueued = NULL;
+        while (true) {
+            // Keep the ring filled, taking cs_main once per half ring
+            if (nQueued - nAdded <= vSlots.size() / 2) {
+                vector<CBlockIndex*> vQueue;
+                {
+                    LOCK(cs_main);
+                    CBlockIndex* pindexNext = pindex;
+                    if (pindexLastQueued) {
+                        // after a reorg continue on the new branch, the wallet
+                        // is notified about the blocks connected there anyway
+                        const CBlockIndex* pindexFork = chainActive.FindFork(pindexLastQueued);
+                        pindexNext = pindexFork ? chainActive.Next(pindexFork) : NULL;
+                    }
+                    while (pindexNext && nQueued + vQueue.size() - nAdded < vSlots.size()) {
+                        vQueue.push_back(pindexNext);
+                        pindexNext = chainActive.Next(pindexNext);
+                    }
+                }
+                if (!vQueue.empty()) {
+                    boost::unique_lock<boost::mutex> lock(csSlots);
+                    for (CBlockIndex* pindexQueue : vQueue) {
+                        CRescanBlock& slot = vSlots[nQueued++ % vSlots.size()];
+                        slot.pindex = pindexQueue;
+                        slot.fReady = false;
+                    }
+                    pindexLastQueued = vQueue.back();
+                    condQueued.notify_all();
+                }
+            }
+            if (nAdded == nQueued)
+                break;
+
+            CRescanBlock& slot = vSlots[nAdded % vSlots.size()];
+            {
+                boost::unique_lock<boost::mutex> lock(csSlots);
+                while (!slot.fReady)
+                    condReady.wait(lock);
+            }
+            pindex = slot.pindex;
+            const CBlock& block = slot.block;
+
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
+            vector<unsigned int> vMatches = CWalletScanFilter::MatchBlock(block, slot.vOutputMatch, setWalletTxes);
+            bool fMints = fCheckZMASTER && slot.fHasMints && pindex->nHeight >= Params().Zerocoin_StartHeight();
+
+            if (!vMatches.empty() || fMints) {
+                LOCK2(cs_main, cs_wallet);
+                // A block queued before a reorg may have left the chain since; the
+                // wallet is notified about the blocks of the new branch anyway
+                bool fActive = chainActive.Contains(pindex);
+                fMints &= fActive;
+                CWalletBatch walletBatch(this);
+                for (unsigned int i : vMatches) {
+                    if (fActive && AddToWalletIfInvolvingMe(block.vtx[i], &block, fUpdate))
+                        ret++;
+                    if (!mapWallet.count(slot.vTxHash[i]))
+                        setWalletTxes.erase(slot.vTxHash[i]);
+                }
 
-            //If this is a zapwallettx, need to readd zmaster
-            if (fCheckZMASTER&& pindex->nHeight >= Params().Zerocoin_StartHeight()) {
-                list<CZerocoinMint> listMints;
-                BlockToZerocoinMintList(block, listMints, true);
-
-                for (auto& m : listMints) {
-                    if (IsMyMint(m.GetValue())) {
-                        LogPrint("zero", "%s: found mint\n", __func__);
-                        pwalletMain->UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
-
-                        // Add the transaction to the wallet
-                        for (auto& tx : block.vtx) {
-                            uint256 txid = tx.GetHash();
-                            if (setAddedToWallet.count(txid) || mapWallet.count(txid))
-                                continue;
-                            if (txid == m.GetTxHash()) {
-                                CWalletTx wtx(pwalletMain, tx);
-                                wtx.nTimeReceived = block.GetBlockTime();
-                                wtx.SetMerkleBranch(block);
-                                pwalletMain->AddToWallet(wtx);
-                                setAddedToWallet.insert(txid);
+                //If this is a zapwallettx, need to readd zmaster
+                if (fMints) {
+                    list<CZerocoinMint> listMints;
+                    BlockToZerocoinMintList(block, listMints, true);
+
+                    for (auto& m : listMints) {
+                        if (IsMyMint(m.GetValue())) {
+                            LogPrint("zero", "%s: found mint\n", __func__);
+                            pwalletMain->UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
+
+                            // Add the transaction to the wallet
+                            for (auto& tx : block.vtx) {
+                                uint256 txid = tx.GetHash();
+                                if (setAddedToWallet.count(txid) || mapWallet.count(txid))
+                                    continue;
+                                if (txid == m.GetTxHash()) {
+                                    CWalletTx wtx(pwalletMain, tx);
+                                    wtx.nTimeReceived = block.GetBlockTime();
+                                    wtx.SetMerkleBranch(block);
+                                    pwalletMain->AddToWallet(wtx);
+                                    setAddedToWallet.insert(txid);
+                                    setWalletTxes.insert(txid);
+                                }
                             }
-                        }
 
-                        //Check if the mint was ever spent
-                        int nHeightSpend = 0;
-                        uint256 txidSpend;
-                        CTransaction txSpend;
-                        if (IsSerialInBlockchain(GetSerialHash(m.GetSerialNumber()), nHeightSpend, txidSpend, txSpend)) {
-                            if (setAddedToWallet.count(txidSpend) || mapWallet.count(txidSpend))
-                                continue;
-
-                            CWalletTx wtx(pwalletMain, txSpend);
-                            CBlockIndex* pindexSpend = chainActive[nHeightSpend];
-                            CBlock blockSpend;
-                            if (ReadBlockFromDisk(blockSpend, pindexSpend))
-                                wtx.SetMerkleBranch(blockSpend);
-
-                            wtx.nTimeReceived = pindexSpend->nTime;
-                            pwalletMain->AddToWallet(wtx);
-                            setAddedToWallet.emplace(txidSpend);
+                            //Check if the mint was ever spent
+                            int nHeightSpend = 0;
+                            uint256 txidSpend;
+                            CTransaction txSpend;
+                            if (IsSerialInBlockchain(GetSerialHash(m.GetSerialNumber()), nHeightSpend, txidSpend, txSpend)) {
+                                if (setAddedToWallet.count(txidSpend) || mapWallet.count(txidSpend))
+                                    continue;
+
+                                CWalletTx wtx(pwalletMain, txSpend);
+                                CBlockIndex* pindexSpend = chainActive[nHeightSpend];
+                                CBlock blockSpend;
+                                if (ReadBlockFromDisk(blockSpend, pindexSpend))
+                                    wtx.SetMerkleBranch(blockSpend);
+
+                                wtx.nTimeReceived = pindexSpend->nTime;
+                                pwalletMain->AddToWallet(wtx);
+                                setAddedToWallet.emplace(txidSpend);
+                                setWalletTxes.insert(txidSpend);
+                            }
                         }
                     }
                 }
             }
 
-            pindex = chainActive.Next(pindex);
+            slot.block.SetNull();
+            nAdded++;
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+    } catch (...) {
+        stopReaders();
+        throw;
     }
+    stopReaders();
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1626,9 +1889,7 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1676,9 +1937,7 @@ CAmount CWallet::GetUnlockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetUnlockedCredit();
         }
@@ -1694,9 +1953,7 @@ CAmount CWallet::GetLockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedCredit();
         }
@@ -1728,9 +1985,7 @@ CAmount CWallet::GetAnonymizableBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizableCredit();
         }
@@ -1746,9 +2001,7 @@ CAmount CWallet::GetAnonymizedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizedCredit();
         }
@@ -1768,10 +2021,8 @@ double CWallet::GetAverageAnonymizedRounds() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 CTxIn vin = CTxIn(hash, i);
@@ -1800,10 +2051,8 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 CTxIn vin = CTxIn(hash, i);
@@ -1827,9 +2076,7 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             nTotal += pcoin->GetDenominatedCredit(unconfirmed);
         }
     }
@@ -1842,8 +2089,7 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1856,8 +2102,7 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1869,8 +2114,7 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1884,8 +2128,7 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1898,8 +2141,7 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1911,8 +2153,7 @@ CAmount CWallet::GetLockedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetWalletCoinTxes()) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedWatchOnlyCredit();
         }
@@ -1929,78 +2170,76 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
+        const CWalletTx* pcoinLast = NULL;
+        bool fSkipTx = false;
+        int nDepth = 0;
+        for (const std::pair<const COutPoint, CWalletCoin>& entry : GetWalletCoins()) {
+            const uint256& wtxid = entry.first.hash;
+            const unsigned int i = entry.first.n;
+            const CWalletCoin& coin = entry.second;
+            const CWalletTx* pcoin = coin.pwtx;
+
+            // the index is ordered by outpoint, so the outputs of a transaction are visited together
+            if (pcoin != pcoinLast) {
+                pcoinLast = pcoin;
+                nDepth = pcoin->GetDepthInMainChain(false);
+                fSkipTx = !CheckFinalTx(*pcoin) ||
+                          (fOnlyConfirmed && !pcoin->IsTrusted()) ||
+                          ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0) ||
+                          // do not use IX for inputs that have less then 6 blockchain confirmations
+                          (fUseIX && nDepth < 6) ||
+                          // We should not consider coins which aren't at least in our mempool
+                          // It's possible for these to be conflicted via ancestors which we may never be able to detect
+                          (nDepth == 0 && !pcoin->InMempool());
+            }
+            if (fSkipTx)
                 continue;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+            bool found = false;
+            if (nCoinType == ONLY_DENOMINATED) {
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if (nCoinType == ONLY_NOT1000IFMN) {
+                found = !(fMasterNode && pcoin->vout[i].nValue == GetCurrentCollateral() * COIN);
+            } else if (nCoinType == ONLY_NONDENOMINATED_NOT1000IFMN) {
+                if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if (found && fMasterNode) found = pcoin->vout[i].nValue != GetCurrentCollateral() * COIN; // do not use Hot MN funds
+            } else if (nCoinType == ONLY_1000) {
+                found = pcoin->vout[i].nValue == GetCurrentCollateral() * COIN;
+            } else {
+                found = true;
+            }
+            if (!found) continue;
 
-            if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+            if (nCoinType == STAKABLE_COINS) {
+                if (pcoin->vout[i].IsZerocoinMint())
+                    continue;
+            }
 
-            int nDepth = pcoin->GetDepthInMainChain(false);
-            // do not use IX for inputs that have less then 6 blockchain confirmations
-            if (fUseIX && nDepth < 6)
+            isminetype mine = coin.mine;
+            if (IsSpent(wtxid, i))
                 continue;
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
+            if ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if (nCoinType == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if (nCoinType == ONLY_NOT1000IFMN) {
-                    found = !(fMasterNode && pcoin->vout[i].nValue == GetCurrentCollateral() * COIN);
-                } else if (nCoinType == ONLY_NONDENOMINATED_NOT1000IFMN) {
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if (found && fMasterNode) found = pcoin->vout[i].nValue != GetCurrentCollateral() * COIN; // do not use Hot MN funds
-                } else if (nCoinType == ONLY_1000) {
-                    found = pcoin->vout[i].nValue == GetCurrentCollateral() * COIN;
-                } else {
-                    found = true;
-                }
-                if (!found) continue;
-
-                if (nCoinType == STAKABLE_COINS) {
-                    if (pcoin->vout[i].IsZerocoinMint())
-                        continue;
-                }
-
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (IsSpent(wtxid, i))
-                    continue;
-                if (mine == ISMINE_NO)
-                    continue;
-
-                if ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2)
-                    continue;
-
-                if (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1)
-                    continue;
+            if (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1)
+                continue;
 
-                if (IsLockedCoin((*it).first, i) && nCoinType != ONLY_1000)
-                    continue;
-                if (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue)
-                    continue;
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
-                    continue;
+            if (coin.fLocked && nCoinType != ONLY_1000)
+                continue;
+            if (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue)
+                continue;
+            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
+                continue;
 
-                bool fIsSpendable = false;
-                if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
-                    fIsSpendable = true;
-                if ((mine & ISMINE_MULTISIG) != ISMINE_NO)
-                    fIsSpendable = true;
+            bool fIsSpendable = false;
+            if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
+                fIsSpendable = true;
+            if ((mine & ISMINE_MULTISIG) != ISMINE_NO)
+                fIsSpendable = true;
 
-                vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
-            }
+            vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
         }
     }
 }
@@ -2064,57 +2303,228 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*, un
     }
 }
 
+/**
+ * Depth first search for a subset of vValue, sorted by descending value, that
+ * adds up to exactly nTargetValue. Each coin is first included, then left out;
+ * a branch is cut as soon as it overshoots or the remaining coins cannot reach
+ * the target. Gives up after nMaxTries steps.
+ */
+bool CWallet::SelectCoinsExact(const vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTargetValue, vector<char>& vfBest, int nMaxTries)
+{
+    // vRemaining[i] is the value of coins i and up
+    vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    for (int i = vValue.size() - 1; i >= 0; i--)
+        vRemaining[i] = vRemaining[i + 1] + vValue[i].first;
+    if (vRemaining[0] < nTargetValue)
+        return false;
+
+    vector<char> vfIncluded(vValue.size(), false);
+    vector<unsigned int> vIncluded;
+    CAmount nTotal = 0;
+    unsigned int i = 0;
+    for (int nTries = 0; nTries < nMaxTries; nTries++) {
+        if (nTotal == nTargetValue) {
+            vfBest = vfIncluded;
+            return true;
+        }
+        if (nTotal > nTargetValue || i == vValue.size() || nTotal + vRemaining[i] < nTargetValue) {
+            if (vIncluded.empty())
+                return false;
+            // leave out the last included coin, and the coins of the same
+            // value after it, which would only repeat the same sums
+            unsigned int j = vIncluded.back();
+            vIncluded.pop_back();
+            vfIncluded[j] = false;
+            nTotal -= vValue[j].first;
+            for (i = j + 1; i < vValue.size() && vValue[i].first == vValue[j].first; i++)
+                ;
+            continue;
+        }
+        vfIncluded[i] = true;
+        vIncluded.push_back(i);
+        nTotal += vValue[i].first;
+        i++;
+    }
+    return false;
+}
 
-// TODO: find appropriate place for this sort function
-// move denoms down
-bool less_then_denom(const COutput& out1, const COutput& out2)
+bool CStakeCandidate::UpdateIndexFrom()
 {
-    const CWalletTx* pcoin1 = out1.tx;
-    const CWalletTx* pcoin2 = out2.tx;
+    AssertLockHeld(cs_main);
+    if (pindexFrom && *pindexFrom->phashBlock == pwtx->hashBlock && chainActive.Contains(pindexFrom))
+        return true;
 
-    bool found1 = false;
-    bool found2 = false;
-    BOOST_FOREACH (CAmount d, obfuScationDenominations) // loop through predefined denoms
-    {
-        if (pcoin1->vout[out1.i].nValue == d) found1 = true;
-        if (pcoin2->vout[out2.i].nValue == d) found2 = true;
+    pindexFrom = NULL;
+    pindexModifier = NULL;
+    if (pwtx->hashBlock == 0)
+        return false;
+    BlockMap::iterator mi = mapBlockIndex.find(pwtx->hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+        return false;
+    pindexFrom = mi->second;
+    return true;
+}
+
+bool CStakeCandidate::UpdateStakeModifier()
+{
+    AssertLockHeld(cs_main);
+    // The modifier only depends on the blocks from pindexFrom up to the one
+    // that generated it, so it stays valid while that block is in the chain
+    if (pindexModifier && chainActive.Contains(pindexModifier))
+        return true;
+
+    pindexModifier = NULL;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    if (!pindexFrom || !GetKernelStakeModifier(pindexFrom->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+        return false;
+    pindexModifier = chainActive[nStakeModifierHeight];
+    return true;
+}
+
+void CWallet::AddStakeCandidates(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = wtx.GetHash();
+
+    // outputs spent by wtx can no longer stake
+    if (!wtx.IsZerocoinSpend()) {
+        for (const CTxIn& txin : wtx.vin)
+            mapStakeCandidates.erase(txin.prevout);
     }
-    return (!found1 && found2);
+
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        const CTxOut& txout = wtx.vout[i];
+        COutPoint outpoint(hash, i);
+        if (txout.IsZerocoinMint() || txout.nValue <= 0 || IsSpent(hash, i) ||
+            !(IsMine(txout) & (ISMINE_SPENDABLE | ISMINE_MULTISIG))) {
+            mapStakeCandidates.erase(outpoint);
+            continue;
+        }
+        std::map<COutPoint, CStakeCandidate>::iterator it = mapStakeCandidates.find(outpoint);
+        if (it == mapStakeCandidates.end())
+            it = mapStakeCandidates.insert(make_pair(outpoint, CStakeCandidate(&wtx, i))).first;
+        // the block may have changed, UpdateIndexFrom() notices that
+        it->second.pwtx = &wtx;
+    }
+}
+
+void CWallet::RebuildStakeCandidates()
+{
+    AssertLockHeld(cs_wallet);
+    mapStakeCandidates.clear();
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        AddStakeCandidates(it->second);
+    fStakeCandidatesDirty = false;
+    LogPrint("staking", "%s : %u stake candidates\n", __func__, mapStakeCandidates.size());
+}
+
+void CWallet::AddWalletCoins(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_wallet);
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        COutPoint outpoint(hash, i);
+        isminetype mine = IsMine(wtx.vout[i]);
+        if (mine == ISMINE_NO) {
+            mapWalletCoins.erase(outpoint);
+            continue;
+        }
+        // spent outputs are dropped by GetWalletCoins() once the spender is confirmed
+        std::map<COutPoint, CWalletCoin>::iterator it = mapWalletCoins.find(outpoint);
+        if (it == mapWalletCoins.end())
+            mapWalletCoins.insert(make_pair(outpoint, CWalletCoin(&wtx, mine, setLockedCoins.count(outpoint) > 0)));
+        else
+            it->second.mine = mine;
+    }
+}
+
+const std::map<COutPoint, CWalletCoin>& CWallet::GetWalletCoins() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fWalletCoinsDirty) {
+        mapWalletCoins.clear();
+        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            AddWalletCoins(it->second);
+        fWalletCoinsDirty = false;
+    }
+
+    // An output spent by a confirmed transaction can only become unspent in a
+    // reorg, and SyncTransaction() adds it back when the spender is disconnected
+    std::map<COutPoint, CWalletCoin>::iterator it = mapWalletCoins.begin();
+    while (it != mapWalletCoins.end()) {
+        bool fSpent = false;
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(it->first);
+        for (TxSpends::const_iterator sit = range.first; sit != range.second && !fSpent; ++sit) {
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(sit->second);
+            fSpent = mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) > 0;
+        }
+        if (fSpent)
+            mapWalletCoins.erase(it++);
+        else
+            ++it;
+    }
+    return mapWalletCoins;
+}
+
+std::vector<const CWalletTx*> CWallet::GetWalletCoinTxes() const
+{
+    std::vector<const CWalletTx*> vTxes;
+    for (const std::pair<const COutPoint, CWalletCoin>& entry : GetWalletCoins()) {
+        if (vTxes.empty() || vTxes.back() != entry.second.pwtx)
+            vTxes.push_back(entry.second.pwtx);
+    }
+    return vTxes;
 }
 
 bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount)
 {
-    LOCK(cs_main);
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, false, STAKABLE_COINS);
+    LOCK2(cs_main, cs_wallet);
     CAmount nAmountSelected = 0;
     if (GetBoolArg("-masterstake", true)) {
-        for (const COutput &out : vCoins) {
+        if (fStakeCandidatesDirty)
+            RebuildStakeCandidates();
+
+        for (auto& entry : mapStakeCandidates) {
+            const COutPoint& outpoint = entry.first;
+            CStakeCandidate& candidate = entry.second;
+            const CWalletTx* pcoin = candidate.pwtx;
+            CAmount nValue = pcoin->vout[candidate.nOut].nValue;
+
             //make sure not to outrun target amount
-            if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+            if (nAmountSelected + nValue > nTargetAmount)
+                continue;
+
+            // only outputs in the active chain can stake
+            if (!candidate.UpdateIndexFrom())
+                continue;
+            int nDepth = chainActive.Height() - candidate.pindexFrom->nHeight + 1;
+
+            //check that it is matured
+            if ((pcoin->IsCoinBase() || pcoin->IsCoinStake()) && nDepth < Params().COINBASE_MATURITY() + 1)
+                continue;
+            if (nDepth < (pcoin->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
+                continue;
+
+            if (IsSpent(outpoint.hash, outpoint.n) || IsLockedCoin(outpoint.hash, outpoint.n))
                 continue;
 
             //if zerocoinspend, then use the block time
-            int64_t nTxTime = out.tx->GetTxTime();
-            if (out.tx->IsZerocoinSpend()) {
-                if (!out.tx->IsInMainChain())
-                    continue;
-                nTxTime = mapBlockIndex.at(out.tx->hashBlock)->GetBlockTime();
-            }
+            int64_t nTxTime = pcoin->IsZerocoinSpend() ? candidate.pindexFrom->GetBlockTime() : pcoin->GetTxTime();
 
             //check for min age
             if (GetAdjustedTime() - nTxTime < nStakeMinAge)
                 continue;
 
-            //check that it is matured
-            if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
-                continue;
-
             //add to our stake set
-            nAmountSelected += out.tx->vout[out.i].nValue;
+            nAmountSelected += nValue;
 
             std::unique_ptr<CMasterStake> input(new CMasterStake());
-            input->SetInput((CTransaction) *out.tx, out.i);
+            input->SetInput(*pcoin, candidate.nOut);
+            input->SetIndexFrom(candidate.pindexFrom);
+            if (candidate.UpdateStakeModifier())
+                input->SetModifier(candidate.nStakeModifier);
             listInputs.emplace_back(std::move(input));
         }
     }
@@ -2195,7 +2605,7 @@ bool CWallet::MintableCoins()
     return false;
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
@@ -2207,31 +2617,35 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // The eligible coins, shuffled, with the denominated ones moved down the list
+    vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vEligible;
+    vEligible.reserve(vCoins.size());
+    BOOST_FOREACH (const COutput& output, vCoins) {
+        if (!output.fSpendable)
+            continue;
+
+        const CWalletTx* pcoin = output.tx;
+
+        //            if (fDebug) LogPrint("selectcoins", "value %s confirms %d\n", FormatMoney(pcoin->vout[output.i].nValue), output.nDepth);
+        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+            continue;
 
-    // move denoms down on the list
-    sort(vCoins.begin(), vCoins.end(), less_then_denom);
+        vEligible.push_back(make_pair(pcoin->vout[output.i].nValue, make_pair(pcoin, output.i)));
+    }
+    random_shuffle(vEligible.begin(), vEligible.end(), GetRandInt);
+    unsigned int nNonDenom = stable_partition(vEligible.begin(), vEligible.end(),
+                                 [this](const pair<CAmount, pair<const CWalletTx*, unsigned int> >& coin) { return !IsDenominatedAmount(coin.first); }) -
+                             vEligible.begin();
 
     // try to find nondenom first to prevent unneeded spending of mixed coins
     for (unsigned int tryDenom = 0; tryDenom < 2; tryDenom++) {
         if (fDebug) LogPrint("selectcoins", "tryDenom: %d\n", tryDenom);
         vValue.clear();
         nTotalLower = 0;
-        BOOST_FOREACH (const COutput& output, vCoins) {
-            if (!output.fSpendable)
-                continue;
-
-            const CWalletTx* pcoin = output.tx;
-
-            //            if (fDebug) LogPrint("selectcoins", "value %s confirms %d\n", FormatMoney(pcoin->vout[output.i].nValue), output.nDepth);
-            if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
-                continue;
-
-            int i = output.i;
-            CAmount n = pcoin->vout[i].nValue;
-            if (tryDenom == 0 && IsDenominatedAmount(n)) continue; // we don't want denom values on first run
-
-            pair<CAmount, pair<const CWalletTx*, unsigned int> > coin = make_pair(n, make_pair(pcoin, i));
+        unsigned int nEligible = tryDenom == 0 ? nNonDenom : vEligible.size(); // we don't want denom values on first run
+        for (unsigned int i = 0; i < nEligible; i++) {
+            const pair<CAmount, pair<const CWalletTx*, unsigned int> >& coin = vEligible[i];
+            CAmount n = coin.first;
 
             if (n == nTargetValue) {
                 setCoinsRet.insert(coin.second);
@@ -2272,14 +2686,21 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         break;
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    // Solve subset sum: look for an exact match, which needs no change, then by
+    // stochastic approximation. The stable sort keeps equal values shuffled.
+    stable_sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    if (SelectCoinsExact(vValue, nTargetValue, vfBest)) {
+        nBest = nTargetValue;
+    } else {
+        // each iteration visits every coin up to twice
+        int nIterations = std::max((int64_t)1, std::min((int64_t)1000, COINSELECT_APPROX_MAX_WORK / (2 * (int64_t)vValue.size())));
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, nIterations);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2964,31 +3385,37 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (listInputs.empty())
         return false;
 
-    if (GetAdjustedTime() - chainActive.Tip()->GetBlockTime() < 60)
-        MilliSleep(10000);
+    // Look up the kernel inputs with cs_main held, then hash them on -stakethreads threads
+    unsigned int nSearchTime = GetAdjustedTime();
+    std::vector<CStakeKernelCandidate> vCandidates;
+    {
+        LOCK(cs_main);
+        for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+            CStakeKernelCandidate candidate(stakeInput.get());
+            if (PrepareStakeKernel(candidate, nSearchTime))
+                vCandidates.push_back(candidate);
+        }
+    }
+    int nStakeThreads = GetArg("-stakethreads", DEFAULT_STAKETHREADS);
 
     CAmount nCredit = 0;
     CScript scriptPubKeyKernel;
     bool fKernelFound = false;
-    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+    while (true) {
         // Make sure the wallet is unlocked and shutdown hasn't been requested
         if (IsLocked() || ShutdownRequested())
             return false;
 
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = stakeInput->GetIndexFrom();
-        if (!pindex || pindex->nHeight < 1) {
-            LogPrintf("*** no pindexfrom\n");
-            continue;
-        }
+        int nKernel = FindStakeKernel(vCandidates, nBits, nSearchTime, nStakeThreads);
+        if (nKernel < 0)
+            break;
 
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-        uint256 hashProofOfStake = 0;
-        nTxNewTime = GetAdjustedTime();
+        // each kernel is tried once, a failure below moves on to the remaining candidates
+        vCandidates[nKernel].fSearched = true;
+        CStakeInput* stakeInput = vCandidates[nKernel].stakeInput;
+        nTxNewTime = vCandidates[nKernel].nTimeTx;
 
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (Stake(stakeInput.get(), nBits, block.GetBlockTime(), nTxNewTime, hashProofOfStake)) {
+        {
             LOCK(cs_main);
             //Double check that this will pass time requirements
             if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
@@ -3044,7 +3471,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
             //Mark mints as spent
             if (stakeInput->IsZMASTER()) {
-                CZMasterStake* z = (CZMasterStake*)stakeInput.get();
+                CZMasterStake* z = (CZMasterStake*)stakeInput;
                 if (!z->MarkSpent(this, txNew.GetHash()))
                     return error("%s: failed to mark mint as used\n", __func__);
             }
@@ -3052,8 +3479,6 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             fKernelFound = true;
             break;
         }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
     }
     if (!fKernelFound)
         return false;
@@ -3731,6 +4156,29 @@ void CReserveKey::ReturnKey()
     vchPubKey = CPubKey();
 }
 
+CWalletBatch::CWalletBatch(const CWallet* pwalletIn) : pwallet(pwalletIn), pwalletdb(NULL), fOwner(false)
+{
+    if (!pwallet)
+        return;
+    // Taken before the batch: a thread waiting on cs_wallet must not hold
+    // database locks the batch needs, nor the other way around
+    ENTER_CRITICAL_SECTION(pwallet->cs_wallet);
+    if (pwallet->fFileBacked) {
+        pwalletdb = new CWalletDB(pwallet->strWalletFile);
+        fOwner = pwalletdb->BeginBatch();
+    }
+}
+
+CWalletBatch::~CWalletBatch()
+{
+    if (!pwallet)
+        return;
+    if (fOwner && !pwalletdb->EndBatch())
+        LogPrintf("%s : failed to commit the wallet database batch\n", __func__);
+    delete pwalletdb;
+    LEAVE_CRITICAL_SECTION(pwallet->cs_wallet);
+}
+
 void CWallet::GetAllReserveKeys(set<CKeyID>& setAddress) const
 {
     setAddress.clear();
@@ -3768,18 +4216,26 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    std::map<COutPoint, CWalletCoin>::iterator it = mapWalletCoins.find(output);
+    if (it != mapWalletCoins.end())
+        it->second.fLocked = true;
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    std::map<COutPoint, CWalletCoin>::iterator it = mapWalletCoins.find(output);
+    if (it != mapWalletCoins.end())
+        it->second.fLocked = false;
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    for (std::pair<const COutPoint, CWalletCoin>& entry : mapWalletCoins)
+        entry.second.fLocked = false;
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -4592,10 +5048,15 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
     libzerocoin::AccumulatorWitness witness(paramsAccumulator, accumulator, pubCoinSelected);
     string strFailReason = "";
     int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, pindexCheckpoint)) {
+    CAccumulatorWitnessState witnessState;
+    if (zmasterWitnessCache)
+        zmasterWitnessCache->Get(GetPubCoinHash(zerocoinSelected.GetValue()), witnessState);
+    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, pindexCheckpoint, &witnessState)) {
         receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZMASTER_FAILED_ACCUMULATOR_INITIALIZATION);
         return error("%s : %s", __func__, receipt.GetStatusMessage());
     }
+    if (zmasterWitnessCache)
+        zmasterWitnessCache->Update(witnessState);
 
     // Construct the CoinSpend object. This acts like a signature on the transaction.
     libzerocoin::PrivateCoin privateCoin(paramsCoin, denomination);
@@ -27,8 +27,10 @@
 #include "walletdb.h"
 #include "zmasterwallet.h"
 #include "zmastertracker.h"
+#include "zmasterwitness.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -60,6 +62,18 @@ static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWa
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 //! -custombackupthreshold default
 static const int DEFAULT_CUSTOMBACKUPTHRESHOLD = 1;
+//! -rescanthreads default, 0 = one per core
+static const int DEFAULT_RESCANTHREADS = 0;
+//! Blocks a rescan keeps in flight per reader thread
+static const unsigned int RESCAN_BLOCKS_PER_THREAD = 16;
+//! -mintpoolthreads default, 0 = one per core
+static const int DEFAULT_MINTPOOLTHREADS = 0;
+//! Mints the mint pool derives and databases per batch
+static const size_t MINTPOOL_BATCH_SIZE = 1000;
+//! Search steps the exact match coin selection takes before giving up
+static const int COINSELECT_EXACT_MAX_TRIES = 100000;
+//! Coins the stochastic coin selection visits at most, over all its iterations
+static const int64_t COINSELECT_APPROX_MAX_WORK = 10000000;
 
 // Zerocoin denomination which creates exactly one of each denominations:
 // 6666 = 1*5000 + 1*1000 + 1*500 + 1*100 + 1*50 + 1*10 + 1*5 + 1
@@ -160,6 +174,69 @@ public:
     StringMap destdata;
 };
 
+/**
+ * A wallet output that may be used as a stake kernel, together with the block
+ * index and stake modifier the kernel hash needs. Both are looked up once and
+ * then only revalidated against the active chain.
+ */
+class CStakeCandidate
+{
+public:
+    const CWalletTx* pwtx;
+    unsigned int nOut;
+    //! block containing the output, NULL while it is not in the active chain
+    CBlockIndex* pindexFrom;
+    //! block that generated nStakeModifier, NULL until it is computed
+    const CBlockIndex* pindexModifier;
+    uint64_t nStakeModifier;
+
+    CStakeCandidate(const CWalletTx* pwtxIn, unsigned int nOutIn) : pwtx(pwtxIn), nOut(nOutIn), pindexFrom(NULL), pindexModifier(NULL), nStakeModifier(0) {}
+
+    /** Point pindexFrom at the block of the output if it is in the active chain */
+    bool UpdateIndexFrom();
+    /** Compute the kernel stake modifier unless the cached one is still in the active chain */
+    bool UpdateStakeModifier();
+};
+
+/**
+ * An output of a wallet transaction that belongs to the wallet, with the
+ * ownership and lock state AvailableCoins would otherwise look up per output.
+ */
+class CWalletCoin
+{
+public:
+    const CWalletTx* pwtx;
+    isminetype mine;
+    //! locked with lockunspent or by the masternode and obfuscation code
+    bool fLocked;
+
+    CWalletCoin(const CWalletTx* pwtxIn, isminetype mineIn, bool fLockedIn) : pwtx(pwtxIn), mine(mineIn), fLocked(fLockedIn) {}
+};
+
+/**
+ * Snapshot of the keys and scripts of a wallet, used to match transaction
+ * outputs without holding the keystore lock. It accepts every output IsMine()
+ * accepts, and a few that IsMine() rejects (multisig scripts with only some of
+ * our keys), so matches still have to be confirmed against the wallet.
+ */
+class CWalletScanFilter
+{
+public:
+    std::set<CKeyID> setKeys;
+    std::set<CScriptID> setScripts;
+    //! watch-only and multisig scripts, matched as a whole
+    std::set<CScript> setScriptPubKeys;
+
+    bool IsRelevant(const CScript& scriptPubKey) const;
+
+    /**
+     * The transactions of a block a rescan hands to the wallet: those with an output
+     * flagged in vOutputMatch, those in setWalletTxes and those spending one of them,
+     * including matches earlier in the same block. Adds the matches to setWalletTxes.
+     */
+    static std::vector<unsigned int> MatchBlock(const CBlock& block, const std::vector<bool>& vOutputMatch, std::set<uint256>& setWalletTxes);
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -193,6 +270,33 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Outputs that may be staked, kept up to date as wallet transactions are
+     * added or updated. A superset: spent and locked outputs are filtered out
+     * by SelectStakeCoins, which is cheap compared to scanning mapWallet.
+     */
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates;
+    //! set when mapStakeCandidates must be rebuilt from mapWallet before use
+    std::atomic<bool> fStakeCandidatesDirty;
+    void AddStakeCandidates(const CWalletTx& wtx);
+    void RebuildStakeCandidates();
+
+    /**
+     * Outputs of the wallet that are not spent in the active chain, kept up to
+     * date as wallet transactions are added or updated and coins are locked.
+     * Outputs spent by unconfirmed transactions stay in the index, as the
+     * spender may still be conflicted, and are filtered by IsSpent(). The
+     * balance and coin listing functions only visit the transactions in here
+     * instead of the whole of mapWallet.
+     */
+    mutable std::map<COutPoint, CWalletCoin> mapWalletCoins;
+    //! set when mapWalletCoins must be rebuilt from mapWallet before use
+    mutable std::atomic<bool> fWalletCoinsDirty;
+    void AddWalletCoins(const CWalletTx& wtx) const;
+    const std::map<COutPoint, CWalletCoin>& GetWalletCoins() const;
+    /** The transactions with an output in mapWalletCoins, in txid order */
+    std::vector<const CWalletTx*> GetWalletCoinTxes() const;
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount);
@@ -246,6 +350,7 @@ public:
     std::string strWalletFile;
     bool fBackupMints;
     std::unique_ptr<CzMASTERTracker> zmasterTracker;
+    std::unique_ptr<CzMASTERWitnessCache> zmasterWitnessCache;
 
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
@@ -310,6 +415,8 @@ public:
         nStakeSplitThreshold = 2000;
         nHashInterval = 22;
         nStakeSetUpdateTime = 300; // 5 minutes
+        fStakeCandidatesDirty = true;
+        fWalletCoinsDirty = true;
 
         //MultiSend
         vMultiSend.clear();
@@ -334,6 +441,7 @@ public:
     {
         zwalletMain = zwallet;
         zmasterTracker = std::unique_ptr<CzMASTERTracker>(new CzMASTERTracker(strWalletFile));
+        zmasterWitnessCache = std::unique_ptr<CzMASTERWitnessCache>(new CzMASTERWitnessCache(strWalletFile));
     }
 
     CzMASTERWallet* getZWallet() { return zwalletMain; }
@@ -388,7 +496,8 @@ public:
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed = true, const CCoinControl* coinControl = NULL, bool fIncludeZeroValue = false, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false, int nWatchonlyConfig = 1) const;
     std::map<CBitcoinAddress, std::vector<COutput> > AvailableCoinsByAddress(bool fConfirmed = true, CAmount maxCoinValue = 0);
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    static bool SelectCoinsExact(const std::vector<std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > >& vValue, const CAmount& nTargetValue, std::vector<char>& vfBest, int nMaxTries = COINSELECT_EXACT_MAX_TRIES);
 
     /// Get 1000DASH output and keys which can be used for the Masternode
     bool GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, std::string strTxHash = "", std::string strOutputIndex = "");
@@ -467,8 +576,10 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
+    void GetScanFilter(CWalletScanFilter& filter) const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
@@ -705,6 +816,27 @@ public:
 };
 
 
+/**
+ * Holds cs_wallet and a write batch on the wallet file while in scope, so the
+ * wallet database writes made meanwhile commit together. Does nothing for a
+ * NULL or memory only wallet; nested scopes join the outer batch.
+ */
+class CWalletBatch
+{
+private:
+    const CWallet* pwallet;
+    CWalletDB* pwalletdb;
+    bool fOwner;
+
+    CWalletBatch(const CWalletBatch&);
+    void operator=(const CWalletBatch&);
+
+public:
+    explicit CWalletBatch(const CWallet* pwalletIn);
+    ~CWalletBatch();
+};
+
+
 typedef std::map<std::string, std::string> mapValue_t;
 
 
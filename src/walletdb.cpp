@@ -8,6 +8,7 @@
 
 #include "walletdb.h"
 
+#include "accumulators.h"
 #include "base58.h"
 #include "protocol.h"
 #include "serialize.h"
@@ -1377,6 +1378,56 @@ std::map<uint256, std::vector<pair<uint256, uint32_t> > > CWalletDB::MapMintPool
     return mapPool;
 }
 
+bool CWalletDB::WriteWitnessState(const CAccumulatorWitnessState& state)
+{
+    return Write(make_pair(string("zwitness"), state.GetPubcoinHash()), state);
+}
+
+bool CWalletDB::EraseWitnessState(const uint256& hashPubcoin)
+{
+    return Erase(make_pair(string("zwitness"), hashPubcoin));
+}
+
+std::list<CAccumulatorWitnessState> CWalletDB::ListWitnessStates()
+{
+    std::list<CAccumulatorWitnessState> listStates;
+    Dbc* pcursor = GetCursor();
+    if (!pcursor)
+        throw runtime_error(std::string(__func__)+" : cannot create DB cursor");
+    unsigned int fFlags = DB_SET_RANGE;
+    for (;;)
+    {
+        // Read next record
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (fFlags == DB_SET_RANGE)
+            ssKey << make_pair(string("zwitness"), uint256(0));
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+        {
+            pcursor->close();
+            throw runtime_error(std::string(__func__)+" : error scanning DB");
+        }
+
+        // Unserialize
+        string strType;
+        ssKey >> strType;
+        if (strType != "zwitness")
+            break;
+
+        CAccumulatorWitnessState state;
+        ssValue >> state;
+
+        listStates.emplace_back(state);
+    }
+
+    pcursor->close();
+    return listStates;
+}
+
 std::list<CDeterministicMint> CWalletDB::ListDeterministicMints()
 {
     std::list<CDeterministicMint> listMints;
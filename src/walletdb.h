@@ -24,6 +24,7 @@
 
 class CAccount;
 class CAccountingEntry;
+class CAccumulatorWitnessState;
 struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
@@ -185,6 +186,9 @@ public:
     bool ReadZMASTERCount(uint32_t& nCount);
     std::map<uint256, std::vector<pair<uint256, uint32_t> > > MapMintPool();
     bool WriteMintPoolPair(const uint256& hashMasterSeed, const uint256& hashPubcoin, const uint32_t& nCount);
+    bool WriteWitnessState(const CAccumulatorWitnessState& state);
+    bool EraseWitnessState(const uint256& hashPubcoin);
+    std::list<CAccumulatorWitnessState> ListWitnessStates();
 
 
 private:
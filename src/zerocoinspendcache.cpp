@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zerocoinspendcache.h"
+
+#include "hash.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <set>
+
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Valid zerocoin spend cache. The key is a salted hash of the serial, the
+ * accumulator checksum and txout hash the spend commits to, the accumulator
+ * (modulus and value) it was checked against and the complete proof, so a different proof
+ * for the same (serial, checksum, txout hash) never hits a cached result.
+ */
+class CZerocoinSpendCache
+{
+private:
+    uint256 nonce;
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_spendcache;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+public:
+    CZerocoinSpendCache() : nHits(0), nMisses(0)
+    {
+        nonce = GetRandHash();
+    }
+
+    uint256 ComputeEntry(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* paramsAccumulator, const CBigNum& bnAccumulatorValue)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << spend.getCoinSerialNumber() << spend.getAccumulatorChecksum() << spend.getTxOutHash();
+        ss << paramsAccumulator->accumulatorParams.accumulatorModulus << bnAccumulatorValue << spend;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+        if (setValid.count(entry)) {
+            nHits++;
+            return true;
+        }
+        nMisses++;
+        return false;
+    }
+
+    void Set(const uint256& entry)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxzcspendcachesize", DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_spendcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize) {
+            // Evict a random entry, as in the signature cache
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(entry);
+    }
+
+    CZerocoinSpendCacheStats GetStats()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_spendcache);
+        CZerocoinSpendCacheStats stats;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        stats.nEntries = setValid.size();
+        return stats;
+    }
+};
+
+CZerocoinSpendCache spendCache;
+
+}
+
+bool IsZerocoinSpendVerified(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* paramsAccumulator, const CBigNum& bnAccumulatorValue)
+{
+    return spendCache.Get(spendCache.ComputeEntry(spend, paramsAccumulator, bnAccumulatorValue));
+}
+
+void SetZerocoinSpendVerified(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* paramsAccumulator, const CBigNum& bnAccumulatorValue)
+{
+    spendCache.Set(spendCache.ComputeEntry(spend, paramsAccumulator, bnAccumulatorValue));
+}
+
+CZerocoinSpendCacheStats GetZerocoinSpendCacheStats()
+{
+    return spendCache.GetStats();
+}
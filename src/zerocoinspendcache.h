@@ -0,0 +1,33 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MasterStake_ZEROCOINSPENDCACHE_H
+#define MasterStake_ZEROCOINSPENDCACHE_H
+
+#include "libzerocoin/CoinSpend.h"
+
+#include <stdint.h>
+
+/** Default for -maxzcspendcachesize, the number of verified zerocoin spends to remember */
+static const int64_t DEFAULT_MAX_ZEROCOIN_SPEND_CACHE_SIZE = 20000;
+
+/** Snapshot of the verified zerocoin spend cache counters */
+struct CZerocoinSpendCacheStats {
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEntries;
+};
+
+/**
+ * Check whether this exact spend was already verified against the given
+ * accumulator value. Entries are recorded by SetZerocoinSpendVerified once
+ * CoinSpend::Verify succeeds, so the RSA-group proofs are only checked once
+ * between mempool acceptance and block validation.
+ */
+bool IsZerocoinSpendVerified(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* paramsAccumulator, const CBigNum& bnAccumulatorValue);
+void SetZerocoinSpendVerified(const libzerocoin::CoinSpend& spend, const libzerocoin::ZerocoinParams* paramsAccumulator, const CBigNum& bnAccumulatorValue);
+
+CZerocoinSpendCacheStats GetZerocoinSpendCacheStats();
+
+#endif // MasterStake_ZEROCOINSPENDCACHE_H
@@ -3,11 +3,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "zmasterchain.h"
+#include "init.h"
 #include "invalid.h"
 #include "main.h"
 #include "txdb.h"
 #include "ui_interface.h"
 
+#include <atomic>
+
+#include <boost/thread.hpp>
+
 // 6 comes from OPCODE (1) + vch.size() (1) + BIGNUM size (4)
 #define SCRIPT_OFFSET 6
 // For Script size (BIGNUM/Uint256 size)
@@ -125,6 +130,42 @@ bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMin
     return true;
 }
 
+//Get the valid mints of a block from the zerocoinDB mint index, only reading the block from disk if it is not
+//indexed yet. denom selects a single denomination, ZQ_ERROR returns the mints of all denominations.
+bool BlockIndexToPubcoinList(const CBlockIndex* pindex, std::list<libzerocoin::PublicCoin>& listPubcoins, libzerocoin::CoinDenomination denom)
+{
+    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params(false);
+    uint256 hashBlock;
+    std::map<libzerocoin::CoinDenomination, std::vector<CBigNum> > mapMints;
+    if (zerocoinDB->ReadBlockMints(pindex->nHeight, hashBlock, mapMints) && hashBlock == pindex->GetBlockHash()) {
+        for (const auto& denomMints : mapMints) {
+            if (denom != libzerocoin::ZQ_ERROR && denomMints.first != denom)
+                continue;
+            for (const CBigNum& bnValue : denomMints.second)
+                listPubcoins.emplace_back(libzerocoin::PublicCoin(params, bnValue, denomMints.first));
+        }
+        return true;
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: failed to read block %d from disk", __func__, pindex->nHeight);
+
+    std::list<libzerocoin::PublicCoin> listBlockPubcoins;
+    if (!BlockToPubcoinList(block, listBlockPubcoins, true))
+        return error("%s: failed to get zerocoin mintlist from block %d", __func__, pindex->nHeight);
+
+    if (!WriteBlockMintIndex(pindex, listBlockPubcoins))
+        LogPrintf("%s: failed to index mints of block %d\n", __func__, pindex->nHeight);
+
+    for (const libzerocoin::PublicCoin& pubcoin : listBlockPubcoins) {
+        if (denom == libzerocoin::ZQ_ERROR || pubcoin.getDenomination() == denom)
+            listPubcoins.emplace_back(pubcoin);
+    }
+
+    return true;
+}
+
 void FindMints(std::vector<CMintMeta> vMintsToFind, std::vector<CMintMeta>& vMintsToUpdate, std::vector<CMintMeta>& vMissingMints)
 {
     // see which mints are in our public zerocoin database. The mint should be here if it exists, unless
@@ -253,80 +294,166 @@ bool IsSerialInBlockchain(const uint256& hashSerial, int& nHeightTx, uint256& tx
     return IsTransactionInChain(txidSpend, nHeightTx, tx);
 }
 
-std::string ReindexZerocoinDB()
+/** Zerocoin spends and mints of one block, parsed by the ReindexZerocoinDB reader threads */
+struct CZerocoinBlockData
 {
-    if (!zerocoinDB->WipeCoins("spends") || !zerocoinDB->WipeCoins("mints")) {
-        return _("Failed to wipe zerocoinDB");
-    }
-
-    uiInterface.ShowProgress(_("Reindexing zerocoin database..."), 0);
-
-    CBlockIndex* pindex = chainActive[Params().Zerocoin_StartHeight()];
+    bool fValid;
     std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpendInfo;
     std::vector<std::pair<libzerocoin::PublicCoin, uint256> > vMintInfo;
-    while (pindex) {
-        uiInterface.ShowProgress(_("Reindexing zerocoin database..."), std::max(1, std::min(99, (int)((double)(pindex->nHeight - Params().Zerocoin_StartHeight()) / (double)(chainActive.Height() - Params().Zerocoin_StartHeight()) * 100))));
+    std::list<libzerocoin::PublicCoin> listPubcoins;
 
-        if (pindex->nHeight % 1000 == 0)
-            LogPrintf("Reindexing zerocoin : block %d...\n", pindex->nHeight);
+    CZerocoinBlockData() : fValid(false) {}
+};
 
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex)) {
-            return _("Reindexing zerocoin failed");
-        }
+static void ReadZerocoinBlocks(const std::vector<CBlockIndex*>& vIndex, std::vector<CZerocoinBlockData>& vData, std::atomic<size_t>& nNext)
+{
+    for (size_t i = nNext++; i < vIndex.size() && !ShutdownRequested(); i = nNext++) {
+        CBlockIndex* pindex = vIndex[i];
+        CZerocoinBlockData& data = vData[i];
+        try {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex))
+                continue;
 
-        for (const CTransaction& tx : block.vtx) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                if (tx.IsCoinBase())
-                    break;
+            for (const CTransaction& tx : block.vtx) {
+                if (tx.IsCoinBase() || tx.vin.empty() || !tx.ContainsZerocoins())
+                    continue;
+
+                uint256 txid = tx.GetHash();
+                //Record Serials
+                if (tx.IsZerocoinSpend()) {
+                    for (auto& in : tx.vin) {
+                        if (!in.scriptSig.IsZerocoinSpend())
+                            continue;
 
-                if (tx.ContainsZerocoins()) {
-                    uint256 txid = tx.GetHash();
-                    //Record Serials
-                    if (tx.IsZerocoinSpend()) {
-                        for (auto& in : tx.vin) {
-                            if (!in.scriptSig.IsZerocoinSpend())
-                                continue;
-
-                            libzerocoin::CoinSpend spend = TxInToZerocoinSpend(in);
-                            vSpendInfo.push_back(make_pair(spend, txid));
-                        }
+                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(in);
+                        data.vSpendInfo.push_back(make_pair(spend, txid));
                     }
+                }
+
+                //Record mints
+                if (tx.IsZerocoinMint()) {
+                    for (auto& out : tx.vout) {
+                        if (!out.IsZerocoinMint())
+                            continue;
 
-                    //Record mints
-                    if (tx.IsZerocoinMint()) {
-                        for (auto& out : tx.vout) {
-                            if (!out.IsZerocoinMint())
-                                continue;
-
-                            CValidationState state;
-                            libzerocoin::PublicCoin coin(Params().Zerocoin_Params(pindex->nHeight < Params().Zerocoin_Block_V2_Start()));
-                            TxOutToPublicCoin(out, coin, state);
-                            vMintInfo.push_back(make_pair(coin, txid));
-                        }
+                        CValidationState state;
+                        libzerocoin::PublicCoin coin(Params().Zerocoin_Params(pindex->nHeight < Params().Zerocoin_Block_V2_Start()));
+                        TxOutToPublicCoin(out, coin, state);
+                        data.vMintInfo.push_back(make_pair(coin, txid));
                     }
                 }
             }
+
+            if (!BlockToPubcoinList(block, data.listPubcoins, true))
+                continue;
+
+            data.fValid = true;
+        } catch (std::exception& e) {
+            LogPrintf("%s: failed to parse block %d: %s\n", __func__, pindex->nHeight, e.what());
         }
+    }
+}
 
-        // Flush the zerocoinDB to disk every 100 blocks
-        if (pindex->nHeight % 100 == 0) {
-            if ((!vSpendInfo.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpendInfo)) || (!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo)))
+//Read and parse the blocks on all cores, the results are in the same order as vIndex
+static void ParseZerocoinBlocks(const std::vector<CBlockIndex*>& vIndex, std::vector<CZerocoinBlockData>& vData)
+{
+    vData.assign(vIndex.size(), CZerocoinBlockData());
+    std::atomic<size_t> nNext(0);
+    boost::thread_group threadGroup;
+    unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ReadZerocoinBlocks, boost::cref(vIndex), boost::ref(vData), boost::ref(nNext)));
+    threadGroup.join_all();
+}
+
+static std::vector<CBlockIndex*> NextReindexChunk(CBlockIndex* pindex)
+{
+    std::vector<CBlockIndex*> vIndex;
+    for (; pindex && vIndex.size() < REINDEX_ZEROCOIN_CHUNK_SIZE; pindex = chainActive.Next(pindex))
+        vIndex.push_back(pindex);
+    return vIndex;
+}
+
+std::string ReindexZerocoinDB()
+{
+    //Resume from the progress marker if the last reindex did not finish
+    int nHeightStart = Params().Zerocoin_StartHeight();
+    int nHeightDone;
+    uint256 hashBlockDone;
+    if (zerocoinDB->ReadReindexProgress("zerocoin", nHeightDone, hashBlockDone) && nHeightDone <= chainActive.Height() &&
+        chainActive[nHeightDone]->GetBlockHash() == hashBlockDone) {
+        LogPrintf("%s: resuming zerocoin reindex after block %d\n", __func__, nHeightDone);
+        nHeightStart = nHeightDone + 1;
+    } else {
+        //A marker that matches no block is written before wiping, so that a crash while wiping
+        //or before the first chunk restarts the reindex from scratch on the next start
+        if (!zerocoinDB->WriteReindexProgress("zerocoin", nHeightStart - 1, uint256(0)))
+            return _("Error writing zerocoinDB to disk");
+
+        if (!zerocoinDB->WipeCoins("spends") || !zerocoinDB->WipeCoins("mints")) {
+            return _("Failed to wipe zerocoinDB");
+        }
+
+        CBlockIndex* pindexPrev = chainActive[nHeightStart - 1];
+        if (!zerocoinDB->WriteReindexProgress("zerocoin", pindexPrev->nHeight, pindexPrev->GetBlockHash()))
+            return _("Error writing zerocoinDB to disk");
+    }
+
+    uiInterface.ShowProgress(_("Reindexing zerocoin database..."), 0);
+
+    //Blocks are read and parsed in parallel, one chunk ahead of the chunk that is written to the database in order
+    std::vector<CBlockIndex*> vIndexNext = NextReindexChunk(chainActive[nHeightStart]);
+    std::vector<CZerocoinBlockData> vDataNext;
+    boost::thread threadParse(boost::bind(&ParseZerocoinBlocks, boost::cref(vIndexNext), boost::ref(vDataNext)));
+    while (true) {
+        threadParse.join();
+        std::vector<CBlockIndex*> vIndex;
+        std::vector<CZerocoinBlockData> vData;
+        vIndex.swap(vIndexNext);
+        vData.swap(vDataNext);
+        if (vIndex.empty() || ShutdownRequested())
+            break;
+
+        vIndexNext = NextReindexChunk(chainActive.Next(vIndex.back()));
+        threadParse = boost::thread(boost::bind(&ParseZerocoinBlocks, boost::cref(vIndexNext), boost::ref(vDataNext)));
+
+        std::vector<std::pair<libzerocoin::CoinSpend, uint256> > vSpendInfo;
+        std::vector<std::pair<libzerocoin::PublicCoin, uint256> > vMintInfo;
+        for (unsigned int i = 0; i < vIndex.size(); i++) {
+            CBlockIndex* pindex = vIndex[i];
+            if (!vData[i].fValid) {
+                threadParse.join();
+                return _("Reindexing zerocoin failed");
+            }
+
+            if (pindex->nHeight % 1000 == 0)
+                LogPrintf("Reindexing zerocoin : block %d...\n", pindex->nHeight);
+
+            vSpendInfo.insert(vSpendInfo.end(), vData[i].vSpendInfo.begin(), vData[i].vSpendInfo.end());
+            vMintInfo.insert(vMintInfo.end(), vData[i].vMintInfo.begin(), vData[i].vMintInfo.end());
+            if (!WriteBlockMintIndex(pindex, vData[i].listPubcoins)) {
+                threadParse.join();
                 return _("Error writing zerocoinDB to disk");
-            vSpendInfo.clear();
-            vMintInfo.clear();
+            }
         }
 
-        pindex = chainActive.Next(pindex);
+        // Flush the chunk to disk before recording the progress
+        CBlockIndex* pindexLast = vIndex.back();
+        if ((!vSpendInfo.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpendInfo)) || (!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo)) ||
+            !zerocoinDB->WriteReindexProgress("zerocoin", pindexLast->nHeight, pindexLast->GetBlockHash())) {
+            threadParse.join();
+            return _("Error writing zerocoinDB to disk");
+        }
+
+        uiInterface.ShowProgress(_("Reindexing zerocoin database..."), std::max(1, std::min(99, (int)((double)(pindexLast->nHeight - Params().Zerocoin_StartHeight()) / (double)(chainActive.Height() - Params().Zerocoin_StartHeight()) * 100))));
     }
     uiInterface.ShowProgress("", 100);
 
-    // Final flush to disk in case any remaining information exists
-    if ((!vSpendInfo.empty() && !zerocoinDB->WriteCoinSpendBatch(vSpendInfo)) || (!vMintInfo.empty() && !zerocoinDB->WriteCoinMintBatch(vMintInfo)))
+    // An interrupted reindex keeps its progress marker and is resumed on the next start
+    if (!ShutdownRequested() && !zerocoinDB->EraseReindexProgress("zerocoin"))
         return _("Error writing zerocoinDB to disk");
 
-    uiInterface.ShowProgress("", 100);
-
     return "";
 }
 
@@ -392,3 +519,12 @@ std::list<libzerocoin::CoinDenomination> ZerocoinSpendListFromBlock(const CBlock
     return vSpends;
 }
 
+//Record the mints of a block in the zerocoinDB mint index, keyed by its height and hash
+bool WriteBlockMintIndex(const CBlockIndex* pindex, const std::list<libzerocoin::PublicCoin>& listPubcoins)
+{
+    std::map<libzerocoin::CoinDenomination, std::vector<CBigNum> > mapMints;
+    for (const libzerocoin::PublicCoin& pubcoin : listPubcoins)
+        mapMints[pubcoin.getDenomination()].emplace_back(pubcoin.getValue());
+
+    return zerocoinDB->WriteBlockMints(pindex->nHeight, pindex->GetBlockHash(), mapMints);
+}
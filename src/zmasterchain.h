@@ -12,6 +12,7 @@
 #include <string>
 
 class CBlock;
+class CBlockIndex;
 class CBigNum;
 struct CMintMeta;
 class CTransaction;
@@ -21,6 +22,10 @@ class CValidationState;
 class CZerocoinMint;
 class uint256;
 
+/** Number of blocks that ReindexZerocoinDB parses in parallel and writes between progress markers */
+static const unsigned int REINDEX_ZEROCOIN_CHUNK_SIZE = 1000;
+
+bool BlockIndexToPubcoinList(const CBlockIndex* pindex, std::list<libzerocoin::PublicCoin>& listPubcoins, libzerocoin::CoinDenomination denom = libzerocoin::ZQ_ERROR);
 bool BlockToMintValueVector(const CBlock& block, const libzerocoin::CoinDenomination denom, std::vector<CBigNum>& vValues);
 bool BlockToPubcoinList(const CBlock& block, std::list<libzerocoin::PublicCoin>& listPubcoins, bool fFilterInvalid);
 bool BlockToZerocoinMintList(const CBlock& block, std::list<CZerocoinMint>& vMints, bool fFilterInvalid);
@@ -36,6 +41,7 @@ bool RemoveSerialFromDB(const CBigNum& bnSerial);
 std::string ReindexZerocoinDB();
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
 bool TxOutToPublicCoin(const CTxOut& txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state);
+bool WriteBlockMintIndex(const CBlockIndex* pindex, const std::list<libzerocoin::PublicCoin>& listPubcoins);
 std::list<libzerocoin::CoinDenomination> ZerocoinSpendListFromBlock(const CBlock& block, bool fFilterInvalid);
 
 
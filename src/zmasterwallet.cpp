@@ -11,9 +11,11 @@
 #include "primitives/deterministicmint.h"
 #include "zmasterchain.h"
 
+#include <boost/thread.hpp>
+
 using namespace libzerocoin;
 
-CzMASTERWallet::CzMASTERWallet(std::string strWalletFile)
+CzMASTERWallet::CzMASTERWallet(std::string strWalletFile) : nMintPoolDerived(0), nMintPoolDeriveTime(0), nMintPoolThreads(0)
 {
     this->strWalletFile = strWalletFile;
     CWalletDB walletdb(strWalletFile);
@@ -104,7 +106,7 @@ void CzMASTERWallet::AddToMintPool(const std::pair<uint256, uint32_t>& pMint, bo
 }
 
 //Add the next 20 mints to the mint pool
-void CzMASTERWallet::GenerateMintPool(uint32_t nCountStart, uint32_t nCountEnd)
+void CzMASTERWallet::GenerateMintPool(uint32_t nCountStart, uint32_t nCountEnd, int nThreads)
 {
 
     //Is locked
@@ -120,38 +122,90 @@ void CzMASTERWallet::GenerateMintPool(uint32_t nCountStart, uint32_t nCountEnd)
     if (nCountEnd > 0)
         nStop = std::max(n, n + nCountEnd);
 
-    bool fFound;
-
-    uint256 hashSeed = Hash(seedMaster.begin(), seedMaster.end());
-    LogPrintf("%s : n=%d nStop=%d\n", __func__, n, nStop - 1);
+    // Prevent unnecessary repeated minted
+    std::set<uint32_t> setPoolCounts;
+    for (auto& pair : mintPool)
+        setPoolCounts.insert(pair.second);
+    std::vector<uint32_t> vCounts;
     for (uint32_t i = n; i < nStop; ++i) {
-        if (ShutdownRequested())
-            return;
+        if (!setPoolCounts.count(i))
+            vCounts.push_back(i);
+    }
+    if (vCounts.empty())
+        return;
 
-        fFound = false;
+    if (nThreads <= 0)
+        nThreads = GetArg("-mintpoolthreads", DEFAULT_MINTPOOLTHREADS);
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, (int)std::min<size_t>(vCounts.size(), MINTPOOL_BATCH_SIZE)));
 
-        // Prevent unnecessary repeated minted
-        for (auto& pair : mintPool) {
-            if(pair.second == i) {
-                fFound = true;
+    uint256 hashSeed = Hash(seedMaster.begin(), seedMaster.end());
+    LogPrintf("%s : n=%d nStop=%d threads=%d\n", __func__, n, nStop - 1, nThreads);
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nAdded = 0;
+    bool fStop = false;
+    for (size_t nBatch = 0; nBatch < vCounts.size() && !fStop; nBatch += MINTPOOL_BATCH_SIZE) {
+        size_t nBatchEnd = std::min(vCounts.size(), nBatch + MINTPOOL_BATCH_SIZE);
+
+        // The threads take counts in turn; each result lands in the count's slot
+        std::vector<uint256> vHashes(nBatchEnd - nBatch);
+        std::vector<char> vDone(nBatchEnd - nBatch, 0);
+        std::atomic<size_t> nNext(nBatch);
+        auto derive = [&]() {
+            try {
+                size_t j;
+                while ((j = nNext++) < nBatchEnd && !ShutdownRequested()) {
+                    CBigNum bnValue;
+                    CBigNum bnSerial;
+                    CBigNum bnRandomness;
+                    CKey key;
+                    SeedToZMASTER(GetZerocoinSeed(vCounts[j]), bnValue, bnSerial, bnRandomness, key);
+                    vHashes[j - nBatch] = GetPubCoinHash(bnValue);
+                    vDone[j - nBatch] = 1;
+                }
+            } catch (std::exception& e) {
+                LogPrintf("%s : %s\n", __func__, e.what());
+            }
+        };
+        boost::thread_group threads;
+        for (int t = 1; t < nThreads; t++)
+            threads.create_thread(derive);
+        derive();
+        threads.join_all();
+
+        // Add in count order up to the first gap, as deriving one by one would
+        std::vector<std::pair<uint256, uint32_t> > vPoolPairs;
+        for (size_t j = nBatch; j < nBatchEnd; j++) {
+            if (!vDone[j - nBatch]) {
+                fStop = true;
                 break;
             }
+            vPoolPairs.push_back(std::make_pair(vHashes[j - nBatch], vCounts[j]));
+            mintPool.Add(vPoolPairs.back());
+            LogPrintf("%s : %s count=%d\n", __func__, vHashes[j - nBatch].GetHex().substr(0, 6), vCounts[j]);
         }
+        nAdded += vPoolPairs.size();
 
-        if(fFound)
-            continue;
+        // Database the new pairs in one batch rather than a commit each
+        CWalletBatch walletBatch(pwalletMain);
+        CWalletDB walletdb(strWalletFile);
+        for (const std::pair<uint256, uint32_t>& pPair : vPoolPairs)
+            walletdb.WriteMintPoolPair(hashSeed, pPair.first, pPair.second);
+    }
 
-        uint512 seedZerocoin = GetZerocoinSeed(i);
-        CBigNum bnValue;
-        CBigNum bnSerial;
-        CBigNum bnRandomness;
-        CKey key;
-        SeedToZMASTER(seedZerocoin, bnValue, bnSerial, bnRandomness, key);
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    nMintPoolDerived += nAdded;
+    nMintPoolDeriveTime += nTime;
+    nMintPoolThreads = nThreads;
+    LogPrintf("%s : derived %u mints with %d threads in %.2fs\n", __func__, nAdded, nThreads, nTime * 0.000001);
+}
 
-        mintPool.Add(bnValue, i);
-        CWalletDB(strWalletFile).WriteMintPoolPair(hashSeed, GetPubCoinHash(bnValue), i);
-        LogPrintf("%s : %s count=%d\n", __func__, bnValue.GetHex().substr(0, 6), i);
-    }
+void CzMASTERWallet::GetGenerationStats(uint64_t& nDerived, int64_t& nTimeMicros, int& nThreads)
+{
+    nDerived = nMintPoolDerived;
+    nTimeMicros = nMintPoolDeriveTime;
+    nThreads = nMintPoolThreads;
 }
 
 // pubcoin hashes are stored to db so that a full accounting of mints belonging to the seed can be tracked without regenerating
@@ -259,6 +313,8 @@ void CzMASTERWallet::SyncWithChain(bool fGenerateMintPool)
                 if (mapBlockIndex.count(hashBlock))
                     pindex = mapBlockIndex.at(hashBlock);
 
+                // The transaction and the mint state are written in one batch
+                CWalletBatch walletBatch(pwalletMain);
                 if (!setAddedTx.count(txHash)) {
                     CBlock block;
                     CWalletTx wtx(pwalletMain, tx);
@@ -372,9 +428,7 @@ void CzMASTERWallet::SeedToZMASTER(const uint512& seedZerocoin, CBigNum& bnValue
 
     //See if serial and randomness make a valid commitment
     // Generate a Pedersen commitment to the serial number
-    CBigNum commitmentValue = params->coinCommitmentGroup.g.pow_mod(bnSerial, params->coinCommitmentGroup.modulus).mul_mod(
-                        params->coinCommitmentGroup.h.pow_mod(bnRandomness, params->coinCommitmentGroup.modulus),
-                        params->coinCommitmentGroup.modulus);
+    CBigNum commitmentValue = params->coinCommitmentGroup.powGH(bnSerial, bnRandomness);
 
     CBigNum random;
     uint256 attempts256 = 0;
@@ -395,7 +449,7 @@ void CzMASTERWallet::SeedToZMASTER(const uint512& seedZerocoin, CBigNum& bnValue
                               attempts256.begin(), attempts256.end());
         random.setuint256(hashRandomness);
         bnRandomness = (bnRandomness + random) % params->coinCommitmentGroup.groupOrder;
-        commitmentValue = commitmentValue.mul_mod(params->coinCommitmentGroup.h.pow_mod(random, params->coinCommitmentGroup.modulus), params->coinCommitmentGroup.modulus);
+        commitmentValue = commitmentValue.mul_mod(params->coinCommitmentGroup.powH(random), params->coinCommitmentGroup.modulus);
     }
 }
 
@@ -5,6 +5,7 @@
 #ifndef MasterStake_ZMASTERWALLET_H
 #define MasterStake_ZMASTERWALLET_H
 
+#include <atomic>
 #include <map>
 #include "libzerocoin/Coin.h"
 #include "mintpool.h"
@@ -21,6 +22,11 @@ private:
     std::string strWalletFile;
     CMintPool mintPool;
 
+    //! Mints derived for the pool so far, the time it took and the threads of the last run
+    std::atomic<uint64_t> nMintPoolDerived;
+    std::atomic<int64_t> nMintPoolDeriveTime;
+    std::atomic<int> nMintPoolThreads;
+
 public:
     CzMASTERWallet(std::string strWalletFile);
 
@@ -32,7 +38,8 @@ public:
     void GenerateMint(const uint32_t& nCount, const libzerocoin::CoinDenomination denom, libzerocoin::PrivateCoin& coin, CDeterministicMint& dMint);
     void GetState(int& nCount, int& nLastGenerated);
     bool RegenerateMint(const CDeterministicMint& dMint, CZerocoinMint& mint);
-    void GenerateMintPool(uint32_t nCountStart = 0, uint32_t nCountEnd = 0);
+    void GenerateMintPool(uint32_t nCountStart = 0, uint32_t nCountEnd = 0, int nThreads = 0);
+    void GetGenerationStats(uint64_t& nDerived, int64_t& nTimeMicros, int& nThreads);
     bool LoadMintPoolFromDB();
     void RemoveMintsFromPool(const std::vector<uint256>& vPubcoinHashes);
     bool SetMintSeen(const CBigNum& bnValue, const int& nHeight, const uint256& txid, const libzerocoin::CoinDenomination& denom);
@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmasterwitness.h"
+#include "main.h"
+#include "util.h"
+#include "walletdb.h"
+
+using namespace std;
+
+CzMASTERWitnessCache::CzMASTERWitnessCache(std::string strWalletFile)
+{
+    this->strWalletFile = strWalletFile;
+    fLoaded = false;
+}
+
+void CzMASTERWitnessCache::Load()
+{
+    if (fLoaded)
+        return;
+
+    for (const CAccumulatorWitnessState& state : CWalletDB(strWalletFile).ListWitnessStates())
+        mapWitness[state.GetPubcoinHash()] = state;
+
+    LogPrint("zero", "%s: loaded %d witnesses\n", __func__, mapWitness.size());
+    fLoaded = true;
+}
+
+bool CzMASTERWitnessCache::Get(const uint256& hashPubcoin, CAccumulatorWitnessState& state)
+{
+    LOCK(cs_witness);
+    Load();
+    auto it = mapWitness.find(hashPubcoin);
+    if (it == mapWitness.end())
+        return false;
+
+    state = it->second;
+    return true;
+}
+
+//Unspent mints that do not have a witness yet
+std::vector<uint256> CzMASTERWitnessCache::GetMissing(const std::set<uint256>& setPubcoinsUnspent)
+{
+    LOCK(cs_witness);
+    Load();
+    vector<uint256> vMissing;
+    for (const uint256& hashPubcoin : setPubcoinsUnspent) {
+        if (!mapWitness.count(hashPubcoin))
+            vMissing.emplace_back(hashPubcoin);
+    }
+
+    return vMissing;
+}
+
+void CzMASTERWitnessCache::Update(const CAccumulatorWitnessState& state)
+{
+    if (state.IsNull())
+        return;
+
+    LOCK(cs_witness);
+    Load();
+    uint256 hashPubcoin = state.GetPubcoinHash();
+    auto it = mapWitness.find(hashPubcoin);
+    if (it != mapWitness.end() && it->second.nHeightEnd == state.nHeightEnd && it->second.hashBlockLast == state.hashBlockLast)
+        return;
+
+    mapWitness[hashPubcoin] = state;
+    if (!CWalletDB(strWalletFile).WriteWitnessState(state))
+        LogPrintf("%s: failed to write witness for pubcoinhash %s\n", __func__, hashPubcoin.GetHex());
+}
+
+void CzMASTERWitnessCache::Advance(const CBlockIndex* pindexTip, const std::set<uint256>& setPubcoinsUnspent)
+{
+    LOCK(cs_witness);
+    Load();
+    CWalletDB walletdb(strWalletFile);
+    int nHeightEnd = GetWitnessStateHeight(pindexTip->nHeight);
+
+    //Spent mints do not need a witness anymore, and witnesses that were reorganized out of the chain
+    //are recomputed on the next spend
+    vector<CAccumulatorWitnessState> vWitnessState;
+    for (auto it = mapWitness.begin(); it != mapWitness.end();) {
+        if (!setPubcoinsUnspent.count(it->first) || !IsWitnessStateInChain(it->second)) {
+            walletdb.EraseWitnessState(it->first);
+            it = mapWitness.erase(it);
+            continue;
+        }
+        if (it->second.nHeightEnd < nHeightEnd)
+            vWitnessState.emplace_back(it->second);
+        ++it;
+    }
+
+    if (vWitnessState.empty())
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    if (!AdvanceAccumulatorWitnesses(vWitnessState, nHeightEnd)) {
+        LogPrintf("%s: failed to advance witnesses to height %d\n", __func__, nHeightEnd);
+        return;
+    }
+
+    for (const CAccumulatorWitnessState& state : vWitnessState) {
+        mapWitness[state.GetPubcoinHash()] = state;
+        walletdb.WriteWitnessState(state);
+    }
+
+    LogPrint("zero", "%s: advanced %d witnesses to height %d in %.2fms\n", __func__, vWitnessState.size(), nHeightEnd,
+             0.001 * (GetTimeMicros() - nTimeStart));
+}
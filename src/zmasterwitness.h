@@ -0,0 +1,37 @@
+// Copyright (c) 2018 The PIVX Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MasterStake_ZMASTERWITNESS_H
+#define MasterStake_ZMASTERWITNESS_H
+
+#include "accumulators.h"
+#include "sync.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+/**
+ * Accumulated witnesses of the wallet's mints, stored in the wallet database.
+ * A witness is started for every confirmed mint and advanced on every accumulator
+ * checkpoint change, so that creating a spend or stake, the first one included,
+ * only has to accumulate the most recent blocks.
+ */
+class CzMASTERWitnessCache
+{
+private:
+    mutable CCriticalSection cs_witness;
+    std::string strWalletFile;
+    std::map<uint256, CAccumulatorWitnessState> mapWitness; //pubcoinhash, witness state
+    bool fLoaded;
+    void Load();
+public:
+    CzMASTERWitnessCache(std::string strWalletFile);
+    bool Get(const uint256& hashPubcoin, CAccumulatorWitnessState& state);
+    std::vector<uint256> GetMissing(const std::set<uint256>& setPubcoinsUnspent);
+    void Update(const CAccumulatorWitnessState& state);
+    void Advance(const CBlockIndex* pindexTip, const std::set<uint256>& setPubcoinsUnspent);
+};
+
+#endif //MasterStake_ZMASTERWITNESS_H